@@ -0,0 +1,737 @@
+/*
+ * Checks for the parts of libchime which don't need a server: date
+ * parsing, object collections, data message reassembly, the audio jitter
+ * buffer and the bundled websocket framing and compression. Run by
+ * 'make check'; with -m perf the timed checks run for longer.
+ */
+#include <glib.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "chime/chime-connection.h"
+#include "chime/chime-call-audio.h"
+
+static void check_parse_iso8601(void)
+{
+	static const gchar *good[] = {
+		"2017-10-19T12:34:56.789Z",
+		"2020-02-29T00:00:00.000Z",
+		"2000-02-29T23:59:59Z",
+		"1970-01-01T00:00:00.000Z",
+		"2021-12-31T23:59:59.999999Z",
+		"2021-04-30T08:00:00.5Z",
+	};
+	static const gchar *bad[] = {
+		"2020-02-30T00:00:00.000Z",
+		"2020-02-31T00:00:00.000Z",
+		"2021-02-29T00:00:00.000Z",
+		"1900-02-29T00:00:00.000Z",
+		"2020-04-31T00:00:00.000Z",
+		"not a date",
+	};
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS(good); i++) {
+		GTimeVal tv;
+		gint64 usec;
+
+		g_assert_true(g_time_val_from_iso8601(good[i], &tv));
+		g_assert_true(chime_parse_iso8601(good[i], &usec));
+		g_assert_cmpint(usec, ==, (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec);
+	}
+	for (i = 0; i < G_N_ELEMENTS(bad); i++) {
+		gint64 usec;
+
+		g_assert_false(chime_parse_iso8601(bad[i], &usec));
+	}
+}
+
+/* The fast path against g_time_val_from_iso8601(), on the format the
+ * server actually sends */
+static void check_parse_iso8601_speed(void)
+{
+	int count = g_test_perf() ? 1000000 : 100000;
+	gchar **stamps = g_new0(gchar *, 1001);
+	gint64 start, fast, slow, usec, sum = 0;
+	GTimeVal tv;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		GDateTime *dt = g_date_time_new_utc(2010 + i % 12, 1 + i % 12, 1 + i % 28,
+						    i % 24, i % 60, (i % 60000) / 1000.0);
+		gchar *s = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%S");
+
+		stamps[i] = g_strdup_printf("%s.%03dZ", s, i);
+		g_free(s);
+		g_date_time_unref(dt);
+	}
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < count; i++) {
+		g_assert_true(chime_parse_iso8601(stamps[i % 1000], &usec));
+		sum += usec;
+	}
+	fast = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < count; i++) {
+		g_assert_true(g_time_val_from_iso8601(stamps[i % 1000], &tv));
+		sum -= (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+	}
+	slow = g_get_monotonic_time() - start;
+
+	/* Both come to the same total */
+	g_assert_cmpint(sum, ==, 0);
+
+	g_test_minimized_result((gdouble)fast * 1000 / count,
+				"chime_parse_iso8601() %.0f ns, g_time_val_from_iso8601() %.0f ns",
+				(gdouble)fast * 1000 / count, (gdouble)slow * 1000 / count);
+	g_strfreev(stamps);
+}
+
+static void check_data_reassembly(void)
+{
+	struct audio_data_slot slot = { 0 };
+	guint64 map[4] = { 0 };
+
+	slot.len = 200;
+	slot.map = map;
+
+	/* Exactly one map word, then the same fragment again */
+	g_assert_false(chime_call_audio_mark_data_received(&slot, 64, 128));
+	g_assert_cmpint(slot.received, ==, 64);
+	g_assert_false(chime_call_audio_mark_data_received(&slot, 64, 128));
+	g_assert_cmpint(slot.received, ==, 64);
+
+	/* The tail before the middle, then overlapping both */
+	g_assert_false(chime_call_audio_mark_data_received(&slot, 150, 200));
+	g_assert_cmpint(slot.received, ==, 114);
+	g_assert_false(chime_call_audio_mark_data_received(&slot, 100, 160));
+	g_assert_cmpint(slot.received, ==, 136);
+
+	/* Complete only once the very first byte turns up */
+	g_assert_false(chime_call_audio_mark_data_received(&slot, 1, 64));
+	g_assert_cmpint(slot.received, ==, 199);
+	g_assert_true(chime_call_audio_mark_data_received(&slot, 0, 1));
+	g_assert_cmpint(slot.received, ==, 200);
+}
+
+/* Random messages, each cut into random fragments which then arrive
+ * shuffled, with random overlapping duplicates mixed in. The distinct
+ * byte count must match a plain byte-per-byte reference throughout. */
+static void check_data_reassembly_fuzz(void)
+{
+	int count = g_test_perf() ? 10000 : 500;
+	gint64 elapsed = 0, fed = 0;
+	int m;
+
+	for (m = 0; m < count; m++) {
+		struct audio_data_slot slot = { 0 };
+		gint32 len = g_test_rand_int_range(1, 65536);
+		GArray *frags = g_array_new(FALSE, FALSE, sizeof(gint32) * 2);
+		guint8 *seen = g_malloc0(len);
+		gint32 covered = 0, frag[2];
+		gint64 start;
+		int i, j;
+
+		slot.len = len;
+		slot.map = g_new0(guint64, (len + 63) / 64);
+
+		for (frag[0] = 0; frag[0] < len; frag[0] = frag[1]) {
+			frag[1] = MIN(len, frag[0] + g_test_rand_int_range(1, 1500));
+			g_array_append_val(frags, frag);
+		}
+		for (i = frags->len / 4; i; i--) {
+			frag[0] = g_test_rand_int_range(0, len);
+			frag[1] = MIN(len, frag[0] + g_test_rand_int_range(1, 3000));
+			g_array_append_val(frags, frag);
+		}
+		for (i = frags->len - 1; i > 0; i--) {
+			j = g_test_rand_int_range(0, i + 1);
+			memcpy(frag, &g_array_index(frags, gint32, j * 2), sizeof(frag));
+			memcpy(&g_array_index(frags, gint32, j * 2),
+			       &g_array_index(frags, gint32, i * 2), sizeof(frag));
+			memcpy(&g_array_index(frags, gint32, i * 2), frag, sizeof(frag));
+		}
+
+		for (i = 0; i < frags->len; i++) {
+			gint32 *f = &g_array_index(frags, gint32, i * 2);
+			gboolean done = chime_call_audio_mark_data_received(&slot, f[0], f[1]);
+
+			for (j = f[0]; j < f[1]; j++) {
+				if (!seen[j]) {
+					seen[j] = 1;
+					covered++;
+				}
+			}
+			g_assert_cmpint(slot.received, ==, covered);
+			g_assert_true(done == (covered == len));
+		}
+		g_assert_cmpint(covered, ==, len);
+
+		/* Again from scratch, timed without the reference */
+		memset(slot.map, 0, (len + 63) / 64 * sizeof(guint64));
+		slot.received = 0;
+		start = g_get_monotonic_time();
+		for (i = 0; i < frags->len; i++) {
+			gint32 *f = &g_array_index(frags, gint32, i * 2);
+
+			chime_call_audio_mark_data_received(&slot, f[0], f[1]);
+			fed += f[1] - f[0];
+		}
+		elapsed += g_get_monotonic_time() - start;
+		g_assert_cmpint(slot.received, ==, len);
+
+		g_array_free(frags, TRUE);
+		g_free(slot.map);
+		g_free(seen);
+	}
+
+	g_test_maximized_result((gdouble)fed / MAX(elapsed, 1),
+				"%d messages, fragments marked at %.0f MB/s",
+				count, (gdouble)fed / MAX(elapsed, 1));
+}
+
+static ChimeCallAudio *jb_new(void)
+{
+	ChimeCallAudio *audio = g_new0(ChimeCallAudio, 1);
+
+	g_mutex_init(&audio->rx_lock);
+	g_mutex_init(&audio->rt_lock);
+	return audio;
+}
+
+static void jb_free(ChimeCallAudio *audio)
+{
+	chime_call_audio_jb_reset(audio);
+	g_assert_cmpuint(audio->jb_held, ==, 0);
+	g_mutex_clear(&audio->rx_lock);
+	g_mutex_clear(&audio->rt_lock);
+	g_free(audio);
+}
+
+/* Feed frames 'base + seqs[i]', each arriving exactly on time so that
+ * the jitter (and thus the target depth) stays at zero. */
+static void jb_feed(ChimeCallAudio *audio, guint16 base, const gint *seqs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		chime_call_audio_jb_receive(audio, base + seqs[i], gst_buffer_new(),
+					    (gint64)seqs[i] * 20000, seqs[i] * 320);
+}
+
+static void check_jitter_buffer(void)
+{
+	static const gint in_order[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	static const gint reorder[] = { 0, 2, 1, 3 };
+	static const gint duplicate[] = { 0, 2, 2, 1 };
+	static const gint loss[] = { 0, 2, 3, 1 };
+	static const gint jump[] = { 0, 5000, 5001 };
+	ChimeCallAudio *audio;
+
+	audio = jb_new();
+	jb_feed(audio, 0, in_order, G_N_ELEMENTS(in_order));
+	g_assert_cmpuint(audio->rx_stats.received, ==, 10);
+	g_assert_cmpuint(audio->rx_stats.lost, ==, 0);
+	g_assert_cmpuint(audio->rx_stats.reordered, ==, 0);
+	g_assert_cmpuint(audio->rx_stats.jitter_ms, ==, 0);
+	g_assert_cmpuint(audio->jb_held, ==, 0);
+	jb_free(audio);
+
+	/* Across the 16-bit wrap, too */
+	audio = jb_new();
+	jb_feed(audio, 65534, reorder, G_N_ELEMENTS(reorder));
+	g_assert_cmpuint(audio->rx_stats.received, ==, 4);
+	g_assert_cmpuint(audio->rx_stats.reordered, ==, 1);
+	g_assert_cmpuint(audio->rx_stats.lost, ==, 0);
+	g_assert_cmpuint(audio->jb_held, ==, 0);
+	jb_free(audio);
+
+	audio = jb_new();
+	jb_feed(audio, 100, duplicate, G_N_ELEMENTS(duplicate));
+	g_assert_cmpuint(audio->rx_stats.received, ==, 3);
+	g_assert_cmpuint(audio->rx_stats.duplicates, ==, 1);
+	g_assert_cmpuint(audio->rx_stats.lost, ==, 0);
+	jb_free(audio);
+
+	/* Frame 1 is given up on once two are waiting behind it */
+	audio = jb_new();
+	jb_feed(audio, 100, loss, 3);
+	g_assert_cmpuint(audio->rx_stats.lost, ==, 1);
+	g_assert_cmpuint(audio->jb_held, ==, 0);
+	jb_feed(audio, 100, loss + 3, 1);
+	g_assert_cmpuint(audio->rx_stats.late, ==, 1);
+	g_assert_cmpuint(audio->rx_stats.received, ==, 3);
+	jb_free(audio);
+
+	/* A restarted stream is neither loss nor lateness */
+	audio = jb_new();
+	chime_call_audio_jb_receive(audio, jump[0], gst_buffer_new(), 0, 0);
+	chime_call_audio_jb_receive(audio, jump[1], gst_buffer_new(), 20000, 320);
+	chime_call_audio_jb_receive(audio, jump[2], gst_buffer_new(), 40000, 640);
+	g_assert_cmpuint(audio->rx_stats.received, ==, 3);
+	g_assert_cmpuint(audio->rx_stats.lost, ==, 0);
+	g_assert_cmpuint(audio->rx_stats.late, ==, 0);
+	jb_free(audio);
+}
+
+/* With every other frame 80ms late the buffer must grow deep enough to
+ * wait out a three-frame gap, which at zero jitter would be loss. */
+static void check_jitter_target(void)
+{
+	static const gint gap[] = { 101, 102, 103, 100 };
+	ChimeCallAudio *audio = jb_new();
+	int i;
+
+	for (i = 0; i < 100; i++)
+		chime_call_audio_jb_receive(audio, i, gst_buffer_new(),
+					    (gint64)i * 20000 + (i & 1) * 80000, i * 320);
+	g_assert_cmpuint(audio->rx_stats.jitter_ms, >=, 70);
+	g_assert_cmpuint(audio->rx_stats.jitter_ms, <=, 80);
+	g_assert_cmpuint(audio->rx_stats.lost, ==, 0);
+
+	for (i = 0; i < G_N_ELEMENTS(gap); i++)
+		chime_call_audio_jb_receive(audio, gap[i], gst_buffer_new(),
+					    (gint64)gap[i] * 20000, gap[i] * 320);
+	g_assert_cmpuint(audio->rx_stats.received, ==, 104);
+	g_assert_cmpuint(audio->rx_stats.lost, ==, 0);
+	g_assert_cmpuint(audio->rx_stats.late, ==, 0);
+	g_assert_cmpuint(audio->rx_stats.reordered, ==, 1);
+	g_assert_cmpuint(audio->jb_held, ==, 0);
+	jb_free(audio);
+}
+
+/* Pack 'msg' as an XRP packet into 'buf', returning its length */
+static gsize rt_packet(RTMessage *msg, guint8 *buf)
+{
+	struct xrp_header *hdr = (void *)buf;
+	gsize len = sizeof(*hdr) + rtmessage__pack(msg, (void *)(hdr + 1));
+
+	hdr->type = htons(XRP_RT_MESSAGE);
+	hdr->len = htons(len);
+	return len;
+}
+
+/* Steady-state audio packets must unpack entirely within the RX arena;
+ * with no appsrc they're dropped after that, so this times the unpack. */
+static void check_rx_arena(void)
+{
+	int count = g_test_perf() ? 1000000 : 10000;
+	RTMessage msg = RTMESSAGE__INIT;
+	AudioMessage audio_msg = AUDIO_MESSAGE__INIT;
+	ClientStatsMessage stats[1000], *statsp[1000];
+	guint8 opus[160], buf[65536];
+	ChimeCallAudio *audio;
+	gint64 start, elapsed;
+	gsize len;
+	int i;
+
+	audio = jb_new();
+	chime_call_audio_rx_arena_init(audio);
+
+	memset(opus, 0x55, sizeof(opus));
+	msg.audio = &audio_msg;
+	audio_msg.has_seq = audio_msg.has_sample_time = TRUE;
+	audio_msg.has_server_time = TRUE;
+	audio_msg.has_audio = TRUE;
+	audio_msg.audio.data = opus;
+	audio_msg.audio.len = sizeof(opus);
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < count; i++) {
+		audio_msg.seq = i & 0xffff;
+		audio_msg.sample_time = i * 320;
+		audio_msg.server_time = i * 20000;
+		len = rt_packet(&msg, buf);
+		g_assert_true(audio_receive_packet(audio, buf, len));
+	}
+	elapsed = g_get_monotonic_time() - start;
+	g_assert_cmpuint(audio->rx_arena_overflows, ==, 0);
+	g_assert_cmpuint(audio->rx_arena_used, ==, 0);
+
+	g_test_minimized_result((gdouble)elapsed * 1000 / count,
+				"%d RT packets at %.0f ns each", count,
+				(gdouble)elapsed * 1000 / count);
+
+	/* One oversized packet counts once, however many allocations
+	 * didn't fit */
+	for (i = 0; i < G_N_ELEMENTS(stats); i++) {
+		client_stats_message__init(&stats[i]);
+		stats[i].has_tag = TRUE;
+		stats[i].tag = i;
+		statsp[i] = &stats[i];
+	}
+	msg.n_client_stats = G_N_ELEMENTS(stats);
+	msg.client_stats = statsp;
+	len = rt_packet(&msg, buf);
+	g_assert_true(audio_receive_packet(audio, buf, len));
+	g_assert_cmpuint(audio->rx_arena_overflows, ==, 1);
+
+	jb_free(audio);
+}
+
+static void count_object(ChimeConnection *cxn, ChimeObject *obj, gpointer _count)
+{
+	(*(guint *)_count)++;
+}
+
+/* A full resync of a large collection, as after a reconnect, in which a
+ * tenth of the objects didn't come back and get expired */
+static void check_collection_sync(void)
+{
+	int nr = 50000, rounds = g_test_perf() ? 10 : 1;
+	ChimeConnection *cxn = chime_connection_new("check@example.com", NULL, NULL, NULL);
+	ChimeObjectCollection coll;
+	gint64 start, sync = 0, expire = 0;
+	guint live = 0, count;
+	int r, i;
+
+	chime_object_collection_init(cxn, &coll);
+
+	for (r = 0; r <= rounds; r++) {
+		coll.generation++;
+
+		start = g_get_monotonic_time();
+		for (i = 0; i < nr; i++) {
+			gchar id[32];
+			ChimeObject *obj;
+
+			/* Each round, a different tenth goes missing */
+			if (r && i % 10 == r % 10)
+				continue;
+
+			g_snprintf(id, sizeof(id), "object-%d", i);
+			obj = chime_connection_object_by_id(&coll, id);
+			if (!obj) {
+				gchar *name = g_strdup_printf("Object %d", i);
+
+				obj = g_object_new(CHIME_TYPE_OBJECT, "id", id, "name", name, NULL);
+				g_free(name);
+			}
+			chime_object_collection_hash_object(&coll, obj, TRUE);
+		}
+		if (r)
+			sync += g_get_monotonic_time() - start;
+
+		start = g_get_monotonic_time();
+		chime_object_collection_expire_outdated(&coll);
+		if (r)
+			expire += g_get_monotonic_time() - start;
+
+		live = r ? nr - nr / 10 : nr;
+		count = 0;
+		chime_object_collection_foreach_object(cxn, &coll, count_object, &count);
+		g_assert_cmpuint(count, ==, live);
+		g_assert_cmpuint(coll.slots->len, ==, live);
+	}
+
+	g_test_minimized_result((gdouble)(sync + expire) / 1000 / rounds,
+				"%d objects: sync %.1f ms, expire %.1f ms", nr,
+				(gdouble)sync / 1000 / rounds, (gdouble)expire / 1000 / rounds);
+
+	chime_object_collection_destroy(&coll);
+	g_object_unref(cxn);
+}
+
+static gboolean jugg_count(ChimeConnection *cxn, gpointer _hits, JsonNode *node)
+{
+	(*(guint *)_hits)++;
+	return TRUE;
+}
+
+static gboolean jugg_unsubscribe_self(ChimeConnection *cxn, gpointer _hits, JsonNode *node)
+{
+	(*(guint *)_hits)++;
+	chime_jugg_unsubscribe(cxn, "channel-0", "Presence", jugg_unsubscribe_self, _hits);
+	return TRUE;
+}
+
+/* Subscribe to 10000 channels, as for a large contact list, dispatch a
+ * message on each and unsubscribe again */
+static void check_jugg_subscriptions(void)
+{
+	int nr = 10000, rounds = g_test_perf() ? 10 : 1;
+	ChimeConnection *cxn = chime_connection_new("check@example.com", NULL, NULL, NULL);
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	gint64 start, sub = 0, dispatch = 0, unsub = 0;
+	gchar **channels = g_new0(gchar *, nr + 1);
+	gchar **msgs = g_new0(gchar *, nr + 1);
+	guint *hits = g_new0(guint, nr);
+	guint self_hits = 0;
+	int r, i;
+
+	for (i = 0; i < nr; i++) {
+		channels[i] = g_strdup_printf("channel-%d", i);
+		msgs[i] = g_strdup_printf("{\"channel\":\"%s\",\"data\":{\"klass\":\"Presence\","
+					  "\"record\":{\"Availability\":1}}}", channels[i]);
+	}
+
+	for (r = 0; r < rounds; r++) {
+		start = g_get_monotonic_time();
+		for (i = 0; i < nr; i++) {
+			chime_jugg_subscribe(cxn, channels[i], "Presence", jugg_count, &hits[i]);
+			chime_jugg_subscribe(cxn, channels[i], "Profile", jugg_count, &hits[i]);
+		}
+		sub += g_get_monotonic_time() - start;
+		g_assert_cmpuint(g_hash_table_size(priv->subscriptions), ==, nr);
+
+		start = g_get_monotonic_time();
+		for (i = 0; i < nr; i++)
+			chime_jugg_handle_callback(cxn, msgs[i], strlen(msgs[i]));
+		dispatch += g_get_monotonic_time() - start;
+
+		start = g_get_monotonic_time();
+		for (i = 0; i < nr; i++) {
+			chime_jugg_unsubscribe(cxn, channels[i], "Presence", jugg_count, &hits[i]);
+			chime_jugg_unsubscribe(cxn, channels[i], "Profile", jugg_count, &hits[i]);
+		}
+		unsub += g_get_monotonic_time() - start;
+		g_assert_cmpuint(g_hash_table_size(priv->subscriptions), ==, 0);
+	}
+	for (i = 0; i < nr; i++)
+		g_assert_cmpuint(hits[i], ==, rounds);
+
+	g_test_minimized_result((gdouble)(sub + dispatch + unsub) / 1000 / rounds,
+				"%d channels: subscribe %.1f ms, dispatch %.1f ms, unsubscribe %.1f ms",
+				nr, (gdouble)sub / 1000 / rounds, (gdouble)dispatch / 1000 / rounds,
+				(gdouble)unsub / 1000 / rounds);
+
+	/* Unsubscribing from within dispatch takes effect afterwards */
+	hits[0] = 0;
+	chime_jugg_subscribe(cxn, channels[0], "Presence", jugg_count, &hits[0]);
+	chime_jugg_subscribe(cxn, channels[0], "Presence", jugg_unsubscribe_self, &self_hits);
+	chime_jugg_handle_callback(cxn, msgs[0], strlen(msgs[0]));
+	chime_jugg_handle_callback(cxn, msgs[0], strlen(msgs[0]));
+	g_assert_cmpuint(hits[0], ==, 2);
+	g_assert_cmpuint(self_hits, ==, 1);
+	chime_jugg_unsubscribe(cxn, channels[0], "Presence", jugg_count, &hits[0]);
+	g_assert_cmpuint(g_hash_table_size(priv->subscriptions), ==, 0);
+
+	g_strfreev(channels);
+	g_strfreev(msgs);
+	g_free(hits);
+	g_object_unref(cxn);
+}
+
+#ifndef USE_LIBSOUP_WEBSOCKETS
+static gboolean ws_timeout(gpointer unused)
+{
+	g_error("Timed out waiting for websocket messages");
+	return G_SOURCE_REMOVE;
+}
+
+static void ws_message(ChimeWebsocketConnection *ws, SoupWebsocketDataType type,
+		       GBytes *message, gpointer _queue)
+{
+	g_queue_push_tail(_queue, g_bytes_ref(message));
+}
+
+static ChimeWebsocketConnection *ws_new(int fd, SoupURI *uri, SoupWebsocketConnectionType type,
+					gboolean deflate, GQueue *rxq)
+{
+	GError *error = NULL;
+	GSocket *sock = g_socket_new_from_fd(fd, &error);
+	g_assert_no_error(error);
+
+	GSocketConnection *conn = g_socket_connection_factory_create_connection(sock);
+	ChimeWebsocketConnection *ws = chime_websocket_connection_new(G_IO_STREAM(conn), uri,
+								      type, NULL, NULL);
+	g_object_unref(conn);
+	g_object_unref(sock);
+
+	if (deflate) {
+		g_assert_true(chime_websocket_connection_enable_deflate(ws, "permessage-deflate",
+									&error));
+		g_assert_no_error(error);
+	}
+	if (rxq)
+		g_signal_connect(ws, "message", G_CALLBACK(ws_message), rxq);
+	return ws;
+}
+
+/* Client frames are masked and server frames aren't, so sending the same
+ * payloads in both directions covers xor_with_mask() at every alignment
+ * and length, and each frame length encoding. */
+static void ws_round_trip(gconstpointer _deflate)
+{
+	static const gsize lens[] = { 0, 1, 3, 4, 5, 6, 7, 8, 9, 15, 16, 17, 63, 64, 65,
+				      125, 126, 127, 1000, 65535, 65536, 100000 };
+	gboolean deflate = GPOINTER_TO_INT(_deflate);
+	GQueue at_client = G_QUEUE_INIT, at_server = G_QUEUE_INIT;
+	ChimeWebsocketConnection *client, *server;
+	ChimeWebsocketDeflateStats stats;
+	SoupURI *uri;
+	guint8 *data;
+	guint timeout;
+	int fds[2], i;
+
+	/* Half text-like, half noise, so compression has work either way */
+	data = g_malloc(lens[G_N_ELEMENTS(lens) - 1]);
+	for (i = 0; i < lens[G_N_ELEMENTS(lens) - 1]; i++)
+		data[i] = (i & 1024) ? g_random_int() : 'a' + i % 26;
+
+	g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+	uri = soup_uri_new("ws://localhost/");
+	client = ws_new(fds[0], uri, SOUP_WEBSOCKET_CONNECTION_CLIENT, deflate, &at_client);
+	server = ws_new(fds[1], uri, SOUP_WEBSOCKET_CONNECTION_SERVER, deflate, &at_server);
+	soup_uri_free(uri);
+
+	for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+		chime_websocket_connection_send_binary(client, data, lens[i]);
+		chime_websocket_connection_send_binary(server, data, lens[i]);
+	}
+	chime_websocket_connection_send_text(client, "{\"type\":\"text\"}");
+	chime_websocket_connection_send_text(server, "{\"type\":\"text\"}");
+
+	timeout = g_timeout_add_seconds(10, ws_timeout, NULL);
+	while (at_client.length <= G_N_ELEMENTS(lens) ||
+	       at_server.length <= G_N_ELEMENTS(lens))
+		g_main_context_iteration(NULL, TRUE);
+	g_source_remove(timeout);
+
+	for (i = 0; i <= G_N_ELEMENTS(lens); i++) {
+		GBytes *c = g_queue_pop_head(&at_client);
+		GBytes *s = g_queue_pop_head(&at_server);
+		gconstpointer expected = i < G_N_ELEMENTS(lens) ? (gconstpointer)data : "{\"type\":\"text\"}";
+		gsize len = i < G_N_ELEMENTS(lens) ? lens[i] : strlen(expected);
+
+		g_assert_cmpmem(g_bytes_get_data(c, NULL), g_bytes_get_size(c), expected, len);
+		g_assert_cmpmem(g_bytes_get_data(s, NULL), g_bytes_get_size(s), expected, len);
+		g_bytes_unref(c);
+		g_bytes_unref(s);
+	}
+
+	g_assert_true(chime_websocket_connection_get_deflate_stats(client, &stats) == deflate);
+	if (deflate) {
+		g_assert_cmpuint(stats.messages_out, >, 0);
+		g_assert_cmpuint(stats.messages_in, >, 0);
+		g_assert_cmpuint(stats.wire_out, <, stats.raw_out);
+	}
+
+	g_object_unref(client);
+	g_object_unref(server);
+	g_free(data);
+}
+
+/* Large unfragmented binary frames, one at a time so that each ends the
+ * receive buffer and is handed over by deliver_incoming_in_place(), after
+ * being unmasked by xor_with_mask() a word at a time. */
+static void ws_throughput(void)
+{
+	gsize len = 4 * 1024 * 1024;
+	int count = g_test_perf() ? 64 : 8;
+	GQueue at_server = G_QUEUE_INIT;
+	ChimeWebsocketConnection *client, *server;
+	SoupURI *uri;
+	guint32 *data;
+	gint64 start, elapsed;
+	guint timeout;
+	int fds[2], i;
+
+	data = g_malloc(len);
+	for (i = 0; i < len / sizeof(*data); i++)
+		data[i] = g_random_int();
+
+	g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+	uri = soup_uri_new("ws://localhost/");
+	client = ws_new(fds[0], uri, SOUP_WEBSOCKET_CONNECTION_CLIENT, FALSE, NULL);
+	server = ws_new(fds[1], uri, SOUP_WEBSOCKET_CONNECTION_SERVER, FALSE, &at_server);
+	soup_uri_free(uri);
+
+	chime_websocket_connection_set_max_incoming_payload_size(server, 2 * len);
+
+	timeout = g_timeout_add_seconds(10 + count, ws_timeout, NULL);
+	start = g_get_monotonic_time();
+	for (i = 0; i < count; i++) {
+		GBytes *s;
+
+		chime_websocket_connection_send_binary(client, data, len);
+		while (!at_server.length)
+			g_main_context_iteration(NULL, TRUE);
+
+		s = g_queue_pop_head(&at_server);
+		g_assert_cmpmem(g_bytes_get_data(s, NULL), g_bytes_get_size(s), data, len);
+		g_bytes_unref(s);
+	}
+	elapsed = g_get_monotonic_time() - start;
+	g_source_remove(timeout);
+
+	g_test_maximized_result((gdouble)len * count / MAX(elapsed, 1),
+				"%d x %" G_GSIZE_FORMAT " byte frames at %.1f MB/s",
+				count, len, (gdouble)len * count / MAX(elapsed, 1));
+
+	g_object_unref(client);
+	g_object_unref(server);
+	g_free(data);
+}
+
+/* A compressed message which would inflate far beyond anything sane must
+ * still be refused when the payload size limit is off, as Juggernaut has
+ * it. */
+static void ws_deflate_bomb(void)
+{
+	gsize len = 80 * 1024 * 1024;
+	GQueue at_server = G_QUEUE_INIT;
+	ChimeWebsocketConnection *client, *server;
+	ChimeWebsocketDeflateStats stats;
+	SoupURI *uri;
+	guint8 *data;
+	guint timeout;
+	int fds[2];
+
+	data = g_malloc0(len);
+
+	g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+	uri = soup_uri_new("ws://localhost/");
+	client = ws_new(fds[0], uri, SOUP_WEBSOCKET_CONNECTION_CLIENT, TRUE, NULL);
+	server = ws_new(fds[1], uri, SOUP_WEBSOCKET_CONNECTION_SERVER, TRUE, &at_server);
+	soup_uri_free(uri);
+
+	chime_websocket_connection_set_max_incoming_payload_size(server, 0);
+	chime_websocket_connection_send_binary(client, data, len);
+	g_free(data);
+
+	/* It went over the wire as well under a megabyte */
+	g_assert_true(chime_websocket_connection_get_deflate_stats(client, &stats));
+	g_assert_cmpuint(stats.wire_out, <, 1024 * 1024);
+
+	timeout = g_timeout_add_seconds(10, ws_timeout, NULL);
+	while (chime_websocket_connection_get_state(client) != SOUP_WEBSOCKET_STATE_CLOSED)
+		g_main_context_iteration(NULL, TRUE);
+	g_source_remove(timeout);
+
+	g_assert_cmpuint(at_server.length, ==, 0);
+	g_assert_cmpuint(chime_websocket_connection_get_close_code(client), ==,
+			 SOUP_WEBSOCKET_CLOSE_BAD_DATA);
+
+	g_object_unref(client);
+	g_object_unref(server);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	gst_init(&argc, &argv);
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/iso8601/parse", check_parse_iso8601);
+	g_test_add_func("/iso8601/speed", check_parse_iso8601_speed);
+	g_test_add_func("/objects/sync-expire", check_collection_sync);
+	g_test_add_func("/juggernaut/subscriptions", check_jugg_subscriptions);
+	g_test_add_func("/audio/data-reassembly", check_data_reassembly);
+	g_test_add_func("/audio/data-reassembly-fuzz", check_data_reassembly_fuzz);
+	g_test_add_func("/audio/jitter-buffer", check_jitter_buffer);
+	g_test_add_func("/audio/jitter-target", check_jitter_target);
+	g_test_add_func("/audio/rx-arena", check_rx_arena);
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	g_test_add_data_func("/websocket/round-trip", GINT_TO_POINTER(FALSE), ws_round_trip);
+	g_test_add_data_func("/websocket/deflate", GINT_TO_POINTER(TRUE), ws_round_trip);
+	g_test_add_func("/websocket/throughput", ws_throughput);
+	g_test_add_func("/websocket/deflate-bomb", ws_deflate_bomb);
+#endif
+	return g_test_run();
+}
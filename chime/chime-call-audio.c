@@ -35,34 +35,413 @@
 #include <ctype.h>
 
 
+gboolean chime_call_audio_debug(void)
+{
+	static gsize debug;
+
+	if (g_once_init_enter(&debug))
+		g_once_init_leave(&debug, getenv("CHIME_AUDIO_DEBUG") ? 2 : 1);
+
+	return debug == 2;
+}
+
+static gint64 audio_rx_timeout(void)
+{
+	static gsize timeout;
+
+	if (g_once_init_enter(&timeout)) {
+		const gchar *env = g_getenv("CHIME_AUDIO_RX_TIMEOUT");
+		guint64 ms = env ? g_ascii_strtoull(env, NULL, 10) : 0;
+
+		g_once_init_leave(&timeout, ms ? ms : AUDIO_RX_TIMEOUT_MS);
+	}
+
+	return (gint64)timeout * 1000;
+}
+
+static void *rx_arena_alloc(void *_audio, size_t size)
+{
+	ChimeCallAudio *audio = _audio;
+	gsize aligned = (size + sizeof(guint64) - 1) & ~(sizeof(guint64) - 1);
+	void *p;
+
+	if (aligned > sizeof(audio->rx_arena) - audio->rx_arena_used) {
+		audio->rx_arena_overflowed = TRUE;
+		return g_malloc(size);
+	}
+
+	p = (guint8 *)audio->rx_arena + audio->rx_arena_used;
+	audio->rx_arena_used += aligned;
+	return p;
+}
+
+static void rx_arena_free(void *_audio, void *p)
+{
+	ChimeCallAudio *audio = _audio;
+
+	/* Arena allocations all go at once in rx_arena_reset() */
+	if ((guint8 *)p < (guint8 *)audio->rx_arena ||
+	    (guint8 *)p >= (guint8 *)audio->rx_arena + sizeof(audio->rx_arena))
+		g_free(p);
+}
+
+static void rx_arena_reset(ChimeCallAudio *audio)
+{
+	audio->rx_arena_used = 0;
+	if (audio->rx_arena_overflowed) {
+		audio->rx_arena_overflowed = FALSE;
+		audio->rx_arena_overflows++;
+	}
+}
+
+void chime_call_audio_rx_arena_init(ChimeCallAudio *audio)
+{
+	audio->rx_allocator.alloc = rx_arena_alloc;
+	audio->rx_allocator.free = rx_arena_free;
+	audio->rx_allocator.allocator_data = audio;
+}
+
+static gboolean on_media_thread(ChimeCallAudio *audio)
+{
+	return audio->media_ctx && g_main_context_is_owner(audio->media_ctx);
+}
+
+struct audio_main_call {
+	ChimeCallAudio *audio;
+	GCancellable *cancel;
+	ChimeCallAudioMainFunc func;
+	gpointer data;
+	GDestroyNotify destroy;
+};
+
+static gboolean audio_main_cb(gpointer _c)
+{
+	struct audio_main_call *c = _c;
+
+	/* If it was cancelled, 'audio' may have been freed. */
+	if (!g_cancellable_is_cancelled(c->cancel))
+		c->func(c->audio, c->data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void audio_main_free(gpointer _c)
+{
+	struct audio_main_call *c = _c;
+
+	if (c->destroy)
+		c->destroy(c->data);
+	g_object_unref(c->cancel);
+	g_free(c);
+}
+
+/* Run 'func' on the main loop, directly if we're already there. */
+void chime_call_audio_run_main(ChimeCallAudio *audio, ChimeCallAudioMainFunc func,
+			       gpointer data, GDestroyNotify destroy)
+{
+	if (!on_media_thread(audio)) {
+		func(audio, data);
+		if (destroy)
+			destroy(data);
+		return;
+	}
+
+	struct audio_main_call *c = g_new0(struct audio_main_call, 1);
+	c->audio = audio;
+	c->cancel = g_object_ref(audio->cancel);
+	c->func = func;
+	c->data = data;
+	c->destroy = destroy;
+	g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, audio_main_cb, c, audio_main_free);
+}
+
+/* Called with rx_lock held. The reference on the appsrc keeps it alive if
+ * the pipeline goes away meanwhile; jb_unlock() drops it, since that may
+ * end up in chime_appsrc_destroy() which takes rx_lock. */
+static void jb_push(ChimeCallAudio *audio, GstBuffer *buffer, gint64 arrived)
+{
+	if (!audio->push_src && audio->audio_src)
+		audio->push_src = gst_object_ref(audio->audio_src);
+
+	if (audio->push_src && audio->appsrc_need_data) {
+		guint latency = g_get_monotonic_time() - arrived;
+
+		audio->rx_latency_total += latency;
+		audio->rx_pushed++;
+		if (latency > audio->rx_stats.latency_max_us)
+			audio->rx_stats.latency_max_us = latency;
+		gst_app_src_push_buffer(audio->push_src, buffer);
+	} else {
+		chime_debug("Audio drop (%p %d)\n", audio->audio_src, audio->appsrc_need_data);
+		gst_buffer_unref(buffer);
+	}
+}
+
+/* Frames which will never be played. The RTP seq numbers we generate
+ * leave a gap for the decoder downstream to conceal. */
+static void jb_frames_lost(ChimeCallAudio *audio, guint16 seq, guint count)
+{
+	chime_debug("Audio lost %u frame(s) from seq %d\n", count, seq);
+	g_atomic_int_add(&audio->rx_stats.lost, count);
+}
+
+/* Push everything in order up to (but not including) 'until' */
+static void jb_flush_until(ChimeCallAudio *audio, guint16 until)
+{
+	while ((gint16)(until - audio->jb_next_seq) > 0) {
+		guint idx = audio->jb_next_seq & (AUDIO_JB_SLOTS - 1);
+		GstBuffer **slot = &audio->jb[idx];
+
+		if (*slot) {
+			jb_push(audio, *slot, audio->jb_arrived[idx]);
+			*slot = NULL;
+			audio->jb_held--;
+		} else
+			jb_frames_lost(audio, audio->jb_next_seq, 1);
+		audio->jb_next_seq++;
+	}
+}
+
+/* How many frames to hold back waiting for a gap to be filled.
+ * One frame of reordering, plus a frame per 20ms of jitter. */
+static guint jb_target(ChimeCallAudio *audio)
+{
+	guint target = 1 + (audio->jb_jitter >> 4) / AUDIO_SAMPLES_PER_FRAME;
+
+	return MIN(target, AUDIO_JB_SLOTS / 2);
+}
+
+static void jb_release(ChimeCallAudio *audio)
+{
+	guint target = jb_target(audio);
+
+	while (audio->jb_held) {
+		guint idx = audio->jb_next_seq & (AUDIO_JB_SLOTS - 1);
+		GstBuffer **slot = &audio->jb[idx];
+
+		if (*slot) {
+			jb_push(audio, *slot, audio->jb_arrived[idx]);
+			*slot = NULL;
+			audio->jb_held--;
+		} else if (audio->jb_held > target) {
+			jb_frames_lost(audio, audio->jb_next_seq, 1);
+		} else
+			break;
+		audio->jb_next_seq++;
+	}
+	audio->rx_stats.depth = target;
+}
+
+void chime_call_audio_jb_reset(ChimeCallAudio *audio)
+{
+	int i;
+
+	for (i = 0; i < AUDIO_JB_SLOTS; i++)
+		g_clear_pointer(&audio->jb[i], gst_buffer_unref);
+	audio->jb_held = 0;
+	audio->jb_started = FALSE;
+}
+
+static void jb_update_jitter(ChimeCallAudio *audio, guint32 sample_time, gint64 now)
+{
+	/* Arrival time in 16kHz samples */
+	gint64 transit = now * 16 / 1000 - sample_time;
+
+	if (audio->jb_started) {
+		gint32 d = (gint32)(guint32)(transit - audio->jb_last_transit);
+
+		if (d < 0)
+			d = -d;
+		audio->jb_jitter += d - ((audio->jb_jitter + 8) >> 4);
+		audio->rx_stats.jitter_ms = (audio->jb_jitter >> 4) / 16;
+	}
+	audio->jb_last_transit = transit;
+}
+
+void chime_call_audio_jb_receive(ChimeCallAudio *audio, guint16 seq, GstBuffer *buffer, gint64 now,
+		guint32 sample_time)
+{
+	gint16 offset;
+
+	jb_update_jitter(audio, sample_time, now);
+
+	if (!audio->jb_started) {
+		audio->jb_started = TRUE;
+		audio->jb_next_seq = audio->jb_highest_seq = seq;
+	}
+
+	offset = seq - audio->jb_next_seq;
+	if (offset < -AUDIO_JB_SLOTS * 8 || offset > AUDIO_JB_SLOTS * 8) {
+		/* Way out of range; the server must have restarted the stream.
+		 * Not worth counting as loss, or playing the stale remnants. */
+		chime_debug("Audio seq jumped from %d to %d\n", audio->jb_next_seq, seq);
+		chime_call_audio_jb_reset(audio);
+		audio->jb_started = TRUE;
+		audio->jb_next_seq = audio->jb_highest_seq = seq;
+		offset = 0;
+	} else if (offset < 0) {
+		chime_debug("Audio late seq %d (expected %d)\n", seq, audio->jb_next_seq);
+		audio->rx_stats.late++;
+		gst_buffer_unref(buffer);
+		return;
+	} else if (offset >= AUDIO_JB_SLOTS) {
+		/* Make room, giving up on anything still missing */
+		jb_flush_until(audio, seq - AUDIO_JB_SLOTS + 1);
+	}
+
+	GstBuffer **slot = &audio->jb[seq & (AUDIO_JB_SLOTS - 1)];
+	if (*slot) {
+		audio->rx_stats.duplicates++;
+		gst_buffer_unref(buffer);
+		return;
+	}
+
+	if ((gint16)(seq - audio->jb_highest_seq) < 0)
+		audio->rx_stats.reordered++;
+	else
+		audio->jb_highest_seq = seq;
+
+	*slot = buffer;
+	audio->jb_arrived[seq & (AUDIO_JB_SLOTS - 1)] = now;
+	audio->jb_held++;
+	audio->rx_stats.received++;
+
+	jb_release(audio);
+}
+
+static void jb_lock(ChimeCallAudio *audio)
+{
+	g_mutex_lock(&audio->rx_lock);
+}
+
+static void jb_unlock(ChimeCallAudio *audio)
+{
+	GstAppSrc *src = audio->push_src;
+
+	audio->push_src = NULL;
+	g_mutex_unlock(&audio->rx_lock);
+
+	if (src)
+		gst_object_unref(src);
+}
+
+void chime_call_audio_get_stats(ChimeCallAudio *audio, ChimeCallAudioStats *stats)
+{
+	g_mutex_lock(&audio->rx_lock);
+	*stats = audio->rx_stats;
+	if (audio->rx_pushed)
+		stats->latency_us = audio->rx_latency_total / audio->rx_pushed;
+	g_mutex_unlock(&audio->rx_lock);
+}
+
+struct participant_update {
+	guint32 stream_id;
+	int vol;
+	int signal_strength;
+};
+
+static void participants_main(ChimeCallAudio *audio, gpointer _unused)
+{
+	GArray *updates;
+	int i;
+
+	g_mutex_lock(&audio->rx_participants_lock);
+	updates = audio->rx_participants;
+	audio->rx_participants = g_array_new(FALSE, FALSE, sizeof(struct participant_update));
+	audio->rx_participants_queued = FALSE;
+	g_mutex_unlock(&audio->rx_participants_lock);
+
+	for (i = 0; i < updates->len; i++) {
+		struct participant_update *u = &g_array_index(updates, struct participant_update, i);
+		const gchar *profile_id = g_hash_table_lookup(audio->profiles,
+							      GUINT_TO_POINTER(u->stream_id));
+		if (!profile_id) {
+			chime_debug("no profile for stream id %d\n", u->stream_id);
+			continue;
+		}
+
+		chime_debug("Participant %s vol %d\n", profile_id, u->vol);
+		/* Emitted in batches, as "participants-updated" */
+		chime_call_participant_audio_stats(audio->call, profile_id, u->vol,
+						   u->signal_strength);
+	}
+
+	g_array_unref(updates);
+}
+
+/* Only the latest for each stream is kept until the main loop gets to it */
+static void queue_participant_update(ChimeCallAudio *audio, guint32 stream_id,
+				     int vol, int signal_strength)
+{
+	struct participant_update *u;
+	gboolean queue;
+	int i;
+
+	g_mutex_lock(&audio->rx_participants_lock);
+	for (i = 0; i < audio->rx_participants->len; i++) {
+		u = &g_array_index(audio->rx_participants, struct participant_update, i);
+		if (u->stream_id == stream_id)
+			break;
+	}
+	if (i == audio->rx_participants->len) {
+		g_array_set_size(audio->rx_participants, i + 1);
+		u = &g_array_index(audio->rx_participants, struct participant_update, i);
+		u->stream_id = stream_id;
+	}
+	u->vol = vol;
+	u->signal_strength = signal_strength;
+
+	queue = !audio->rx_participants_queued;
+	audio->rx_participants_queued = TRUE;
+	g_mutex_unlock(&audio->rx_participants_lock);
+
+	if (queue)
+		chime_call_audio_run_main(audio, participants_main, NULL, NULL);
+}
+
+static void remote_mute_main(ChimeCallAudio *audio, gpointer muted)
+{
+	if (GPOINTER_TO_INT(muted))
+		chime_call_audio_local_mute(audio, TRUE);
+
+	g_mutex_lock(&audio->rt_lock);
+	if (GPOINTER_TO_INT(muted)) {
+		audio->rt_msg.client_status = &audio->client_status_msg;
+		audio->client_status_msg.has_remote_mute_ack = TRUE;
+		audio->client_status_msg.remote_mute_ack = TRUE;
+	} else {
+		audio->rt_msg.client_status = NULL;
+	}
+	g_mutex_unlock(&audio->rt_lock);
+}
 
 static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
-	RTMessage *msg = rtmessage__unpack(NULL, len, pkt);
-	if (!msg)
+	RTMessage *msg = rtmessage__unpack(&audio->rx_allocator, len, pkt);
+	if (!msg) {
+		rx_arena_reset(audio);
 		return FALSE;
-	gint64 now = g_get_monotonic_time();
+	}
+	gint64 now = audio->last_rx;
 
 	if (msg->client_status) {
 		/* This never seems to happen in practice. We just get a Juggernaut message
 		 * about the call roster, with a 'muter' node in our own participant information. */
-		if (msg->client_status->has_remote_muted && msg->client_status->remote_muted) {
-			chime_call_audio_local_mute(audio, TRUE);
-
-			audio->rt_msg.client_status = &audio->client_status_msg;
-			audio->client_status_msg.has_remote_mute_ack = TRUE;
-			audio->client_status_msg.remote_mute_ack = TRUE;
-		} else {
-			audio->rt_msg.client_status = NULL;
-		}
+		gboolean muted = msg->client_status->has_remote_muted &&
+			msg->client_status->remote_muted;
 
+		chime_call_audio_run_main(audio, remote_mute_main, GINT_TO_POINTER(muted), NULL);
 	}
 	if (msg->audio) {
 		if (msg->audio->has_server_time) {
+			g_mutex_lock(&audio->rt_lock);
 			audio->last_server_time_offset = msg->audio->server_time - now;
 			audio->echo_server_time = TRUE;
+			g_mutex_unlock(&audio->rt_lock);
 		}
-		if (msg->audio->has_audio && audio->audio_src && audio->appsrc_need_data) {
+		/* Unlocked, but jb_push() checks again */
+		if (msg->audio->has_audio && msg->audio->audio.len && audio->audio_src &&
+		    msg->audio->has_seq && msg->audio->has_sample_time) {
 			GstBuffer *buffer = gst_rtp_buffer_new_allocate(msg->audio->audio.len, 0, 0);
 			GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
 			if (gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp)) {
@@ -78,29 +457,23 @@ static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, g
 				gst_buffer_fill(buffer, gst_rtp_buffer_calc_header_len(0),
 						msg->audio->audio.data, msg->audio->audio.len);
 
-				gst_app_src_push_buffer(GST_APP_SRC(audio->audio_src), buffer);
-			}
+				jb_lock(audio);
+				chime_call_audio_jb_receive(audio, msg->audio->seq, buffer, now,
+							    msg->audio->sample_time);
+				jb_unlock(audio);
+			} else
+				gst_buffer_unref(buffer);
 		} else if (msg->audio->has_audio && msg->audio->audio.len) {
-			chime_debug("Audio drop (%p %d) seq %d ts %u\n",
-				    audio->audio_src, audio->appsrc_need_data,
+			chime_debug("Audio drop (no appsrc) seq %d ts %u\n",
 				    msg->audio->seq, msg->audio->sample_time);
 		}
 
 	}
-	gboolean send_sig = FALSE;
 	int i;
 	for (i=0; i < msg->n_profiles; i++) {
 		if (!msg->profiles[i]->has_stream_id)
 			continue;
 
-		const gchar *profile_id = g_hash_table_lookup(audio->profiles,
-							      GUINT_TO_POINTER(msg->profiles[i]->stream_id));
-		if (!profile_id) {
-			chime_debug("no profile for stream id %d\n",
-			       msg->profiles[i]->stream_id);
-			continue;
-		}
-
 		int vol;
 		if (msg->profiles[i]->has_muted && msg->profiles[i]->muted)
 			vol = -128;
@@ -112,14 +485,12 @@ static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, g
 		int signal_strength = -1;
 		if (msg->profiles[i]->has_signal_strength)
 			signal_strength = msg->profiles[i]->signal_strength;
-		chime_debug("Participant %s vol %d\n", profile_id, vol);
-		if (chime_call_participant_audio_stats(audio->call, profile_id, vol, signal_strength))
-			send_sig = TRUE;
+		queue_participant_update(audio, msg->profiles[i]->stream_id, vol, signal_strength);
 	}
-	if (send_sig)
-		chime_call_emit_participants(audio->call);
 
-	rtmessage__free_unpacked(msg, NULL);
+	/* Only actually frees anything which overflowed the arena */
+	rtmessage__free_unpacked(msg, &audio->rx_allocator);
+	rx_arena_reset(audio);
 	return TRUE;
 }
 
@@ -128,6 +499,7 @@ static gboolean audio_reconnect(gpointer _audio)
 	ChimeCallAudio *audio = _audio;
 
 	audio->timeout_source = 0;
+	audio->reconnect_start = g_get_monotonic_time();
 
 	chime_call_transport_disconnect(audio, TRUE);
 	chime_call_transport_connect(audio, audio->silent);
@@ -143,7 +515,7 @@ static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 
 	g_mutex_lock(&audio->rt_lock);
 	gint64 now = g_get_monotonic_time();
-	if (!audio->timeout_source && audio->last_rx + 10000000 < now) {
+	if (!audio->timeout_source && audio->last_rx + audio_rx_timeout() < now) {
 		chime_debug("RX timeout, reconnect audio\n");
 		audio->timeout_source = g_timeout_add(0, audio_reconnect, audio);
 	}
@@ -205,8 +577,9 @@ static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 	} else
 		audio->audio_msg.has_echo_time = 0;
 
+	/* What we've lost receiving from the server */
 	audio->audio_msg.has_total_frames_lost = TRUE;
-	audio->audio_msg.total_frames_lost = 0;
+	audio->audio_msg.total_frames_lost = g_atomic_int_get(&audio->rx_stats.lost);
 
 	audio->audio_msg.has_ntp_time = TRUE;
 	audio->audio_msg.ntp_time = g_get_real_time();
@@ -239,6 +612,13 @@ static gboolean audio_receive_auth_msg(ChimeCallAudio *audio, gconstpointer pkt,
 
 	chime_debug("Got AuthMessage authorised %d %d\n", msg->has_authorized, msg->authorized);
 	if (msg->has_authorized && msg->authorized) {
+		if (audio->reconnect_start) {
+			chime_debug("Audio reconnected in %" G_GINT64_FORMAT "ms (%s)\n",
+				    (g_get_monotonic_time() - audio->reconnect_start) / 1000,
+				    audio->ws ? "websocket" :
+				    audio->dtls_resumed ? "DTLS resumed" : "DTLS");
+			audio->reconnect_start = 0;
+		}
 		do_send_rt_packet(audio, NULL);
 		chime_call_audio_set_state(audio, audio->silent ? CHIME_AUDIO_STATE_AUDIOLESS :
 					   (audio->local_mute ? CHIME_AUDIO_STATE_AUDIO_MUTED : CHIME_AUDIO_STATE_AUDIO),
@@ -251,52 +631,89 @@ static gboolean audio_receive_auth_msg(ChimeCallAudio *audio, gconstpointer pkt,
 	auth_message__free_unpacked(msg, NULL);
 	return TRUE;
 }
-struct message_frag {
-	struct message_frag *next;
-	gint32 start;
-	gint32 end;
-};
+static void free_data_slot(ChimeCallAudio *audio, struct audio_data_slot *slot)
+{
+	audio->data_bytes -= slot->alloc;
+	g_free(slot->map);
+	memset(slot, 0, sizeof(*slot));
+}
 
-struct message_buf {
-	gint32 msg_id;
-	gint32 len;
-	uint8_t *buf;
-	struct message_frag *frags;
-};
+static struct audio_data_slot *oldest_data_slot(ChimeCallAudio *audio)
+{
+	struct audio_data_slot *oldest = NULL;
+	int i;
 
-static struct message_buf *find_msgbuf(ChimeCallAudio *audio, gint32 msg_id, gint32 msg_len)
+	for (i = 0; i < AUDIO_DATA_SLOTS; i++) {
+		struct audio_data_slot *slot = &audio->data_slots[i];
+
+		if (slot->map && (!oldest || slot->msg_id < oldest->msg_id))
+			oldest = slot;
+	}
+	return oldest;
+}
+
+/* Returns NULL if the message is outside the window, or too large */
+static struct audio_data_slot *get_data_slot(ChimeCallAudio *audio, gint32 msg_id, gint32 msg_len)
 {
-	GSList **l = &audio->data_messages;
-	struct message_buf *m;
+	struct audio_data_slot *slot = &audio->data_slots[msg_id & (AUDIO_DATA_SLOTS - 1)];
+	gsize map_len, alloc;
 
-	while (*l) {
-		m = (*l)->data;
-		if (m->msg_id == msg_id)
-			return m;
-		else if (m->msg_id > msg_id)
-			break;
-		else
-			l = &((*l)->next);
+	if (slot->map && slot->msg_id == msg_id)
+		return slot;
+
+	if (msg_len <= 0)
+		return NULL;
+
+	map_len = ((msg_len + 63) / 64) * sizeof(guint64);
+	alloc = map_len + msg_len;
+	if (alloc > AUDIO_DATA_MAX_BYTES) {
+		chime_debug("DataMessage %d too large (%d bytes)\n", msg_id, msg_len);
+		return NULL;
+	}
+
+	if (slot->map) {
+		/* A straggler from a message we've already given up on */
+		if (slot->msg_id > msg_id)
+			return NULL;
+
+		chime_debug("Evicting incomplete DataMessage %d for %d\n", slot->msg_id, msg_id);
+		audio->data_evictions++;
+		free_data_slot(audio, slot);
+	}
+
+	while (audio->data_bytes + alloc > AUDIO_DATA_MAX_BYTES) {
+		struct audio_data_slot *oldest = oldest_data_slot(audio);
+
+		chime_debug("Evicting incomplete DataMessage %d for space\n", oldest->msg_id);
+		audio->data_evictions++;
+		free_data_slot(audio, oldest);
 	}
-	m = g_new0(struct message_buf, 1);
 
-	m->msg_id = msg_id;
-	m->len = msg_len;
-	m->buf = g_malloc0(msg_len);
-	/* Insert into the correct place in the sorted list */
-	*l = g_slist_prepend(*l, m);
-	return m;
+	slot->msg_id = msg_id;
+	slot->len = msg_len;
+	slot->alloc = alloc;
+	slot->map = g_malloc(alloc);
+	memset(slot->map, 0, map_len);
+	slot->data = (guint8 *)slot->map + map_len;
+	audio->data_bytes += alloc;
+	return slot;
 }
 
-static void free_msgbuf(struct message_buf *m)
+/* Returns TRUE when the message is complete. Duplicate and overlapping
+ * fragments are only counted once. */
+gboolean chime_call_audio_mark_data_received(struct audio_data_slot *slot, gint32 start, gint32 end)
 {
-	while (m->frags) {
-		struct message_frag *f = m->frags;
-		m->frags = f->next;
-		g_free(f);
+	while (start < end) {
+		guint bit = start & 63;
+		guint n = MIN(64 - bit, (guint)(end - start));
+		guint64 mask = (n == 64 ? ~0ULL : (1ULL << n) - 1) << bit;
+		guint64 *word = &slot->map[start / 64];
+
+		slot->received += __builtin_popcountll(mask & ~*word);
+		*word |= mask;
+		start += n;
 	}
-	g_free(m->buf);
-	g_free(m);
+	return slot->received == slot->len;
 }
 
 void chime_call_audio_cleanup_datamsgs(ChimeCallAudio *audio)
@@ -306,8 +723,14 @@ void chime_call_audio_cleanup_datamsgs(ChimeCallAudio *audio)
 		audio->data_ack_source = 0;
 	}
 
-	g_slist_free_full(audio->data_messages, (GDestroyNotify) free_msgbuf);
-	audio->data_messages = NULL;
+	int i;
+	for (i = 0; i < AUDIO_DATA_SLOTS; i++) {
+		if (audio->data_slots[i].map)
+			free_data_slot(audio, &audio->data_slots[i]);
+	}
+	if (audio->data_evictions)
+		chime_debug("%u incomplete DataMessages evicted\n", audio->data_evictions);
+	audio->data_evictions = 0;
 
 	audio->data_next_seq = 0;
 	audio->data_ack_mask = 0;
@@ -338,44 +761,6 @@ static gboolean idle_send_ack(gpointer _audio)
 	return FALSE;
 }
 
-static gboolean insert_frag(struct message_buf *m, gint32 start, gint32 end)
-{
-	struct message_frag **f = &m->frags, *nf;
-	while (*f) {
-		if (end < (*f)->start) {
-			/* Insert before *f */
-			break;
-		} else if (start <= (*f)->end) {
-			/* Overlap / touching *f so merge */
-			if (start < (*f)->start)
-				(*f)->start = start;
-			/* ... and merge subsequent frags that we now touch */
-			if (end > (*f)->end) {
-				(*f)->end = end;
-				nf = (*f)->next;
-				while ((*f)->next && nf->start <= (*f)->end) {
-					(*f)->end = nf->end;
-					(*f)->next = nf->next;
-					g_free(nf);
-				}
-			}
-			goto done;
-		} else {
-			/* New frag lives after *f */
-			f = &(*f)->next;
-		}
-	}
-	nf = g_new0(struct message_frag, 1);
-	nf->start = start;
-	nf->end = end;
-	nf->next = *f;
-	*f = nf;
- done:
-	return (m->frags->start == 0 &&
-		m->frags->end == m->len);
-}
-
-
 static gboolean audio_receive_stream_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
 	StreamMessage *msg = stream_message__unpack(NULL, len, pkt);
@@ -404,6 +789,7 @@ static gboolean audio_receive_stream_msg(ChimeCallAudio *audio, gconstpointer pk
 static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
 	gboolean ret = FALSE;
+	int i;
 	DataMessage *msg = data_message__unpack(NULL, len, pkt);
 	if (!msg)
 		return FALSE;
@@ -446,28 +832,29 @@ static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt,
 	if (msg->msg_id < audio->data_next_logical_msg)
 		goto drop;
 
-	struct message_buf *m = find_msgbuf(audio, msg->msg_id, msg->msg_len);
-	if (msg->msg_len != m->len ||
-	    msg->offset + msg->data.len > m->len)
+	struct audio_data_slot *slot = get_data_slot(audio, msg->msg_id, msg->msg_len);
+	if (!slot)
+		goto drop;
+
+	if (msg->msg_len != slot->len || msg->offset < 0 || msg->offset > slot->len ||
+	    msg->data.len > slot->len - msg->offset)
 		goto fail;
 
-	memcpy(m->buf + msg->offset, msg->data.data, msg->data.len);
-	if (insert_frag(m, msg->offset, msg->offset + msg->data.len)) {
-		struct xrp_header *hdr = (void *)m->buf;
-		if (m->len > sizeof(*hdr) && ntohs(hdr->len) == m->len &&
+	memcpy(slot->data + msg->offset, msg->data.data, msg->data.len);
+	if (chime_call_audio_mark_data_received(slot, msg->offset, msg->offset + msg->data.len)) {
+		struct xrp_header *hdr = (void *)slot->data;
+		if (slot->len > sizeof(*hdr) && ntohs(hdr->len) == slot->len &&
 		    ntohs(hdr->type) == XRP_STREAM_MESSAGE) {
-			audio_receive_stream_msg(audio, m->buf + sizeof(*hdr), m->len - sizeof(*hdr));
-			audio->data_next_logical_msg = m->msg_id + 1;
+			audio_receive_stream_msg(audio, slot->data + sizeof(*hdr), slot->len - sizeof(*hdr));
+			audio->data_next_logical_msg = slot->msg_id + 1;
 		}
-		/* Now kill *all* pending messagse up to and including this one */
-		while (audio->data_messages) {
-			struct message_buf *m = audio->data_messages->data;
-
-			if (m->msg_id >= audio->data_next_logical_msg)
-				break;
+		free_data_slot(audio, slot);
 
-			audio->data_messages = g_slist_remove(audio->data_messages, m);
-			free_msgbuf(m);
+		/* Now kill *all* pending messages before the next one we want */
+		for (i = 0; i < AUDIO_DATA_SLOTS; i++) {
+			slot = &audio->data_slots[i];
+			if (slot->map && slot->msg_id < audio->data_next_logical_msg)
+				free_data_slot(audio, slot);
 		}
 	}
  drop:
@@ -477,6 +864,14 @@ static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt,
 	return ret;
 }
 
+static void receive_packet_main(ChimeCallAudio *audio, gpointer _pkt)
+{
+	gsize len;
+	gconstpointer pkt = g_bytes_get_data(_pkt, &len);
+
+	audio_receive_packet(audio, pkt, len);
+}
+
 gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
 	if (len < sizeof(struct xrp_header))
@@ -488,6 +883,13 @@ gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize le
 
 	audio->last_rx = g_get_monotonic_time();
 
+	/* Only the audio itself is handled on the media thread */
+	if (ntohs(hdr->type) != XRP_RT_MESSAGE && on_media_thread(audio)) {
+		chime_call_audio_run_main(audio, receive_packet_main, g_bytes_new(pkt, len),
+					  (GDestroyNotify)g_bytes_unref);
+		return TRUE;
+	}
+
 	/* Point to the payload, without (void *) arithmetic */
 	pkt = hdr + 1;
 	len -= 4;
@@ -510,16 +912,33 @@ void chime_call_audio_close(ChimeCallAudio *audio, gboolean hangup)
 {
 	g_signal_handlers_disconnect_matched(G_OBJECT(audio->call), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, audio);
 
-	chime_debug("close audio\n");
+	chime_debug("close audio (%u RX packets overflowed the arena)\n",
+		    audio->rx_arena_overflows);
 
-	if (audio->audio_src)
-		gst_app_src_set_callbacks(audio->audio_src, &no_appsrc_callbacks, NULL, NULL);
 	if (audio->audio_sink)
 		gst_app_sink_set_callbacks(audio->audio_sink, &no_appsink_callbacks, NULL, NULL);
 
+	/* This stops the media thread, so nothing is pushing to the appsrc */
 	chime_call_transport_disconnect(audio, hangup);
+	chime_call_transport_cleanup(audio);
+
+	if (audio->audio_src)
+		gst_app_src_set_callbacks(audio->audio_src, &no_appsrc_callbacks, NULL, NULL);
+
 	chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_HANGUP, NULL);
 
+	ChimeCallAudioStats stats;
+	chime_call_audio_get_stats(audio, &stats);
+	chime_debug("Audio RX: %u received, %u lost, %u late, %u reordered, %u dup, jitter %ums\n",
+		    stats.received, stats.lost, stats.late,
+		    stats.reordered, stats.duplicates, stats.jitter_ms);
+	chime_debug("Audio RX latency to appsrc: %uus mean, %uus max\n",
+		    stats.latency_us, stats.latency_max_us);
+	chime_call_audio_jb_reset(audio);
+
+	g_array_unref(audio->rx_participants);
+	g_mutex_clear(&audio->rx_participants_lock);
+	g_mutex_clear(&audio->rx_lock);
 	g_hash_table_destroy(audio->profiles);
 	g_free(audio);
 }
@@ -562,7 +981,9 @@ static void chime_appsrc_destroy(gpointer _audio)
 {
 	ChimeCallAudio *audio = _audio;
 
+	g_mutex_lock(&audio->rx_lock);
 	audio->audio_src = NULL;
+	g_mutex_unlock(&audio->rx_lock);
 }
 
 static void chime_appsink_destroy(gpointer _audio)
@@ -580,9 +1001,10 @@ static GstAppSrcCallbacks chime_appsrc_callbacks = {
 void chime_call_audio_install_gst_app_callbacks(ChimeCallAudio *audio, GstAppSrc *appsrc, GstAppSink *appsink)
 {
 	audio->audio_sink = appsink;
+	g_mutex_lock(&audio->rx_lock);
 	audio->audio_src = appsrc;
-
 	audio->appsrc_need_data = TRUE;
+	g_mutex_unlock(&audio->rx_lock);
 
 	gst_app_src_set_callbacks(appsrc, &chime_appsrc_callbacks, audio, chime_appsrc_destroy);
 	gst_app_sink_set_callbacks(appsink, &chime_appsink_callbacks, audio, chime_appsink_destroy);
@@ -596,6 +1018,9 @@ ChimeCallAudio *chime_call_audio_open(ChimeConnection *cxn, ChimeCall *call, gbo
 	audio->profiles = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 	g_mutex_init(&audio->transport_lock);
 	g_mutex_init(&audio->rt_lock);
+	g_mutex_init(&audio->rx_participants_lock);
+	g_mutex_init(&audio->rx_lock);
+	audio->rx_participants = g_array_new(FALSE, FALSE, sizeof(struct participant_update));
 
 	audio->session_id = ((guint64)g_random_int() << 32) | g_random_int();
 
@@ -608,6 +1033,8 @@ ChimeCallAudio *chime_call_audio_open(ChimeConnection *cxn, ChimeCall *call, gbo
 	audio->audio_msg.has_sample_time = 1;
 	audio->audio_msg.sample_time = g_random_int();
 
+	chime_call_audio_rx_arena_init(audio);
+
 	chime_call_transport_connect(audio, silent);
 
 	return audio;
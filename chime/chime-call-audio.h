@@ -33,6 +33,32 @@
 
 #define NS_PER_SAMPLE (1000000000 / 16000)
 
+/* Reconnect if we hear nothing for this long. CHIME_AUDIO_RX_TIMEOUT
+ * in the environment overrides it, in milliseconds. */
+#define AUDIO_RX_TIMEOUT_MS 4000
+
+/* Enough for an unpacked RTMessage from any DTLS-sized packet */
+#define AUDIO_RX_ARENA_SIZE 16384
+
+/* Receive jitter buffer, in 20ms frames. Must be a power of two. */
+#define AUDIO_JB_SLOTS 16
+#define AUDIO_SAMPLES_PER_FRAME 320
+
+/* Fragmented DataMessages being reassembled, by logical message ID. Must
+ * be a power of two. Anything which would take us over the memory cap
+ * gets the oldest partial messages thrown away. */
+#define AUDIO_DATA_SLOTS 8
+#define AUDIO_DATA_MAX_BYTES (256 * 1024)
+
+struct audio_data_slot {
+	gint32 msg_id;
+	gint32 len;
+	gint32 received;	/* Distinct bytes so far */
+	gsize alloc;
+	guint64 *map;		/* A bit per byte received, then the data itself */
+	guint8 *data;
+};
+
 struct _ChimeCallAudio {
 	ChimeCall *call;
 	ChimeAudioState state;
@@ -44,29 +70,53 @@ struct _ChimeCallAudio {
 
 	guint recv_ssrc;	/* Fake SSRC on incoming generated RTP */
 
-	time_t last_rx;
+	gint64 last_rx;
 	guint timeout_source;
 	gboolean dtls_handshaked;
 	GSocket *dtls_sock;
 	GSource *dtls_source;
 	gnutls_session_t dtls_sess;
 	gchar *dtls_hostname;
-	gnutls_certificate_credentials_t dtls_cred;
 	GCancellable *cancel;
 
+	/* Kept across reconnects within the call, so that we can go straight
+	 * to the address which worked last time and resume the session
+	 * rather than doing a full handshake. */
+	GSocketAddress *dtls_addr;
+	gnutls_datum_t dtls_resume;
+	gboolean dtls_resumed;
+	gint64 reconnect_start;
+
+	/* With DTLS, the socket and everything on the receive side down to
+	 * the appsrc is handled by a thread of its own, so that it doesn't
+	 * have to wait for the UI. Only participant and state changes come
+	 * back to the main loop, via chime_call_audio_run_main(). */
+	GThread *media_thread;
+	GMainContext *media_ctx;
+	gint media_quit;
+	GSource *dtls_timeout;
+
 	guint data_ack_source;
 	guint32 data_next_seq;
 	guint64 data_ack_mask;
 	gint32 data_next_logical_msg;
-	GSList *data_messages;
+	struct audio_data_slot data_slots[AUDIO_DATA_SLOTS];
+	gsize data_bytes;
+	guint data_evictions;
 	GHashTable *profiles;
 
 	GstClockTime next_dts;
 	gint64 last_send_local_time;
-	GstAppSrc *audio_src;
 	GstAppSink *audio_sink;
 	gboolean appsrc_need_data;
 
+	/* The media thread pushes to audio_src while the UI can tear down
+	 * the pipeline under it, and reads the stats too. This protects
+	 * audio_src, the jitter buffer and the RX stats. */
+	GMutex rx_lock;
+	GstAppSrc *audio_src;
+	GstAppSrc *push_src;	/* Ref held by jb_push(), dropped without rx_lock */
+
 	GMutex rt_lock;
 	guint send_rt_source;
 	gint64 last_server_time_offset;
@@ -74,6 +124,35 @@ struct _ChimeCallAudio {
 	RTMessage rt_msg;
 	AudioMessage audio_msg;
 	ClientStatusMessage client_status_msg;
+
+	/* Incoming RTMessages are unpacked into this, and it's reset after
+	 * each one. Anything which doesn't fit falls back to the heap, and
+	 * rx_arena_overflows counts the packets for which that happened. */
+	ProtobufCAllocator rx_allocator;
+	gsize rx_arena_used;
+	gboolean rx_arena_overflowed;
+	guint rx_arena_overflows;
+	guint64 rx_arena[AUDIO_RX_ARENA_SIZE / sizeof(guint64)];
+
+	/* Incoming frames are held here, indexed by seq, until they can go
+	 * to the appsrc in order. A gap is only given up on when more than
+	 * jb_target frames are waiting behind it. */
+	GstBuffer *jb[AUDIO_JB_SLOTS];
+	gint64 jb_arrived[AUDIO_JB_SLOTS];
+	gboolean jb_started;
+	guint16 jb_next_seq;
+	guint16 jb_highest_seq;
+	guint jb_held;
+	gint64 jb_last_transit;
+	guint32 jb_jitter;	/* In 1/16 samples, as RFC 3550 */
+	ChimeCallAudioStats rx_stats;
+	guint64 rx_latency_total;
+	guint rx_pushed;
+
+	/* Volume updates from RTMessages, waiting for the main loop */
+	GMutex rx_participants_lock;
+	GArray *rx_participants;
+	gboolean rx_participants_queued;
 };
 
 struct xrp_header {
@@ -96,13 +175,28 @@ gboolean chime_call_audio_get_silent(ChimeCallAudio *audio);
 void chime_call_audio_set_state(ChimeCallAudio *audio, ChimeAudioState state, const gchar *message);
 void chime_call_audio_local_mute(ChimeCallAudio *audio, gboolean muted);
 
+gboolean chime_call_audio_debug(void);
+void chime_call_audio_get_stats(ChimeCallAudio *audio, ChimeCallAudioStats *stats);
+
 /* Called from audio code */
 void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent);
 void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup);
+void chime_call_transport_cleanup(ChimeCallAudio *audio);
 void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type type, const ProtobufCMessage *message);
 
 /* Callbacks into audio code from transport */
 gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len);
 
+typedef void (*ChimeCallAudioMainFunc)(ChimeCallAudio *audio, gpointer data);
+void chime_call_audio_run_main(ChimeCallAudio *audio, ChimeCallAudioMainFunc func,
+			       gpointer data, GDestroyNotify destroy);
+
 void chime_call_audio_install_gst_app_callbacks(ChimeCallAudio *audio, GstAppSrc *appsrc, GstAppSink *appsink);
 void chime_call_audio_cleanup_datamsgs(ChimeCallAudio *audio);
+
+/* Internals, also exercised by chime-check */
+void chime_call_audio_jb_receive(ChimeCallAudio *audio, guint16 seq, GstBuffer *buffer, gint64 now,
+		guint32 sample_time);
+void chime_call_audio_jb_reset(ChimeCallAudio *audio);
+gboolean chime_call_audio_mark_data_received(struct audio_data_slot *slot, gint32 start, gint32 end);
+void chime_call_audio_rx_arena_init(ChimeCallAudio *audio);
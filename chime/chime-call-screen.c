@@ -22,12 +22,14 @@
 #include <string.h>
 #include <ctype.h>
 
-#include <gst/rtp/gstrtpbuffer.h>
 #include <gst/video/video.h>
 
 static GstAppSrcCallbacks no_appsrc_callbacks;
 static GstAppSinkCallbacks no_appsink_callbacks;
 
+/* In VP8 frames, which arrive one per packet */
+#define SCREEN_RX_QUEUE_MAX 8
+
 struct screen_pkt {
 	unsigned char type;
 	unsigned char flag;
@@ -92,30 +94,48 @@ static void screen_send_packet(ChimeCallScreen *screen, enum screen_pkt_type typ
 	unsigned char dest = 0;
 	enum screen_pkt_flag flag = SCREEN_PKT_FLAG_LOCAL;
 
+	struct screen_pkt pkt;
+	GOutputVector vec[2] = {
+		{ &pkt, sizeof(pkt) },
+		{ data, dlen },
+	};
+
+	pkt.type = type;
+	pkt.source = source;
+	pkt.dest = dest;
+	pkt.flag = flag;
+
 	g_mutex_lock(&screen->transport_lock);
-	if (dlen) {
-		/* Ick, we need to fix websockets to take iovecs */
-		struct screen_pkt *buf = g_malloc0(sizeof(*buf) + dlen);
-		buf->type = type;
-		buf->source = source;
-		buf->dest = dest;
-		buf->flag = flag;
-		memcpy(&buf[1], data, dlen);
-
-		soup_websocket_connection_send_binary(screen->ws, buf, sizeof(*buf) + dlen);
-		g_free(buf);
-	} else {
-		struct screen_pkt pkt;
-		pkt.type = type;
-		pkt.source = source;
-		pkt.dest = dest;
-		pkt.flag = flag;
-
-		soup_websocket_connection_send_binary(screen->ws, &pkt, sizeof(pkt));
-	}
+	chime_websocket_connection_send_binary_iov(screen->ws, vec, dlen ? 2 : 1);
 	g_mutex_unlock(&screen->transport_lock);
 }
 
+/* The callbacks may still be running, or be destroyed later, on a
+ * GStreamer thread. The screen lives until they are. */
+static void screen_unref(ChimeCallScreen *screen)
+{
+	if (!g_atomic_int_dec_and_test(&screen->refs))
+		return;
+
+	chime_debug("Screen RX: %u frames dropped\n", screen->rx_frames_dropped);
+	g_mutex_clear(&screen->rx_lock);
+	g_mutex_clear(&screen->transport_lock);
+	g_free(screen);
+}
+
+static void screen_clear_appsrc(ChimeCallScreen *screen)
+{
+	GstAppSrc *src;
+
+	g_mutex_lock(&screen->rx_lock);
+	src = screen->screen_src;
+	screen->screen_src = NULL;
+	g_mutex_unlock(&screen->rx_lock);
+
+	if (src)
+		gst_app_src_set_callbacks(src, &no_appsrc_callbacks, NULL, NULL);
+}
+
 static void on_screenws_closed(SoupWebsocketConnection *ws, gpointer _screen)
 {
 	ChimeCallScreen *screen = _screen;
@@ -127,10 +147,7 @@ static void on_screenws_closed(SoupWebsocketConnection *ws, gpointer _screen)
 	/* This provokes the UI to tear down the GStreamer pipeline */
 	chime_call_screen_set_state(screen, CHIME_SCREEN_STATE_FAILED, "Websocket closed unexpectedly");
 
-	if (screen->screen_src) {
-		gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-		screen->screen_src = NULL;
-	}
+	screen_clear_appsrc(screen);
 
 	if (screen->screen_sink) {
 		gst_app_sink_set_callbacks(screen->screen_sink, &no_appsink_callbacks, NULL, NULL);
@@ -138,6 +155,76 @@ static void on_screenws_closed(SoupWebsocketConnection *ws, gpointer _screen)
 	}
 }
 
+/* Called with rx_lock held */
+static void screen_rx_drop_queued(ChimeCallScreen *screen)
+{
+	GstBuffer *buffer;
+
+	while ((buffer = g_queue_pop_head(&screen->rx_queue))) {
+		screen->rx_frames_dropped++;
+		gst_buffer_unref(buffer);
+	}
+}
+
+/* Called with rx_lock held */
+static void screen_rx_drain(ChimeCallScreen *screen)
+{
+	while (screen->screen_src && g_atomic_int_get(&screen->appsrc_need_data) &&
+	       !g_queue_is_empty(&screen->rx_queue))
+		gst_app_src_push_buffer(screen->screen_src, g_queue_pop_head(&screen->rx_queue));
+}
+
+/* The P bit in the first byte of the VP8 frame tag is clear for key frames */
+static gboolean vp8_is_keyframe(const guint8 *frame, gsize len)
+{
+	return len && !(frame[0] & 1);
+}
+
+/*
+ * If the pipeline can't keep up, hold a few frames. When that fills up,
+ * drop frames until the next key frame, since every delta frame after
+ * a dropped one would decode to garbage anyway, and ask the presenter
+ * for one rather than waiting for the next scheduled key frame. A key
+ * frame also makes anything still waiting in the queue redundant.
+ */
+static void screen_rx_frame(ChimeCallScreen *screen, GBytes *message)
+{
+	gsize s;
+	const guint8 *d = g_bytes_get_data(message, &s);
+	gboolean key = vp8_is_keyframe(d + sizeof(struct screen_pkt), s - sizeof(struct screen_pkt));
+
+	g_mutex_lock(&screen->rx_lock);
+
+	if (key) {
+		screen->rx_waiting_key = FALSE;
+		screen_rx_drop_queued(screen);
+	} else if (screen->rx_waiting_key ||
+		   g_queue_get_length(&screen->rx_queue) >= SCREEN_RX_QUEUE_MAX) {
+		gboolean was_waiting = screen->rx_waiting_key;
+
+		screen->rx_waiting_key = TRUE;
+		screen->rx_frames_dropped++;
+		g_mutex_unlock(&screen->rx_lock);
+
+		if (!was_waiting) {
+			chime_debug("Screen RX queue full; requesting a key frame\n");
+			screen_send_packet(screen, SCREEN_PKT_TYPE_KEY_REQUEST, NULL, 0);
+		}
+		return;
+	}
+
+	/* Hand the websocket's own buffer to GStreamer, skipping our header */
+	GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, (gpointer)d, s,
+							sizeof(struct screen_pkt),
+							s - sizeof(struct screen_pkt),
+							g_bytes_ref(message),
+							(GDestroyNotify)g_bytes_unref);
+	g_queue_push_tail(&screen->rx_queue, buffer);
+	screen_rx_drain(screen);
+
+	g_mutex_unlock(&screen->rx_lock);
+}
+
 static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 			       GBytes *message, gpointer _screen)
 {
@@ -181,11 +268,8 @@ static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 		break;
 
 	case SCREEN_PKT_TYPE_CAPTURE:
-		if (screen->screen_src) {
-			GstBuffer *buffer = gst_rtp_buffer_new_allocate(s - 4, 0, 0);
-			gst_buffer_fill(buffer, 0, &pkt[1], s - sizeof(*pkt));
-			gst_app_src_push_buffer(GST_APP_SRC(screen->screen_src), buffer);
-		}
+		if (screen->screen_src)
+			screen_rx_frame(screen, message);
 		break;
 
 	default:
@@ -239,10 +323,7 @@ ChimeCallScreen *chime_call_screen_open(ChimeConnection *cxn, ChimeCall *call, C
 		g_object_unref(screen->ws);
 		screen->ws = NULL;
 
-		if (screen->screen_src) {
-			gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-			screen->screen_src = NULL;
-		}
+		screen_clear_appsrc(screen);
 		if (screen->screen_sink) {
 			gst_app_sink_set_callbacks(screen->screen_sink, &no_appsink_callbacks, NULL, NULL);
 			screen->screen_sink = NULL;
@@ -253,6 +334,8 @@ ChimeCallScreen *chime_call_screen_open(ChimeConnection *cxn, ChimeCall *call, C
 		screen = g_new0(ChimeCallScreen, 1);
 
 		g_mutex_init(&screen->transport_lock);
+		g_mutex_init(&screen->rx_lock);
+		screen->refs = 1;
 
 		screen->call = call;
 		screen->cancel = g_cancellable_new();
@@ -276,7 +359,7 @@ ChimeCallScreen *chime_call_screen_open(ChimeConnection *cxn, ChimeCall *call, C
 	chime_call_screen_set_state(screen, CHIME_SCREEN_STATE_CONNECTING, NULL);
 
 	chime_connection_websocket_connect_async(g_object_ref(cxn), msg, origin, protocols,
-						 screen->cancel, screen_ws_connect_cb, screen);
+						 FALSE, screen->cancel, screen_ws_connect_cb, screen);
 	g_free(origin);
 
 	return screen;
@@ -310,27 +393,38 @@ void chime_call_screen_close(ChimeCallScreen *screen)
 		soup_websocket_connection_close(screen->ws, 0, NULL);
 		screen->ws = NULL;
 	}
-	if (screen->screen_src) {
-		gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-		screen->screen_src = NULL;
-	}
+	screen_clear_appsrc(screen);
 	if (screen->screen_sink) {
 		gst_app_sink_set_callbacks(screen->screen_sink, &no_appsink_callbacks, NULL, NULL);
 		screen->screen_sink = NULL;
 	}
-	g_free(screen);
+
+	g_mutex_lock(&screen->rx_lock);
+	screen_rx_drop_queued(screen);
+	g_mutex_unlock(&screen->rx_lock);
+
+	/* A need_data callback may still be running; if so, the appsrc
+	 * drops the last reference when it destroys the callbacks. */
+	screen_unref(screen);
 }
 
+/* On a GStreamer thread. Pushing may call enough_data, so it mustn't take rx_lock. */
 static void screen_appsrc_need_data(GstAppSrc *src, guint length, gpointer _screen)
 {
 	ChimeCallScreen *screen = _screen;
-	screen->appsrc_need_data = TRUE;
+
+	g_atomic_int_set(&screen->appsrc_need_data, TRUE);
+
+	g_mutex_lock(&screen->rx_lock);
+	screen_rx_drain(screen);
+	g_mutex_unlock(&screen->rx_lock);
 }
 
 static void screen_appsrc_enough_data(GstAppSrc *src, gpointer _screen)
 {
 	ChimeCallScreen *screen = _screen;
-	screen->appsrc_need_data = FALSE;
+
+	g_atomic_int_set(&screen->appsrc_need_data, FALSE);
 }
 
 static void screen_appsrc_destroy(gpointer _screen)
@@ -339,11 +433,17 @@ static void screen_appsrc_destroy(gpointer _screen)
 
 	if (screen->state == CHIME_SCREEN_STATE_VIEWING) {
 		screen_send_packet(screen, SCREEN_PKT_TYPE_VIEWER_END, NULL, 0);
+		g_mutex_lock(&screen->rx_lock);
 		screen->screen_src = NULL;
+		g_mutex_unlock(&screen->rx_lock);
 		chime_call_screen_set_state(screen, CHIME_SCREEN_STATE_CONNECTED, NULL);
 	} else if (screen->state == CHIME_SCREEN_STATE_FAILED) {
+		g_mutex_lock(&screen->rx_lock);
 		screen->screen_src = NULL;
+		g_mutex_unlock(&screen->rx_lock);
 	}
+
+	screen_unref(screen);
 }
 
 static GstAppSrcCallbacks screen_appsrc_callbacks = {
@@ -354,7 +454,18 @@ static GstAppSrcCallbacks screen_appsrc_callbacks = {
 
 void chime_call_screen_install_appsrc(ChimeCallScreen *screen, GstAppSrc *appsrc)
 {
+	/* Nothing left over from a previous viewer is any use, and the
+	 * new decoder needs to start with a key frame. */
+	GstBuffer *buffer;
+	g_mutex_lock(&screen->rx_lock);
+	while ((buffer = g_queue_pop_head(&screen->rx_queue)))
+		gst_buffer_unref(buffer);
+	screen->rx_waiting_key = TRUE;
 	screen->screen_src = appsrc;
+	screen->appsrc_need_data = TRUE;
+	g_mutex_unlock(&screen->rx_lock);
+
+	g_atomic_int_inc(&screen->refs);
 	gst_app_src_set_callbacks(appsrc, &screen_appsrc_callbacks, screen, screen_appsrc_destroy);
 
 	if (screen->state == CHIME_SCREEN_STATE_SENDING)
@@ -384,22 +495,28 @@ static GstFlowReturn screen_appsink_new_sample(GstAppSink* self, gpointer data)
 
 	if (screen->state == CHIME_SCREEN_STATE_SENDING && screen->viewer_present) {
 		GstBuffer *buffer = gst_sample_get_buffer(sample);
-		gsize len = gst_buffer_get_size(buffer);
-
-		/* Ick, we need to fix websockets to take iovecs */
-		struct screen_pkt *buf = g_malloc0(sizeof(*buf) + len);
-		buf->type = SCREEN_PKT_TYPE_CAPTURE;
-		buf->source = 0;
-		buf->dest = 0;
-		buf->flag = SCREEN_PKT_FLAG_BROADCAST;
-		gst_buffer_extract(buffer, 0, &buf[1], len);
-		g_mutex_lock(&screen->transport_lock);
-		if (screen->ws && screen->state == CHIME_SCREEN_STATE_SENDING) {
-			chime_debug("Screen send %zu bytes dts %ld\n", len, GST_BUFFER_DTS(buffer));
-			soup_websocket_connection_send_binary(screen->ws, buf, sizeof(*buf) + len);
+		struct screen_pkt pkt = { 0 };
+		GstMapInfo map;
+
+		pkt.type = SCREEN_PKT_TYPE_CAPTURE;
+		pkt.flag = SCREEN_PKT_FLAG_BROADCAST;
+
+		/* The frame goes straight from the mapped buffer into the
+		 * websocket frame, without an intermediate copy. */
+		if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+			GOutputVector vec[2] = {
+				{ &pkt, sizeof(pkt) },
+				{ map.data, map.size },
+			};
+
+			g_mutex_lock(&screen->transport_lock);
+			if (screen->ws && screen->state == CHIME_SCREEN_STATE_SENDING) {
+				chime_debug("Screen send %zu bytes dts %ld\n", map.size, GST_BUFFER_DTS(buffer));
+				chime_websocket_connection_send_binary_iov(screen->ws, vec, 2);
+			}
+			g_mutex_unlock(&screen->transport_lock);
+			gst_buffer_unmap(buffer, &map);
 		}
-		g_mutex_unlock(&screen->transport_lock);
-		g_free(buf);
 	}
 	gst_sample_unref(sample);
 
@@ -431,10 +548,7 @@ void chime_call_screen_install_appsink(ChimeCallScreen *screen, GstAppSink *apps
 	if (screen->state == CHIME_SCREEN_STATE_VIEWING)
 		screen_send_packet(screen, SCREEN_PKT_TYPE_VIEWER_END, NULL, 0);
 
-	if (screen->screen_src) {
-		gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-		screen->screen_src = NULL;
-	}
+	screen_clear_appsrc(screen);
 
 	if (screen->ws) {
 		screen->viewer_present = 0;
@@ -33,6 +33,17 @@ struct _ChimeCallScreen {
 	GstAppSrc *screen_src;
 	gboolean appsrc_need_data, viewer_present;
 
+	/* Held by chime_call_screen_close() and by each set of appsrc
+	 * callbacks until GStreamer destroys them; the last one frees. */
+	gint refs;
+
+	/* Frames held while the appsrc says it has enough. Also guards
+	 * screen_src against the GStreamer thread calling need_data. */
+	GMutex rx_lock;
+	GQueue rx_queue;
+	gboolean rx_waiting_key;
+	guint rx_frames_dropped;
+
 	GstAppSink *screen_sink;
 
 	SoupWebsocketConnection *ws;
@@ -64,7 +64,7 @@ static void on_audiows_message(SoupWebsocketConnection *ws, gint type,
 	gsize s;
 	gconstpointer d = g_bytes_get_data(message, &s);
 
-	if (getenv("CHIME_AUDIO_DEBUG")) {
+	if (chime_call_audio_debug()) {
 		printf("incoming:\n");
 		hexdump(d, s);
 	}
@@ -188,7 +188,7 @@ static void chime_call_transport_connect_ws(ChimeCallAudio *audio)
 
 	ChimeConnection *cxn = chime_call_get_connection(audio->call);
 	chime_connection_websocket_connect_async(g_object_ref(cxn), msg, origin, protocols,
-						 audio->cancel, audio_ws_connect_cb, audio);
+						 FALSE, audio->cancel, audio_ws_connect_cb, audio);
 	g_free(origin);
 }
 
@@ -376,51 +376,120 @@ g_tls_connection_gnutls_pull_timeout_func (gnutls_transport_ptr_t transport_data
 	return 0;
 }
 
+static gpointer media_thread_fn(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+
+	g_main_context_push_thread_default(audio->media_ctx);
+	while (!g_atomic_int_get(&audio->media_quit))
+		g_main_context_iteration(audio->media_ctx, TRUE);
+	g_main_context_pop_thread_default(audio->media_ctx);
+
+	return NULL;
+}
+
+static void clear_dtls_timeout(ChimeCallAudio *audio)
+{
+	if (audio->dtls_timeout) {
+		g_source_destroy(audio->dtls_timeout);
+		g_source_unref(audio->dtls_timeout);
+		audio->dtls_timeout = NULL;
+	}
+}
+
+/* Also tears down its sources, so the DTLS session is all ours afterwards */
+static void stop_media_thread(ChimeCallAudio *audio)
+{
+	if (audio->media_thread) {
+		g_atomic_int_set(&audio->media_quit, 1);
+		g_main_context_wakeup(audio->media_ctx);
+		g_thread_join(audio->media_thread);
+		audio->media_thread = NULL;
+	}
+
+	clear_dtls_timeout(audio);
+	if (audio->dtls_source) {
+		g_source_destroy(audio->dtls_source);
+		g_source_unref(audio->dtls_source);
+		audio->dtls_source = NULL;
+	}
+	g_clear_pointer(&audio->media_ctx, g_main_context_unref);
+}
+
+/* Don't try to short-cut the next connection */
+static void forget_dtls_peer(ChimeCallAudio *audio)
+{
+	g_clear_object(&audio->dtls_addr);
+	gnutls_free(audio->dtls_resume.data);
+	audio->dtls_resume.data = NULL;
+	audio->dtls_resume.size = 0;
+}
+
+static void dtls_failed_main(ChimeCallAudio *audio, gpointer _unused)
+{
+	stop_media_thread(audio);
+	forget_dtls_peer(audio);
+
+	g_mutex_lock(&audio->transport_lock);
+	gnutls_deinit(audio->dtls_sess);
+	audio->dtls_sess = NULL;
+	g_clear_object(&audio->dtls_sock);
+	g_mutex_unlock(&audio->transport_lock);
+
+	chime_call_transport_connect_ws(audio);
+}
+
+static void send_auth_main(ChimeCallAudio *audio, gpointer _unused)
+{
+	audio_send_auth_packet(audio);
+}
+
 static gboolean dtls_timeout(ChimeCallAudio *audio);
 
+static void set_dtls_timeout(ChimeCallAudio *audio)
+{
+	clear_dtls_timeout(audio);
+
+	audio->dtls_timeout = g_timeout_source_new(gnutls_dtls_get_timeout(audio->dtls_sess));
+	g_source_set_callback(audio->dtls_timeout, (GSourceFunc)dtls_timeout, audio, NULL);
+	g_source_attach(audio->dtls_timeout, audio->media_ctx);
+}
+
+/* On the media thread */
 static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, ChimeCallAudio *audio)
 {
 	if (!audio->dtls_handshaked) {
 		int ret = gnutls_handshake(audio->dtls_sess);
 
 		if (ret == GNUTLS_E_AGAIN) {
-			if (audio->timeout_source)
-				g_source_remove(audio->timeout_source);
-
-			int timeo = gnutls_dtls_get_timeout(audio->dtls_sess);
-			audio->timeout_source = g_timeout_add(timeo, (GSourceFunc)dtls_timeout, audio);
-
+			set_dtls_timeout(audio);
 			return G_SOURCE_CONTINUE;
 		}
 
+		clear_dtls_timeout(audio);
+
 		if (ret) {
 			chime_debug("DTLS failed: %s\n", gnutls_strerror(ret));
-			gnutls_deinit(audio->dtls_sess);
-			audio->dtls_sess = NULL;
-			g_source_destroy(audio->dtls_source);
-			audio->dtls_source = NULL;
-			g_object_unref(audio->dtls_sock);
-			audio->dtls_sock = NULL;
-			if (audio->timeout_source)
-				g_source_remove(audio->timeout_source);
-			audio->timeout_source = 0;
-
-			chime_call_transport_connect_ws(audio);
+			chime_call_audio_run_main(audio, dtls_failed_main, NULL, NULL);
 			return G_SOURCE_REMOVE;
 		}
 
-		chime_debug("DTLS established\n");
-		g_source_remove(audio->timeout_source);
-		audio->timeout_source = 0;
 		audio->dtls_handshaked = TRUE;
-		audio_send_auth_packet(audio);
+		audio->dtls_resumed = gnutls_session_is_resumed(audio->dtls_sess);
+		if (!audio->dtls_resumed) {
+			gnutls_free(audio->dtls_resume.data);
+			if (gnutls_session_get_data2(audio->dtls_sess, &audio->dtls_resume))
+				audio->dtls_resume.data = NULL;
+		}
+		chime_debug("DTLS established%s\n", audio->dtls_resumed ? " (resumed)" : "");
+		chime_call_audio_run_main(audio, send_auth_main, NULL, NULL);
 		/* Fall through and receive data, not that it should be there */
 	}
 
 	unsigned char pkt[CHIME_DTLS_MTU];
 	ssize_t len = gnutls_record_recv(audio->dtls_sess, pkt, sizeof(pkt));
 	if (len > 0) {
-		if (getenv("CHIME_AUDIO_DEBUG")) {
+		if (chime_call_audio_debug()) {
 			printf("incoming:\n");
 			hexdump(pkt, len);
 		}
@@ -432,7 +501,9 @@ static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, Chime
 
 static gboolean dtls_timeout(ChimeCallAudio *audio)
 {
-	audio->timeout_source = 0;
+	/* The context holds its own reference while we're dispatched */
+	g_source_unref(audio->dtls_timeout);
+	audio->dtls_timeout = NULL;
 
 	dtls_src_cb(NULL, 0, audio);
 
@@ -460,27 +531,42 @@ static int dtls_verify_cb(gnutls_session_t sess)
 	return 0;
 }
 
+/* Loading the system trust store is slow, so it's done once for all calls */
+static gnutls_certificate_credentials_t dtls_credentials(void)
+{
+	static gsize cred;
+
+	if (g_once_init_enter(&cred)) {
+		gnutls_certificate_credentials_t c;
+
+		gnutls_certificate_allocate_credentials(&c);
+		gnutls_certificate_set_x509_system_trust(c);
+		gnutls_certificate_set_x509_trust_dir(c, CHIME_CERTS_DIR, GNUTLS_X509_FMT_PEM);
+		gnutls_certificate_set_verify_function(c, dtls_verify_cb);
+		g_once_init_leave(&cred, (gsize)c);
+	}
+
+	return (gnutls_certificate_credentials_t)cred;
+}
+
 static void connect_dtls(ChimeCallAudio *audio, GSocket *s)
 {
 	/* Not that "connected" means anything except that we think we can route to it. */
 	chime_debug("UDP socket connected\n");
 
+	audio->media_ctx = g_main_context_new();
 	audio->dtls_source = g_datagram_based_create_source(G_DATAGRAM_BASED(s), G_IO_IN, audio->cancel);
 	audio->dtls_sock = s;
 	g_source_set_callback(audio->dtls_source, (GSourceFunc)dtls_src_cb, audio, NULL);
-	g_source_attach(audio->dtls_source, NULL);
+	g_source_attach(audio->dtls_source, audio->media_ctx);
 
 	gnutls_init(&audio->dtls_sess, GNUTLS_CLIENT|GNUTLS_DATAGRAM|GNUTLS_NONBLOCK);
 	gnutls_set_default_priority(audio->dtls_sess);
 	gnutls_session_set_ptr(audio->dtls_sess, audio);
-	if (!audio->dtls_cred) {
-		gnutls_certificate_allocate_credentials(&audio->dtls_cred);
-		gnutls_certificate_set_x509_system_trust(audio->dtls_cred);
-		gnutls_certificate_set_x509_trust_dir(audio->dtls_cred,
-						      CHIME_CERTS_DIR, GNUTLS_X509_FMT_PEM);
-		gnutls_certificate_set_verify_function(audio->dtls_cred, dtls_verify_cb);
-	}
-	gnutls_credentials_set(audio->dtls_sess, GNUTLS_CRD_CERTIFICATE, audio->dtls_cred);
+	gnutls_credentials_set(audio->dtls_sess, GNUTLS_CRD_CERTIFICATE, dtls_credentials());
+	if (audio->dtls_resume.data)
+		gnutls_session_set_data(audio->dtls_sess, audio->dtls_resume.data,
+					audio->dtls_resume.size);
 
 	if (!audio->dtls_hostname) {
 		gchar *hostname = g_strdup(chime_call_get_media_host(audio->call));
@@ -512,27 +598,50 @@ static void connect_dtls(ChimeCallAudio *audio, GSocket *s)
 
 	if (gnutls_handshake(audio->dtls_sess) != GNUTLS_E_AGAIN) {
 		chime_debug("Initial DTLS handshake failed\n");
-
-		gnutls_deinit(audio->dtls_sess);
-		audio->dtls_sess = NULL;
-
-		if (audio->dtls_source) {
-			g_source_destroy(audio->dtls_source);
-			audio->dtls_source = NULL;
-		}
 		goto err;
 	}
 
-	int timeo = gnutls_dtls_get_timeout(audio->dtls_sess);
-	audio->timeout_source = g_timeout_add(timeo, (GSourceFunc)dtls_timeout, audio);
+	set_dtls_timeout(audio);
 
+	audio->media_quit = 0;
+	audio->media_thread = g_thread_new("chime-audio", media_thread_fn, audio);
 	return;
 
  err:
+	if (audio->dtls_sess) {
+		gnutls_deinit(audio->dtls_sess);
+		audio->dtls_sess = NULL;
+	}
+	stop_media_thread(audio);
+	forget_dtls_peer(audio);
 	g_clear_object(&audio->dtls_sock);
 	chime_call_transport_connect_ws(audio);
 }
 
+/* Returns FALSE if we can't even route to it */
+static gboolean try_dtls_addr(ChimeCallAudio *audio, GSocketAddress *addr)
+{
+	GSocket *s = g_socket_new(g_socket_address_get_family(addr), G_SOCKET_TYPE_DATAGRAM,
+				  G_SOCKET_PROTOCOL_UDP, NULL);
+	if (!s)
+		return FALSE;
+
+	g_socket_set_blocking(s, FALSE);
+
+	/* This doesn't block as it's a UDP connect */
+	if (!g_socket_connect(s, addr, NULL, NULL)) {
+		g_object_unref(s);
+		return FALSE;
+	}
+
+	if (audio->dtls_addr != addr) {
+		g_clear_object(&audio->dtls_addr);
+		audio->dtls_addr = g_object_ref(addr);
+	}
+	connect_dtls(audio, s);
+	return TRUE;
+}
+
 static void audio_dtls_one(GObject *obj, GAsyncResult *res, gpointer user_data)
 {
 	GSocketAddressEnumerator *enumerator = G_SOCKET_ADDRESS_ENUMERATOR(obj);
@@ -556,28 +665,15 @@ static void audio_dtls_one(GObject *obj, GAsyncResult *res, gpointer user_data)
 	chime_debug("DTLS address %s:%d\n", addr_str, port);
 	g_free(addr_str);
 
-	GSocket *s = g_socket_new(g_socket_address_get_family(addr), G_SOCKET_TYPE_DATAGRAM,
-				  G_SOCKET_PROTOCOL_UDP, NULL);
-	if (!s)
-		goto err;
-
-	g_socket_set_blocking(s, FALSE);
-
-	/* This doesn't block as it's a UDP connect */
-	if (g_socket_connect(s, addr, NULL, NULL)) {
+	if (try_dtls_addr(audio, addr)) {
 		/* Ideally, we should keep the enumerator around and try the next
 		   address if the actual DTLS connection fails. */
 		g_object_unref(addr);
 		g_object_unref(enumerator);
-
-		connect_dtls(audio, s);
 		return;
 	}
 
 	/* Failed to connect (i.e. we can't route to it. Try next addresses... */
-	g_object_unref(s);
-
- err:
 	g_object_unref(addr);
 	g_socket_address_enumerator_next_async(enumerator, audio->cancel,
 					       (GAsyncReadyCallback)audio_dtls_one, audio);
@@ -589,9 +685,22 @@ void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent)
 	audio->cancel = g_cancellable_new();
 	audio->dtls_handshaked = FALSE;
 	audio->recv_ssrc = g_random_int();
+	/* The RX timeout counts from here */
+	audio->last_rx = g_get_monotonic_time();
 
 	chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_CONNECTING, NULL);
 
+	/* Reconnecting within the same call? Skip the DNS lookup. */
+	if (audio->dtls_addr) {
+		GSocketAddress *addr = g_object_ref(audio->dtls_addr);
+		gboolean connected = try_dtls_addr(audio, addr);
+
+		g_object_unref(addr);
+		if (connected)
+			return;
+		forget_dtls_peer(audio);
+	}
+
 	GSocketConnectable *addr = g_network_address_parse(chime_call_get_media_host(audio->call),
 							   0, NULL);
 	if (!addr) {
@@ -627,6 +736,14 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 	if (hangup && audio->state >= CHIME_AUDIO_STATE_AUDIOLESS)
 		audio_send_hangup_packet(audio);
 
+	stop_media_thread(audio);
+
+	/* Any pending participants_main() is cancelled below */
+	g_mutex_lock(&audio->rx_participants_lock);
+	g_array_set_size(audio->rx_participants, 0);
+	audio->rx_participants_queued = FALSE;
+	g_mutex_unlock(&audio->rx_participants_lock);
+
 	g_mutex_lock(&audio->transport_lock);
 
 	if (audio->cancel) {
@@ -642,11 +759,6 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 	} else if (audio->dtls_sess) {
 		gnutls_deinit(audio->dtls_sess);
 		audio->dtls_sess = NULL;
-
-		if (audio->dtls_source) {
-			g_source_destroy(audio->dtls_source);
-			audio->dtls_source = NULL;
-		}
 		g_clear_object(&audio->dtls_sock);
 	}
 
@@ -660,27 +772,36 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 		audio->timeout_source = 0;
 	}
 
-	if (hangup && audio->dtls_cred) {
-		gnutls_certificate_free_credentials(audio->dtls_cred);
-		audio->dtls_cred = NULL;
-	}
-
 	g_mutex_unlock(&audio->transport_lock);
 }
 
+/* When the call's audio is closed for good */
+void chime_call_transport_cleanup(ChimeCallAudio *audio)
+{
+	forget_dtls_peer(audio);
+}
+
 void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type type, const ProtobufCMessage *message)
 {
 	if (!audio->ws && !audio->dtls_sess)
 		return;
 
+	/* Every RT packet fits in a DTLS record, so the 20ms audio path
+	 * never needs to touch the heap. protobuf-c packs without allocating. */
+	union {
+		struct xrp_header hdr;
+		guint8 buf[CHIME_DTLS_MTU];
+	} stack_pkt;
+	struct xrp_header *hdr = &stack_pkt.hdr;
 	size_t len = protobuf_c_message_get_packed_size(message);
 
 	len += sizeof(struct xrp_header);
-	struct xrp_header *hdr = g_malloc0(len);
+	if (len > sizeof(stack_pkt))
+		hdr = g_malloc(len);
 	hdr->type = htons(type);
 	hdr->len = htons(len);
 	protobuf_c_message_pack(message, (void *)(hdr + 1));
-	if (getenv("CHIME_AUDIO_DEBUG")) {
+	if (chime_call_audio_debug()) {
 		printf("sending protobuf of len %"G_GSIZE_FORMAT"\n", len);
 		hexdump(hdr, len);
 	}
@@ -690,5 +811,6 @@ void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type t
 	else if (audio->ws)
 		soup_websocket_connection_send_binary(audio->ws, hdr, len);
 	g_mutex_unlock(&audio->transport_lock);
-	g_free(hdr);
+	if (hdr != &stack_pkt.hdr)
+		g_free(hdr);
 }
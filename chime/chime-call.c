@@ -58,12 +58,25 @@ enum {
 	AUDIO_STATE,
 	SCREEN_STATE,
 	PARTICIPANTS_CHANGED,
+	PARTICIPANTS_UPDATED,
 	NEW_PRESENTER,
 	LAST_SIGNAL,
 };
 
 static guint signals[LAST_SIGNAL];
 
+/* Speaking indicators can change every 20ms; nobody needs to see that */
+#define PARTICIPANTS_AUDIO_MS	200
+#define PARTICIPANTS_ROSTER_MS	1000
+
+struct participants_journal {
+	ChimeCall *call;
+	ChimeCallParticipantsChannel channel;
+	GHashTable *changed;	/* participant_id → ChimeCallParticipant */
+	guint source;
+	guint coalesced;
+};
+
 struct _ChimeCall {
 	ChimeObject parent_instance;
 
@@ -71,6 +84,7 @@ struct _ChimeCall {
 
 	GHashTable *participants;
 	ChimeCallParticipant *presenter;
+	struct participants_journal journals[CHIME_CALL_PARTICIPANTS_NR];
 
 	ChimeCallAudio *audio;
 	ChimeCallScreen *screen;
@@ -115,6 +129,19 @@ chime_call_dispose(GObject *object)
 
 	g_signal_emit(self, signals[ENDED], 0, NULL);
 
+	int i;
+	for (i = 0; i < CHIME_CALL_PARTICIPANTS_NR; i++) {
+		struct participants_journal *j = &self->journals[i];
+
+		if (j->source) {
+			g_source_remove(j->source);
+			j->source = 0;
+		}
+		if (j->coalesced)
+			chime_debug("Call %p coalesced %u participant updates on channel %d\n",
+				    self, j->coalesced, i);
+		g_clear_pointer(&j->changed, g_hash_table_destroy);
+	}
 	g_clear_pointer(&self->participants, g_hash_table_destroy);
 
 	G_OBJECT_CLASS(chime_call_parent_class)->dispose(object);
@@ -193,6 +220,12 @@ static void chime_call_class_init(ChimeCallClass *klass)
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
 			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_HASH_TABLE);
 
+	signals[PARTICIPANTS_UPDATED] =
+		g_signal_new ("participants-updated",
+			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 3,
+			      G_TYPE_HASH_TABLE, G_TYPE_HASH_TABLE, G_TYPE_INT);
+
 	signals[NEW_PRESENTER] =
 		g_signal_new ("new_presenter",
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
@@ -202,6 +235,13 @@ static void chime_call_class_init(ChimeCallClass *klass)
 static void chime_call_init(ChimeCall *self)
 {
 	self->participants = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_participant);
+
+	int i;
+	for (i = 0; i < CHIME_CALL_PARTICIPANTS_NR; i++) {
+		self->journals[i].call = self;
+		self->journals[i].channel = i;
+		self->journals[i].changed = g_hash_table_new(g_str_hash, g_str_equal);
+	}
 }
 
 
@@ -343,6 +383,32 @@ static void free_participant(void *_p)
 	free(p);
 }
 
+static gboolean flush_participants(gpointer _j)
+{
+	struct participants_journal *j = _j;
+
+	j->source = 0;
+	g_signal_emit(j->call, signals[PARTICIPANTS_UPDATED], 0,
+		      j->call->participants, j->changed, j->channel);
+	g_hash_table_remove_all(j->changed);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void journal_participant(ChimeCall *call, ChimeCallParticipantsChannel channel,
+				ChimeCallParticipant *p)
+{
+	struct participants_journal *j = &call->journals[channel];
+
+	if (!g_hash_table_insert(j->changed, (void *)p->participant_id, p))
+		j->coalesced++;
+
+	if (!j->source)
+		j->source = g_timeout_add(channel == CHIME_CALL_PARTICIPANTS_AUDIO ?
+					  PARTICIPANTS_AUDIO_MS : PARTICIPANTS_ROSTER_MS,
+					  flush_participants, j);
+}
+
 static gboolean parse_participant(ChimeConnection *cxn, ChimeCall *call, JsonNode *p,
 				  ChimeCallParticipant **presenter)
 {
@@ -374,6 +440,10 @@ static gboolean parse_participant(ChimeConnection *cxn, ChimeCall *call, JsonNod
 		if (email)
 			cp->email = g_strdup(email);
 		g_hash_table_insert(call->participants, (void *)cp->participant_id, cp);
+		journal_participant(call, CHIME_CALL_PARTICIPANTS_ROSTER, cp);
+	} else if (cp->pots != pots || cp->speaker != speaker ||
+		   cp->status != status || cp->shared_screen != screen) {
+		journal_participant(call, CHIME_CALL_PARTICIPANTS_ROSTER, cp);
 	}
 	cp->pots = pots;
 	cp->speaker = speaker;
@@ -423,8 +493,6 @@ static gboolean call_roster_cb(ChimeConnection *cxn, gpointer _call, JsonNode *d
 		g_signal_emit(call, signals[NEW_PRESENTER], 0, presenter);
 	}
 
-	g_signal_emit(call, signals[PARTICIPANTS_CHANGED], 0, call->participants);
-
 	return ret;
 }
 
@@ -441,6 +509,7 @@ gboolean chime_call_participant_audio_stats(ChimeCall *call, const gchar *partic
 	if (vol != p->volume || signal_strength != p->signal_strength) {
 		p->volume = vol;
 		p->signal_strength = signal_strength;
+		journal_participant(call, CHIME_CALL_PARTICIPANTS_AUDIO, p);
 		return TRUE;
 	}
 
@@ -609,6 +678,18 @@ void chime_call_screen_set_state(ChimeCallScreen *screen, ChimeScreenState state
 	g_signal_emit(screen->call, signals[SCREEN_STATE], 0, state, message);
 }
 
+gboolean chime_call_get_audio_stats(ChimeCall *call, ChimeCallAudioStats *stats)
+{
+	g_return_val_if_fail(CHIME_IS_CALL(call), FALSE);
+	g_return_val_if_fail(stats != NULL, FALSE);
+
+	if (!call->audio)
+		return FALSE;
+
+	chime_call_audio_get_stats(call->audio, stats);
+	return TRUE;
+}
+
 void chime_call_install_gst_app_callbacks(ChimeCall *call, GstAppSrc *appsrc, GstAppSink *appsink)
 {
 	if (call->audio)
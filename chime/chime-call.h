@@ -101,8 +101,33 @@ struct _ChimeCallScreen;
 typedef struct _ChimeCallScreen ChimeCallScreen;
 
 
+/* "participants-changed" hands over the whole participants table, and is
+ * only emitted by chime_call_emit_participants(). Changes as they happen
+ * are batched up and emitted as "participants-updated", with the table of
+ * participants which changed since the last one on that channel. */
+typedef enum {
+	CHIME_CALL_PARTICIPANTS_AUDIO = 0,	/* Volume and signal strength */
+	CHIME_CALL_PARTICIPANTS_ROSTER,
+	CHIME_CALL_PARTICIPANTS_NR,
+} ChimeCallParticipantsChannel;
+
 void chime_call_emit_participants(ChimeCall *call);
 
+/* Incoming audio, since the audio connection was opened */
+typedef struct {
+	guint received;
+	guint lost;		/* Never arrived in time to be played */
+	guint late;		/* Arrived after we'd given up on them */
+	guint reordered;
+	guint duplicates;
+	guint jitter_ms;	/* RFC 3550 interarrival jitter */
+	guint depth;		/* Frames the jitter buffer will hold back */
+	guint latency_us;	/* Mean time from arrival to the appsrc */
+	guint latency_max_us;
+} ChimeCallAudioStats;
+
+gboolean chime_call_get_audio_stats(ChimeCall *call, ChimeCallAudioStats *stats);
+
 typedef enum {
 	CHIME_AUDIO_STATE_CONNECTING = 0,
 	CHIME_AUDIO_STATE_FAILED,
@@ -46,6 +46,21 @@
 #define soup_websocket_connection_get_close_code chime_websocket_connection_get_close_code
 #define soup_websocket_connection_get_close_data chime_websocket_connection_get_close_data
 #define SoupWebsocketConnection ChimeWebsocketConnection
+#else
+/* libsoup can't gather, so do it for it */
+static inline void
+chime_websocket_connection_send_binary_iov(SoupWebsocketConnection *ws,
+					   const GOutputVector *vectors,
+					   gint n_vectors)
+{
+	GByteArray *buf = g_byte_array_new();
+	gint i;
+
+	for (i = 0; i < n_vectors; i++)
+		g_byte_array_append(buf, vectors[i].buffer, vectors[i].size);
+	soup_websocket_connection_send_binary(ws, buf->data, buf->len);
+	g_byte_array_unref(buf);
+}
 #endif
 
 #define CHIME_ENUM_VALUE(val, nick) { val, #val, nick },
@@ -89,6 +104,25 @@ typedef enum {
 #define CHIME_DEVICE_CAP_WEBINAR			(1<<3)
 #define CHIME_DEVICE_CAP_PRESENCE_SUBSCRIPTION		(1<<4)
 
+/* Requests are admitted to the SoupSession per class, each with its own
+ * concurrency limit, so that a big sync or history fetch can't hold up
+ * the user sending a message. */
+typedef enum {
+	CHIME_REQ_INTERACTIVE,
+	CHIME_REQ_SYNC,
+	CHIME_REQ_BACKGROUND,
+	CHIME_REQ_NR
+} ChimeRequestClass;
+
+struct chime_req_class {
+	GQueue waiting;
+	guint in_flight;
+
+	/* Statistics */
+	guint nr_reqs, nr_done, max_depth;
+	gint64 wait_usec, max_wait_usec, rtt_usec;
+};
+
 /* SoupMessage handling for Chime communication, with retry on re-auth
  * and JSON parsing. XX: MAke this a proper superclass of SoupMessage */
 struct chime_msg {
@@ -97,8 +131,16 @@ struct chime_msg {
 	gpointer cb_data;
 	SoupMessage *msg;
 	gboolean auto_renew;
+	struct chime_json_stream *stream;
+	ChimeRequestClass cls;
+	gint64 queued_time, sent_time;
 };
 
+/* For streamed responses, called for each element of the array as it
+ * arrives. The node is only valid for the duration of the call. */
+typedef void (*ChimeJsonElementCallback)(ChimeConnection *cxn, JsonNode *node,
+					 gpointer cb_data);
+
 typedef struct {
 	ChimeConnectionState state;
 	GSList *amazon_cas;
@@ -133,11 +175,25 @@ typedef struct {
 	const gchar *feature_url;
 	gchar *express_url;
 
+	gchar *cache_dir;
+	GMappedFile *snapshot;
+
+	guint page_size;
+
+	/* Interned strings; see chime_connection_intern() */
+	GStringChunk *atom_chunk;
+	GHashTable *atoms;
+	guint atom_lookups;
+	gsize atom_bytes;
+
 	SoupSession *soup_sess;
 
 	/* Messages queued for resubmission */
 	GQueue *msgs_queued;
 	GQueue *msgs_pending_auth;
+	struct chime_req_class req_classes[CHIME_REQ_NR];
+	gboolean reqs_aborting;		/* Hold new requests back while disconnecting */
+	guint reqs_cancel_idle;
 
 	/* Juggernaut */
 	SoupWebsocketConnection *ws_conn;
@@ -145,12 +201,21 @@ typedef struct {
 	guint keepalive_timer;
 	gchar *ws_key;
 	GHashTable *subscriptions;
+	GQueue jugg_parsers;		/* Idle JsonParsers for reuse */
+	GHashTable *jugg_stats;		/* klass → struct jugg_klass_stats */
+	GHashTable *jugg_pending_subs;	/* channel → pending (un)subscribe */
+	guint jugg_flush_id;
+	gint64 jugg_connect_start;
 
 	/* Contacts */
 	ChimeObjectCollection contacts;
 	ChimeSyncState contacts_sync;
-	GSList *contacts_needed;
+	GQueue contacts_needed;		/* Waiting for a presence fetch */
 	guint contacts_src_id;
+	guint presence_fetches;		/* Presence requests in flight */
+	GHashTable *contacts_pending;	/* ChimeContact → pending notifies */
+	guint contacts_notify_id;
+	guint contacts_coalesced;
 
 	/* Rooms */
 	ChimeObjectCollection rooms;
@@ -178,6 +243,7 @@ chime_connection_websocket_connect_async (ChimeConnection      *cxn,
 					  SoupMessage          *msg,
 					  const char           *origin,
 					  char                **protocols,
+					  gboolean              deflate,
 					  GCancellable         *cancellable,
 					  GAsyncReadyCallback   callback,
 					  gpointer              user_data);
@@ -198,13 +264,40 @@ void chime_connection_new_conversation(ChimeConnection *cxn, ChimeConversation *
 void chime_connection_new_meeting(ChimeConnection *cxn, ChimeMeeting *meeting);
 void chime_connection_log(ChimeConnection *cxn, ChimeLogLevel level, const gchar *format, ...);
 void chime_connection_progress(ChimeConnection *cxn, int percent, const gchar *message);
+void chime_connection_timing(ChimeConnection *cxn, const gchar *what, gint64 usec);
 SoupMessage *chime_connection_queue_http_request(ChimeConnection *self, JsonNode *node,
 						 SoupURI *uri, const gchar *method,
 						 ChimeSoupMessageCallback callback,
 						 gpointer cb_data);
+SoupMessage *chime_connection_queue_http_request_class(ChimeConnection *self, JsonNode *node,
+						       SoupURI *uri, const gchar *method,
+						       ChimeRequestClass cls,
+						       ChimeSoupMessageCallback callback,
+						       gpointer cb_data);
+SoupMessage *chime_connection_queue_http_request_streamed(ChimeConnection *self, JsonNode *node,
+							  SoupURI *uri, const gchar *method,
+							  ChimeRequestClass cls,
+							  const gchar *member,
+							  ChimeJsonElementCallback elem_cb,
+							  gpointer elem_cb_data,
+							  ChimeSoupMessageCallback callback,
+							  gpointer cb_data);
 SoupURI *soup_uri_new_printf(const gchar *base, const gchar *format, ...);
+
+/* Called for each page of a paginated list request. 'more' is set if
+ * there's another page to come. Returning FALSE abandons the rest. */
+typedef gboolean (*ChimePageCallback)(ChimeConnection *cxn, SoupMessage *msg,
+				      JsonNode *node, gboolean more, gpointer cb_data);
+void chime_connection_fetch_pages(ChimeConnection *cxn, const gchar *what, SoupURI *uri,
+				  ChimeRequestClass cls,
+				  const gchar *member, ChimeJsonElementCallback elem_cb,
+				  ChimePageCallback callback, gpointer cb_data);
+const gchar *chime_connection_intern(ChimeConnection *cxn, const gchar *str);
+gboolean parse_atom(ChimeConnection *cxn, JsonNode *parent, const gchar *name, const gchar **res);
 gboolean parse_notify_pref(JsonNode *node, const gchar *member, ChimeNotifyPref *type);
 gboolean parse_visibility(JsonNode *node, const gchar *member, gboolean *val);
+const gchar *enum_value_nick(GType type, gint value);
+void build_notify_prefs(JsonBuilder *jb, ChimeNotifyPref desktop, ChimeNotifyPref mobile);
 
 
 /* chime-contact.c */
@@ -216,6 +309,9 @@ ChimeContact *chime_connection_parse_conversation_contact(ChimeConnection *cxn,
 ChimeContact *chime_connection_parse_contact(ChimeConnection *cxn,
 					     gboolean is_contact,
 					     JsonNode *node, GError **error);
+JsonNode *chime_contact_get_snapshot(ChimeContact *contact);
+JsonNode *chime_contact_get_member_snapshot(ChimeContact *contact);
+JsonNode *chime_contact_get_presence_snapshot(ChimeContact *contact);
 
 
 /* chime-juggernaut.c */
@@ -224,6 +320,7 @@ gboolean chime_connection_jugg_send(ChimeConnection *self, JsonNode *node);
 /* chime-conversation.c */
 void chime_init_conversations(ChimeConnection *cxn);
 void chime_destroy_conversations(ChimeConnection *cxn);
+JsonNode *chime_conversation_get_snapshot(ChimeConversation *conversation);
 
 /* chime-juggernaut.c */
 void chime_init_juggernaut(ChimeConnection *cxn);
@@ -237,10 +334,13 @@ void chime_jugg_subscribe(ChimeConnection *cxn, const gchar *channel,
 void chime_jugg_unsubscribe(ChimeConnection *cxn, const gchar *channel,
 			    const gchar *klass, JuggernautCallback cb,
 			    gpointer cb_data);
+/* The payload of a socket.io event; exposed for chime-check */
+void chime_jugg_handle_callback(ChimeConnection *cxn, const gchar *msg, gsize len);
 
 /* chime-rooms.c */
 void chime_init_rooms(ChimeConnection *cxn);
 void chime_destroy_rooms(ChimeConnection *cxn);
+JsonNode *chime_room_get_snapshot(ChimeRoom *room);
 gboolean chime_connection_fetch_room(ChimeConnection *cxn, const gchar *id,
 				     JuggernautCallback cb, gpointer cb_data);
 
@@ -267,4 +367,21 @@ void chime_initial_login(ChimeConnection *cxn);
 /* chime-certs.c */
 GSList *chime_cert_list(void);
 
+/* chime-snapshot.c */
+typedef enum {
+	CHIME_SNAPSHOT_CONTACTS,
+	CHIME_SNAPSHOT_ROOMS,
+	CHIME_SNAPSHOT_CONVERSATIONS,
+	CHIME_SNAPSHOT_PRESENCE,
+	CHIME_SNAPSHOT_NR
+} ChimeSnapshotSection;
+
+typedef gboolean (*ChimeSnapshotParseCB)(ChimeConnection *cxn, JsonNode *node);
+
+void chime_snapshot_open(ChimeConnection *cxn);
+void chime_snapshot_close(ChimeConnection *cxn);
+guint chime_snapshot_load(ChimeConnection *cxn, ChimeSnapshotSection section,
+			  ChimeSnapshotParseCB cb);
+void chime_snapshot_save(ChimeConnection *cxn);
+
 #endif /* __CHIME_CONNECTION_PRIVATE_H__ */
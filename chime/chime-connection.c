@@ -44,6 +44,7 @@ enum {
 	NEW_MEETING,
 	LOG_MESSAGE,
 	PROGRESS,
+	TIMING,
 	LAST_SIGNAL
 };
 
@@ -64,19 +65,97 @@ chime_connection_finalize(GObject *object)
 	g_free(priv->device_token);
 	g_free(priv->server);
 	g_free(priv->express_url);
+	g_free(priv->cache_dir);
+
+	/* Objects hold a reference to us, so nothing is still using these */
+	g_hash_table_destroy(priv->atoms);
+	g_string_chunk_free(priv->atom_chunk);
 
 	chime_connection_log(self, CHIME_LOGLVL_MISC, "Connection finalized: %p\n", self);
 
 	G_OBJECT_CLASS(chime_connection_parent_class)->finalize(object);
 }
 
+static void json_stream_free(struct chime_json_stream *stream);
+
 static void
 cmsg_free(struct chime_msg *cmsg)
 {
 	g_object_unref(cmsg->msg);
+	if (cmsg->stream)
+		json_stream_free(cmsg->stream);
 	g_free(cmsg);
 }
 
+static const struct {
+	const gchar *name;
+	guint limit;
+} req_class_info[CHIME_REQ_NR] = {
+	[CHIME_REQ_INTERACTIVE] = { "interactive", 4 },
+	[CHIME_REQ_SYNC] = { "sync", 3 },
+	[CHIME_REQ_BACKGROUND] = { "background", 2 },
+};
+
+/* Enough for all the classes to be at their limit at once, plus the websocket */
+#define CHIME_MAX_CONNS_PER_HOST 10
+
+/* Complain about interactive requests held up for this long */
+#define CHIME_REQ_SLOW_WAIT_USEC (G_USEC_PER_SEC / 2)
+
+/* Complete every waiting request through its callback, just as
+ * soup_session_abort() does for those already submitted. */
+static void cancel_waiting_requests(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	gboolean found;
+	int i;
+
+	do {
+		found = FALSE;
+		for (i = 0; i < CHIME_REQ_NR; i++) {
+			struct chime_msg *cmsg;
+
+			while ((cmsg = g_queue_pop_head(&priv->req_classes[i].waiting))) {
+				found = TRUE;
+				soup_message_set_status(cmsg->msg, SOUP_STATUS_CANCELLED);
+				if (cmsg->cb)
+					cmsg->cb(self, cmsg->msg, NULL, cmsg->cb_data);
+				cmsg_free(cmsg);
+			}
+		}
+	} while (found);
+}
+
+static gboolean cancel_waiting_idle(gpointer _self)
+{
+	ChimeConnection *self = _self;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	priv->reqs_cancel_idle = 0;
+	cancel_waiting_requests(self);
+	return FALSE;
+}
+
+static void log_request_stats(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	int i;
+
+	for (i = 0; i < CHIME_REQ_NR; i++) {
+		struct chime_req_class *rc = &priv->req_classes[i];
+
+		if (!rc->nr_done)
+			continue;
+
+		chime_connection_log(self, CHIME_LOGLVL_MISC,
+				     "HTTP %s: %u requests, max queue %u, wait avg %" G_GINT64_FORMAT
+				     "ms max %" G_GINT64_FORMAT "ms, latency avg %" G_GINT64_FORMAT "ms\n",
+				     req_class_info[i].name, rc->nr_reqs, rc->max_depth,
+				     rc->wait_usec / rc->nr_done / 1000, rc->max_wait_usec / 1000,
+				     rc->rtt_usec / rc->nr_done / 1000);
+	}
+}
+
 void
 chime_connection_disconnect(ChimeConnection    *self)
 {
@@ -84,10 +163,25 @@ chime_connection_disconnect(ChimeConnection    *self)
 
 	chime_connection_log(self, CHIME_LOGLVL_MISC, "Disconnecting connection: %p\n", self);
 
+	/* Anything still waiting is completed as cancelled rather than
+	 * submitted. Callbacks may queue more, both now and from the abort,
+	 * so hold them back and drain again once the session is done. */
+	priv->reqs_aborting = TRUE;
+	cancel_waiting_requests(self);
+
+	log_request_stats(self);
+
 	if (priv->soup_sess) {
 		soup_session_abort(priv->soup_sess);
 		g_clear_object(&priv->soup_sess);
 	}
+	cancel_waiting_requests(self);
+	priv->reqs_aborting = FALSE;
+
+	/* Only if we had a complete picture to save */
+	if (priv->state == CHIME_STATE_CONNECTED)
+		chime_snapshot_save(self);
+	chime_snapshot_close(self);
 
 	chime_destroy_meetings(self);
 	chime_destroy_calls(self);
@@ -98,6 +192,16 @@ chime_connection_disconnect(ChimeConnection    *self)
 
 	g_clear_pointer(&priv->reg_node, json_node_unref);
 
+	/* Everything which used them has gone with the collections and the
+	 * Juggernaut, and objects which outlive us have taken copies. */
+	chime_connection_log(self, CHIME_LOGLVL_MISC,
+			     "Interned %u strings (%" G_GSIZE_FORMAT " bytes) over %u lookups\n",
+			     g_hash_table_size(priv->atoms), priv->atom_bytes, priv->atom_lookups);
+	g_hash_table_remove_all(priv->atoms);
+	g_string_chunk_clear(priv->atom_chunk);
+	priv->atom_bytes = 0;
+	priv->atom_lookups = 0;
+
 	if (priv->msgs_pending_auth) {
 		g_queue_free_full(priv->msgs_pending_auth, (GDestroyNotify)cmsg_free);
 		priv->msgs_pending_auth = NULL;
@@ -283,6 +387,11 @@ chime_connection_class_init(ChimeConnectionClass *klass)
 		g_signal_new ("progress",
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
 			      0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_INT, G_TYPE_STRING);
+
+	signals[TIMING] =
+		g_signal_new ("timing",
+			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_INT64);
 }
 
 void chime_connection_fail_error(ChimeConnection *cxn, GError *error)
@@ -357,7 +466,8 @@ static void
 chime_connection_init(ChimeConnection *self)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
-	priv->soup_sess = soup_session_new();
+	priv->soup_sess = soup_session_new_with_options(SOUP_SESSION_MAX_CONNS_PER_HOST,
+							CHIME_MAX_CONNS_PER_HOST, NULL);
 	priv->amazon_cas = chime_cert_list();
 
 	if (getenv("CHIME_DEBUG") && atoi(getenv("CHIME_DEBUG")) > 0) {
@@ -377,6 +487,9 @@ chime_connection_init(ChimeConnection *self)
 	priv->msgs_pending_auth = g_queue_new();
 	priv->msgs_queued = g_queue_new();
 	priv->state = CHIME_STATE_DISCONNECTED;
+
+	priv->atom_chunk = g_string_chunk_new(4096);
+	priv->atoms = g_hash_table_new(g_str_hash, g_str_equal);
 }
 
 #define SIGNIN_DEFAULT "https://signin.id.ue1.app.chime.aws/"
@@ -417,9 +530,9 @@ static gboolean parse_regnode(ChimeConnection *self, JsonNode *regnode)
 	obj = json_node_get_object(sess_node);
 
 	node = json_object_get_member(obj, "Profile");
-	if (!parse_string(node, "profile_channel", &priv->profile_channel) ||
-	    !parse_string(node, "presence_channel", &priv->presence_channel) ||
-	    !parse_string(node, "id", &priv->profile_id) ||
+	if (!parse_atom(self, node, "profile_channel", &priv->profile_channel) ||
+	    !parse_atom(self, node, "presence_channel", &priv->presence_channel) ||
+	    !parse_atom(self, node, "id", &priv->profile_id) ||
 	    !parse_string(node, "display_name", &priv->display_name) ||
 	    !parse_string(node, "email", &priv->email))
 		return FALSE;
@@ -532,11 +645,15 @@ static void register_cb(ChimeConnection *self, SoupMessage *msg,
 	chime_jugg_subscribe(self, priv->presence_channel, NULL, NULL, NULL);
 	chime_jugg_subscribe(self, priv->device_channel, NULL, NULL, NULL);
 
+	chime_snapshot_open(self);
+
 	chime_init_contacts(self);
 	chime_init_rooms(self);
 	chime_init_conversations(self);
 	chime_init_calls(self);
 	chime_init_meetings(self);
+
+	chime_snapshot_close(self);
 }
 
 void chime_connection_calculate_online(ChimeConnection *self)
@@ -696,6 +813,59 @@ chime_connection_set_session_token(ChimeConnection *self,
 	}
 }
 
+static void send_request(ChimeConnection *self, struct chime_msg *cmsg)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	struct chime_req_class *rc = &priv->req_classes[cmsg->cls];
+	gint64 now = g_get_monotonic_time();
+	gint64 wait = now - cmsg->queued_time;
+
+	if (cmsg->cls == CHIME_REQ_INTERACTIVE && wait > CHIME_REQ_SLOW_WAIT_USEC)
+		chime_connection_log(self, CHIME_LOGLVL_INFO, "Request to %s waited %" G_GINT64_FORMAT "ms to be sent\n",
+				     soup_uri_get_path(soup_message_get_uri(cmsg->msg)), wait / 1000);
+
+	rc->in_flight++;
+	rc->wait_usec += wait;
+	if (wait > rc->max_wait_usec)
+		rc->max_wait_usec = wait;
+	cmsg->sent_time = now;
+
+	g_queue_push_tail(priv->msgs_queued, cmsg);
+	g_object_ref(self);
+	soup_session_queue_message(priv->soup_sess, cmsg->msg, soup_msg_cb, cmsg);
+}
+
+/* Submit whatever each class has room for. Classes are independent, so
+ * the background ones make progress however busy the others are. */
+static void schedule_requests(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	int i;
+
+	if (priv->reqs_aborting)
+		return;
+
+	/* Disconnected for good; nothing will ever send these. Complete
+	 * them from idle since the caller doesn't expect its callback yet. */
+	if (!priv->soup_sess) {
+		if (!priv->reqs_cancel_idle)
+			priv->reqs_cancel_idle = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+								 cancel_waiting_idle,
+								 g_object_ref(self),
+								 g_object_unref);
+		return;
+	}
+
+	for (i = 0; i < CHIME_REQ_NR; i++) {
+		struct chime_req_class *rc = &priv->req_classes[i];
+		struct chime_msg *cmsg;
+
+		while (rc->in_flight < req_class_info[i].limit &&
+		       (cmsg = g_queue_pop_head(&rc->waiting)))
+			send_request(self, cmsg);
+	}
+}
+
 /* If we get an auth failure on a standard request, we automatically attempt
  * to renew the authentication token and resubmit the request. */
 static void renew_cb(ChimeConnection *self, SoupMessage *msg,
@@ -727,9 +897,8 @@ static void renew_cb(ChimeConnection *self, SoupMessage *msg,
 					     "X-Chime-Auth-Token", cookie_hdr);
 		chime_connection_log(self, CHIME_LOGLVL_MISC, "Requeued %p to %s\n", cmsg->msg,
 				     soup_uri_get_path(soup_message_get_uri(cmsg->msg)));
-		g_object_ref(self);
-		soup_session_queue_message(priv->soup_sess, cmsg->msg,
-					   soup_msg_cb, cmsg);
+		/* These were already admitted, so they don't queue again */
+		send_request(self, cmsg);
 	}
 
 	g_free(cookie_hdr);
@@ -757,6 +926,177 @@ static void chime_renew_token(ChimeConnection *self)
 	g_object_unref(builder);
 }
 
+/*
+ * Streamed JSON responses. Rather than letting libsoup accumulate the
+ * whole body and then building a DOM for all of it, we scan each chunk
+ * as it arrives. Elements of the array we're interested in (the named
+ * member of the top-level object, or the top-level array itself if
+ * 'member' is NULL) are parsed and handed to the element callback one
+ * at a time. Everything else is kept as a 'skeleton' with that array
+ * left empty, which is parsed at the end and given to the normal
+ * response callback, for NextToken and friends.
+ */
+struct chime_json_stream {
+	ChimeConnection *cxn;
+	gchar *member;
+	ChimeJsonElementCallback cb;
+	gpointer cb_data;
+	JsonParser *parser;
+	GString *skel;
+	GString *elem;
+	gint depth, elem_depth;
+	gsize key_start;
+	goffset bytes;	/* The body isn't accumulated, so count it here */
+	gboolean active, in_string, escape, key_matched, in_array, failed;
+};
+
+static void json_stream_free(struct chime_json_stream *stream)
+{
+	g_object_unref(stream->parser);
+	g_string_free(stream->skel, TRUE);
+	g_string_free(stream->elem, TRUE);
+	g_free(stream->member);
+	g_free(stream);
+}
+
+/* Each response (including after a redirect or auth renewal) starts afresh */
+static void json_stream_got_headers(SoupMessage *msg, gpointer _stream)
+{
+	struct chime_json_stream *stream = _stream;
+
+	/* Error responses just get parsed whole */
+	stream->active = SOUP_STATUS_IS_SUCCESSFUL(msg->status_code);
+	g_string_truncate(stream->skel, 0);
+	g_string_truncate(stream->elem, 0);
+	stream->bytes = 0;
+	stream->depth = stream->elem_depth = 0;
+	stream->in_string = stream->escape = stream->key_matched = FALSE;
+	stream->in_array = stream->failed = FALSE;
+}
+
+static void json_stream_emit(struct chime_json_stream *stream)
+{
+	GError *error = NULL;
+
+	if (!stream->elem->len)
+		return;
+
+	if (json_parser_load_from_data(stream->parser, stream->elem->str,
+				       stream->elem->len, &error)) {
+		stream->cb(stream->cxn, json_parser_get_root(stream->parser),
+			   stream->cb_data);
+	} else {
+		g_warning("Error loading streamed element: %s", error->message);
+		g_error_free(error);
+		stream->failed = TRUE;
+	}
+	g_string_truncate(stream->elem, 0);
+}
+
+static void json_stream_got_chunk(SoupMessage *msg, SoupBuffer *chunk, gpointer _stream)
+{
+	struct chime_json_stream *stream = _stream;
+	gsize i;
+
+	stream->bytes += chunk->length;
+	for (i = 0; i < chunk->length; i++) {
+		gchar c = chunk->data[i];
+
+		if (stream->in_array) {
+			if (stream->in_string) {
+				g_string_append_c(stream->elem, c);
+				if (stream->escape)
+					stream->escape = FALSE;
+				else if (c == '\\')
+					stream->escape = TRUE;
+				else if (c == '"')
+					stream->in_string = FALSE;
+				continue;
+			}
+			if (!stream->elem_depth && (c == ',' || c == ']')) {
+				json_stream_emit(stream);
+				if (c == ']') {
+					g_string_append_c(stream->skel, ']');
+					stream->depth--;
+					stream->in_array = FALSE;
+				}
+				continue;
+			}
+			if (!stream->elem->len && g_ascii_isspace(c))
+				continue;
+
+			g_string_append_c(stream->elem, c);
+			if (c == '"')
+				stream->in_string = TRUE;
+			else if (c == '{' || c == '[')
+				stream->elem_depth++;
+			else if (c == '}' || c == ']')
+				stream->elem_depth--;
+			continue;
+		}
+
+		g_string_append_c(stream->skel, c);
+		if (stream->in_string) {
+			if (stream->escape)
+				stream->escape = FALSE;
+			else if (c == '\\')
+				stream->escape = TRUE;
+			else if (c == '"') {
+				gsize len = stream->skel->len - stream->key_start - 2;
+
+				stream->in_string = FALSE;
+				stream->key_matched = stream->depth == 1 && stream->member &&
+					len == strlen(stream->member) &&
+					!memcmp(stream->skel->str + stream->key_start + 1,
+						stream->member, len);
+			}
+			continue;
+		}
+
+		switch (c) {
+		case '"':
+			stream->in_string = TRUE;
+			stream->key_start = stream->skel->len - 1;
+			break;
+		case '[':
+			if (stream->active &&
+			    (stream->member ? stream->key_matched : !stream->depth))
+				stream->in_array = TRUE;
+			/* fall through */
+		case '{':
+			stream->depth++;
+			stream->key_matched = FALSE;
+			break;
+		case '}':
+		case ']':
+			stream->depth--;
+			stream->key_matched = FALSE;
+			break;
+		case ':':
+			break;
+		default:
+			if (!g_ascii_isspace(c))
+				stream->key_matched = FALSE;
+		}
+	}
+}
+
+static JsonNode *json_stream_finish(struct chime_json_stream *stream)
+{
+	GError *error = NULL;
+
+	if (stream->failed || stream->in_array || !stream->skel->len)
+		return NULL;
+
+	if (!json_parser_load_from_data(stream->parser, stream->skel->str,
+					stream->skel->len, &error)) {
+		g_warning("Error loading data: %s", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+	return json_parser_get_root(stream->parser);
+}
+
 /* First callback for SoupMessage completion — do the common
  * parsing of the JSON response (if any) and hand it on to the
  * real callback function. Also handles auth token renewal. */
@@ -767,10 +1107,16 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 	JsonParser *parser = NULL;
 	JsonNode *node = NULL;
+	struct chime_req_class *rc = &priv->req_classes[cmsg->cls];
 
 	if (priv->msgs_queued)
 		g_queue_remove(priv->msgs_queued, cmsg);
 
+	rc->in_flight--;
+	rc->nr_done++;
+	rc->rtt_usec += g_get_monotonic_time() - cmsg->sent_time;
+	schedule_requests(cxn);
+
 	/* Special case for renew_cb itself, which mustn't recurse! */
 	if (priv->state != CHIME_STATE_DISCONNECTED &&
 	    cmsg->cb != renew_cb && cmsg->cb != register_cb &&
@@ -795,7 +1141,12 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 	}
 
 	const gchar *content_type = soup_message_headers_get_content_type(msg->response_headers, NULL);
-	if (!g_strcmp0(content_type, "application/json") && msg->response_body->data) {
+	if (cmsg->stream) {
+		g_object_set_data(G_OBJECT(msg), "chime-stream-bytes",
+				  GSIZE_TO_POINTER(cmsg->stream->bytes));
+		if (!g_strcmp0(content_type, "application/json"))
+			node = json_stream_finish(cmsg->stream);
+	} else if (!g_strcmp0(content_type, "application/json") && msg->response_body->data) {
 		GError *error = NULL;
 
 		parser = json_parser_new();
@@ -810,28 +1161,39 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 	if (cmsg->cb)
 		cmsg->cb(cmsg->cxn, msg, node, cmsg->cb_data);
 	g_clear_object(&parser);
+	if (cmsg->stream)
+		json_stream_free(cmsg->stream);
 	g_free(cmsg);
 	g_object_unref(cxn);
 }
 
-SoupMessage *
-chime_connection_queue_http_request(ChimeConnection *self, JsonNode *node,
-				    SoupURI *uri, const gchar *method,
-				    ChimeSoupMessageCallback callback,
-				    gpointer cb_data)
+static SoupMessage *
+queue_http_request(ChimeConnection *self, JsonNode *node,
+		   SoupURI *uri, const gchar *method,
+		   ChimeRequestClass cls,
+		   struct chime_json_stream *stream,
+		   ChimeSoupMessageCallback callback,
+		   gpointer cb_data)
 {
-	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
-	g_return_val_if_fail(SOUP_URI_IS_VALID(uri), NULL);
-
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	struct chime_req_class *rc = &priv->req_classes[cls];
 	struct chime_msg *cmsg = g_new0(struct chime_msg, 1);
 
 	cmsg->cxn = self;
 	cmsg->cb = callback;
 	cmsg->cb_data = cb_data;
+	cmsg->cls = cls;
+	cmsg->queued_time = g_get_monotonic_time();
 	cmsg->msg = soup_message_new_from_uri(method, uri);
 	soup_uri_free(uri);
 
+	if (stream) {
+		cmsg->stream = stream;
+		soup_message_body_set_accumulate(cmsg->msg->response_body, FALSE);
+		g_signal_connect(cmsg->msg, "got-headers", G_CALLBACK(json_stream_got_headers), stream);
+		g_signal_connect(cmsg->msg, "got-chunk", G_CALLBACK(json_stream_got_chunk), stream);
+	}
+
 	if (priv->session_token) {
 		gchar *cookie = g_strdup_printf("_aws_wt_session=%s", priv->session_token);
 		soup_message_headers_append(cmsg->msg->request_headers, "Cookie", cookie);
@@ -856,17 +1218,79 @@ chime_connection_queue_http_request(ChimeConnection *self, JsonNode *node,
 	/* If we are already renewing the token, don't bother submitting it with the
 	 * old token just for it to fail (and perhaps trigger *another* token reneawl
 	 * which isn't even needed. */
+	rc->nr_reqs++;
 	if (cmsg->cb != renew_cb && !g_queue_is_empty(priv->msgs_pending_auth))
 		g_queue_push_tail(priv->msgs_pending_auth, cmsg);
-	else {
-		g_queue_push_tail(priv->msgs_queued, cmsg);
-		g_object_ref(self);
-		soup_session_queue_message(priv->soup_sess, cmsg->msg, soup_msg_cb, cmsg);
+	else if (cmsg->cb == renew_cb) {
+		/* Everything else is waiting for this one */
+		send_request(self, cmsg);
+	} else {
+		g_queue_push_tail(&rc->waiting, cmsg);
+		if (rc->waiting.length > rc->max_depth)
+			rc->max_depth = rc->waiting.length;
+		schedule_requests(self);
 	}
 
 	return cmsg->msg;
 }
 
+SoupMessage *
+chime_connection_queue_http_request(ChimeConnection *self, JsonNode *node,
+				    SoupURI *uri, const gchar *method,
+				    ChimeSoupMessageCallback callback,
+				    gpointer cb_data)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
+	g_return_val_if_fail(SOUP_URI_IS_VALID(uri), NULL);
+
+	return queue_http_request(self, node, uri, method, CHIME_REQ_INTERACTIVE,
+				  NULL, callback, cb_data);
+}
+
+SoupMessage *
+chime_connection_queue_http_request_class(ChimeConnection *self, JsonNode *node,
+					  SoupURI *uri, const gchar *method,
+					  ChimeRequestClass cls,
+					  ChimeSoupMessageCallback callback,
+					  gpointer cb_data)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
+	g_return_val_if_fail(SOUP_URI_IS_VALID(uri), NULL);
+	g_return_val_if_fail(cls < CHIME_REQ_NR, NULL);
+
+	return queue_http_request(self, node, uri, method, cls, NULL, callback, cb_data);
+}
+
+/* Like chime_connection_queue_http_request(), but the elements of the
+ * array 'member' (or the top-level array, if NULL) are handed to elem_cb
+ * as they arrive. The node passed to 'callback' has that array empty. */
+SoupMessage *
+chime_connection_queue_http_request_streamed(ChimeConnection *self, JsonNode *node,
+					     SoupURI *uri, const gchar *method,
+					     ChimeRequestClass cls,
+					     const gchar *member,
+					     ChimeJsonElementCallback elem_cb,
+					     gpointer elem_cb_data,
+					     ChimeSoupMessageCallback callback,
+					     gpointer cb_data)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
+	g_return_val_if_fail(SOUP_URI_IS_VALID(uri), NULL);
+	g_return_val_if_fail(cls < CHIME_REQ_NR, NULL);
+
+	struct chime_json_stream *stream = g_new0(struct chime_json_stream, 1);
+
+	stream->cxn = self;
+	stream->member = g_strdup(member);
+	stream->cb = elem_cb;
+	stream->cb_data = elem_cb_data;
+	stream->parser = json_parser_new();
+	stream->skel = g_string_new(NULL);
+	stream->elem = g_string_new(NULL);
+
+	return queue_http_request(self, node, uri, method, cls, stream, callback, cb_data);
+}
+
 void chime_connection_new_contact(ChimeConnection *cxn, ChimeContact *contact)
 {
 	g_signal_emit(cxn, signals[NEW_CONTACT], 0, contact);
@@ -904,6 +1328,200 @@ void chime_connection_progress(ChimeConnection *cxn, int percent, const gchar *m
 	g_signal_emit(cxn, signals[PROGRESS], 0, percent, message);
 }
 
+/*
+ * Paginated list requests (rooms, conversations, memberships, messages).
+ * We look for the NextToken and queue the request for the next page
+ * *before* handing the current page to the callback, so the server is
+ * working on it while we parse. The page size starts at the configured
+ * maximum, and backs off if pages are slow or large.
+ */
+#define CHIME_PAGE_SIZE_MIN	10
+#define CHIME_PAGE_SLOW_USEC	(2 * G_USEC_PER_SEC)
+#define CHIME_PAGE_FAST_USEC	(G_USEC_PER_SEC / 2)
+#define CHIME_PAGE_LARGE_BYTES	(1024 * 1024)
+
+struct chime_pager {
+	gchar *what;
+	SoupURI *uri;
+	ChimeRequestClass cls;
+	gchar *member;
+	ChimeJsonElementCallback elem_cb;
+	ChimePageCallback cb;
+	gpointer cb_data;
+	guint page_size;
+	guint pages;
+	gint64 start_time;
+	gint64 req_time;
+	gboolean pending;
+	gboolean in_callback;
+	gboolean abandoned;
+};
+
+static void free_pager(struct chime_pager *pager)
+{
+	soup_uri_free(pager->uri);
+	g_free(pager->member);
+	g_free(pager->what);
+	g_free(pager);
+}
+
+static void pager_cb(ChimeConnection *cxn, SoupMessage *msg,
+		     JsonNode *node, gpointer _pager);
+
+static void pager_elem_cb(ChimeConnection *cxn, JsonNode *node, gpointer _pager)
+{
+	struct chime_pager *pager = _pager;
+
+	/* A prefetched page arriving after the caller gave up */
+	if (!pager->abandoned)
+		pager->elem_cb(cxn, node, pager->cb_data);
+}
+
+static void pager_request(ChimeConnection *cxn, struct chime_pager *pager,
+			  const gchar *next_token)
+{
+	const gchar *query = soup_uri_get_query(pager->uri);
+	GHashTable *form;
+	gchar *size;
+	SoupURI *uri;
+
+	if (query)
+		form = soup_form_decode(query);
+	else
+		form = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	size = g_strdup_printf("%u", pager->page_size);
+	g_hash_table_replace(form, g_strdup("max-results"), size);
+	if (next_token)
+		g_hash_table_replace(form, g_strdup("next-token"), (gchar *)next_token);
+
+	uri = soup_uri_copy(pager->uri);
+	soup_uri_set_query_from_form(uri, form);
+	g_hash_table_destroy(form);
+	g_free(size);
+
+	pager->req_time = g_get_monotonic_time();
+	pager->pending = TRUE;
+	if (pager->elem_cb)
+		chime_connection_queue_http_request_streamed(cxn, NULL, uri, "GET", pager->cls,
+							     pager->member, pager_elem_cb, pager,
+							     pager_cb, pager);
+	else
+		chime_connection_queue_http_request_class(cxn, NULL, uri, "GET", pager->cls,
+							  pager_cb, pager);
+}
+
+/* Streamed responses aren't accumulated; soup_msg_cb() notes their size */
+static goffset response_bytes(SoupMessage *msg)
+{
+	gpointer bytes = g_object_get_data(G_OBJECT(msg), "chime-stream-bytes");
+
+	return bytes ? (goffset)GPOINTER_TO_SIZE(bytes) : msg->response_body->length;
+}
+
+static void pager_adapt(ChimeConnection *cxn, struct chime_pager *pager, goffset bytes)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gint64 elapsed = g_get_monotonic_time() - pager->req_time;
+	guint max_size = priv->page_size ? : CHIME_PAGE_SIZE_DEFAULT;
+	guint size = pager->page_size;
+
+	if (elapsed > CHIME_PAGE_SLOW_USEC ||
+	    bytes > CHIME_PAGE_LARGE_BYTES)
+		size = MAX(size / 2, CHIME_PAGE_SIZE_MIN);
+	else if (elapsed < CHIME_PAGE_FAST_USEC)
+		size = MIN(size * 2, max_size);
+
+	if (size != pager->page_size) {
+		chime_connection_log(cxn, CHIME_LOGLVL_MISC,
+				     "Page size for %s now %u (%" G_GINT64_FORMAT "ms, %" G_GOFFSET_FORMAT " bytes)\n",
+				     pager->what, size, elapsed / 1000, bytes);
+		pager->page_size = size;
+	}
+}
+
+static void pager_cb(ChimeConnection *cxn, SoupMessage *msg,
+		     JsonNode *node, gpointer _pager)
+{
+	struct chime_pager *pager = _pager;
+	const gchar *next_token = NULL;
+	gboolean more;
+
+	pager->pending = FALSE;
+
+	/* Either the caller has given up, or this is the prefetched page
+	 * being aborted from within the callback for the previous one. */
+	if (pager->abandoned || pager->in_callback) {
+		pager->abandoned = TRUE;
+		if (!pager->in_callback)
+			free_pager(pager);
+		return;
+	}
+
+	pager->pages++;
+	more = SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && node &&
+		parse_string(node, "NextToken", &next_token);
+
+	if (more) {
+		pager_adapt(cxn, pager, response_bytes(msg));
+		pager_request(cxn, pager, next_token);
+	}
+
+	pager->in_callback = TRUE;
+	if (!pager->cb(cxn, msg, node, more, pager->cb_data))
+		pager->abandoned = TRUE;
+	pager->in_callback = FALSE;
+
+	if (!more && SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
+		gint64 elapsed = g_get_monotonic_time() - pager->start_time;
+
+		chime_connection_log(cxn, CHIME_LOGLVL_MISC, "Fetched %s: %u pages in %" G_GINT64_FORMAT "ms\n",
+				     pager->what, pager->pages, elapsed / 1000);
+		chime_connection_timing(cxn, pager->what, elapsed);
+	}
+
+	/* If the next page is still in flight, its callback will free it */
+	if (!more || (pager->abandoned && !pager->pending))
+		free_pager(pager);
+}
+
+/* Takes ownership of 'uri'. Any query parameters on it are preserved.
+ * If elem_cb is set, the 'member' array of each page is streamed to it. */
+void chime_connection_fetch_pages(ChimeConnection *cxn, const gchar *what, SoupURI *uri,
+				  ChimeRequestClass cls,
+				  const gchar *member, ChimeJsonElementCallback elem_cb,
+				  ChimePageCallback callback, gpointer cb_data)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	struct chime_pager *pager = g_new0(struct chime_pager, 1);
+
+	pager->what = g_strdup(what);
+	pager->uri = uri;
+	pager->cls = cls;
+	pager->member = g_strdup(member);
+	pager->elem_cb = elem_cb;
+	pager->cb = callback;
+	pager->cb_data = cb_data;
+	pager->page_size = priv->page_size ? : CHIME_PAGE_SIZE_DEFAULT;
+	pager->start_time = g_get_monotonic_time();
+
+	pager_request(cxn, pager, NULL);
+}
+
+void chime_connection_set_page_size(ChimeConnection *self, guint page_size)
+{
+	g_return_if_fail(CHIME_IS_CONNECTION(self));
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	priv->page_size = MAX(page_size, CHIME_PAGE_SIZE_MIN);
+}
+
+/* Report how long (in µs) some phase of the connection took */
+void chime_connection_timing(ChimeConnection *cxn, const gchar *what, gint64 usec)
+{
+	g_signal_emit(cxn, signals[TIMING], 0, what, usec);
+}
+
 SoupURI *soup_uri_new_printf(const gchar *base, const gchar *format, ...)
 {
 	SoupURI *uri;
@@ -958,6 +1576,30 @@ gboolean parse_notify_pref(JsonNode *node, const gchar *member,
 	return TRUE;
 }
 
+/* The reverse of the above, for building records for the snapshot */
+const gchar *enum_value_nick(GType type, gint value)
+{
+	gpointer klass = g_type_class_ref(type);
+	GEnumValue *val = g_enum_get_value(klass, value);
+	g_type_class_unref(klass);
+
+	return val ? val->value_nick : NULL;
+}
+
+void build_notify_prefs(JsonBuilder *jb, ChimeNotifyPref desktop, ChimeNotifyPref mobile)
+{
+	jb = json_builder_set_member_name(jb, "Preferences");
+	jb = json_builder_begin_object(jb);
+	jb = json_builder_set_member_name(jb, "NotificationPreferences");
+	jb = json_builder_begin_object(jb);
+	jb = json_builder_set_member_name(jb, "DesktopNotificationPreferences");
+	jb = json_builder_add_string_value(jb, enum_value_nick(CHIME_TYPE_NOTIFY_PREF, desktop));
+	jb = json_builder_set_member_name(jb, "MobileNotificationPreferences");
+	jb = json_builder_add_string_value(jb, enum_value_nick(CHIME_TYPE_NOTIFY_PREF, mobile));
+	jb = json_builder_end_object(jb);
+	jb = json_builder_end_object(jb);
+}
+
 gboolean parse_int(JsonNode *node, const gchar *member, gint64 *val)
 {
 	node = json_object_get_member(json_node_get_object(node), member);
@@ -1006,12 +1648,125 @@ gboolean parse_string(JsonNode *parent, const gchar *name, const gchar **res)
 	return TRUE;
 }
 
-gboolean parse_time(JsonNode *parent, const gchar *name, const gchar **time_str, GTimeVal *tv)
+/*
+ * IDs and names turn up over and over again: in the objects in each
+ * collection, in room memberships and in the Juggernaut subscriptions.
+ * Keep one copy of each until we disconnect, so that they can be shared
+ * and compared by pointer.
+ */
+const gchar *chime_connection_intern(ChimeConnection *cxn, const gchar *str)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	const gchar *atom;
+
+	if (!str)
+		return NULL;
+
+	priv->atom_lookups++;
+	atom = g_hash_table_lookup(priv->atoms, str);
+	if (atom)
+		return atom;
+
+	atom = g_string_chunk_insert(priv->atom_chunk, str);
+	g_hash_table_add(priv->atoms, (gpointer)atom);
+	priv->atom_bytes += strlen(atom) + 1;
+	return atom;
+}
+
+/* As parse_string(), but the result is interned */
+gboolean parse_atom(ChimeConnection *cxn, JsonNode *parent, const gchar *name, const gchar **res)
+{
+	const gchar *str;
+
+	if (!parse_string(parent, name, &str))
+		return FALSE;
+
+	*res = chime_connection_intern(cxn, str);
+	return TRUE;
+}
+
+/* Days since 1970-01-01 in the proleptic Gregorian calendar */
+static gint64 days_from_civil(int y, int m, int d)
+{
+	int era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (gint64)era * 146097 + doe - 719468;
+}
+
+#define DIGITS2(p) (((p)[0] - '0') * 10 + (p)[1] - '0')
+
+/*
+ * The server always gives us "YYYY-MM-DDTHH:MM:SS.sssZ", so parse that
+ * directly into microseconds since the epoch. Anything else goes the long
+ * way round through g_time_val_from_iso8601().
+ */
+gboolean chime_parse_iso8601(const gchar *str, gint64 *usec)
+{
+	static const gchar pattern[] = "dddd-dd-ddTdd:dd:dd";
+	int y, mo, d, h, mi, s, frac = 0, scale = G_USEC_PER_SEC;
+	const gchar *p;
+	guint i;
+	GTimeVal tv;
+
+	if (!str)
+		return FALSE;
+
+	/* A NUL in the string fails this too, so we never read past it */
+	for (i = 0; i < sizeof(pattern) - 1; i++) {
+		if (pattern[i] == 'd' ? !g_ascii_isdigit(str[i]) : str[i] != pattern[i])
+			goto slow;
+	}
+
+	p = str + sizeof(pattern) - 1;
+	if (*p == '.') {
+		if (!g_ascii_isdigit(*++p))
+			goto slow;
+		for (; g_ascii_isdigit(*p); p++) {
+			if (scale > 1) {
+				scale /= 10;
+				frac += (*p - '0') * scale;
+			}
+		}
+	}
+	if (p[0] != 'Z' || p[1])
+		goto slow;
+
+	y = DIGITS2(str) * 100 + DIGITS2(str + 2);
+	mo = DIGITS2(str + 5);
+	d = DIGITS2(str + 8);
+	h = DIGITS2(str + 11);
+	mi = DIGITS2(str + 14);
+	s = DIGITS2(str + 17);
+	if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 59)
+		goto slow;
+
+	/* Not a real date, like 2020-02-30; don't let it roll over */
+	if (d > g_date_get_days_in_month(mo, y))
+		return FALSE;
+
+	*usec = ((days_from_civil(y, mo, d) * 24 + h) * 3600 + mi * 60 + s) * G_USEC_PER_SEC + frac;
+	return TRUE;
+
+ slow:
+	if (!g_time_val_from_iso8601(str, &tv))
+		return FALSE;
+
+	*usec = (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+	return TRUE;
+}
+
+gboolean parse_timestamp(JsonNode *parent, const gchar *name, const gchar **time_str, gint64 *usec)
 {
 	const gchar *msg_time;
 
 	if (!parse_string(parent, name, &msg_time) ||
-	    !g_time_val_from_iso8601(msg_time, tv))
+	    !chime_parse_iso8601(msg_time, usec))
 		return FALSE;
 
 	if (time_str)
@@ -1020,6 +1775,18 @@ gboolean parse_time(JsonNode *parent, const gchar *name, const gchar **time_str,
 	return TRUE;
 }
 
+gboolean parse_time(JsonNode *parent, const gchar *name, const gchar **time_str, GTimeVal *tv)
+{
+	gint64 usec;
+
+	if (!parse_timestamp(parent, name, time_str, &usec))
+		return FALSE;
+
+	tv->tv_sec = usec / G_USEC_PER_SEC;
+	tv->tv_usec = usec % G_USEC_PER_SEC;
+	return TRUE;
+}
+
 static void send_message_cb(ChimeConnection *self, SoupMessage *msg,
 			    JsonNode *node, gpointer user_data)
 {
@@ -1119,6 +1886,17 @@ chime_connection_send_message_finish(ChimeConnection *self, GAsyncResult *result
 	return g_task_propagate_pointer(G_TASK(result), error);
 }
 
+/* Where to keep the snapshot of contacts/rooms/conversations. If unset,
+ * we don't keep one. */
+void chime_connection_set_cache_dir(ChimeConnection *self, const gchar *dir)
+{
+	g_return_if_fail(CHIME_IS_CONNECTION(self));
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	g_free(priv->cache_dir);
+	priv->cache_dir = g_strdup(dir);
+}
+
 const gchar *chime_connection_get_profile_id(ChimeConnection *self)
 {
 	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
@@ -1143,25 +1921,10 @@ const gchar *chime_connection_get_email(ChimeConnection *self)
 	return priv->email;
 }
 
-struct fetch_msg_data {
-	ChimeObject *obj;
-	GHashTable *query;
-};
-static void free_fetch_msg_data(gpointer _fmd)
-{
-	struct fetch_msg_data *fmd = _fmd;
-	g_hash_table_destroy(fmd->query);
-	g_object_unref(fmd->obj);
-	g_free(fmd);
-}
-
-static void fetch_messages_req(ChimeConnection *self, GTask *task);
-
-static void fetch_messages_cb(ChimeConnection *self, SoupMessage *msg,
-			      JsonNode *node, gpointer user_data)
+static gboolean fetch_messages_cb(ChimeConnection *self, SoupMessage *msg,
+				  JsonNode *node, gboolean more, gpointer user_data)
 {
 	GTask *task = G_TASK(user_data);
-	struct fetch_msg_data *fmd = g_task_get_task_data(task);
 
 	if (!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
 		const gchar *reason = msg->reason_phrase;
@@ -1174,41 +1937,22 @@ static void fetch_messages_cb(ChimeConnection *self, SoupMessage *msg,
 					_("Failed to fetch messages: %d %s"),
 					msg->status_code, reason);
 	} else {
-		JsonObject *obj = json_node_get_object(node);
-		JsonNode *msgs_node = json_object_get_member(obj, "Messages");
-		JsonArray *msgs_array = json_node_get_array(msgs_node);
-		guint i, len = json_array_get_length(msgs_array);
-
-		for (i = 0; i < len; i++) {
-			JsonNode *msg_node = json_array_get_element(msgs_array, i);
-			const gchar *id;
-			if (parse_string(msg_node, "MessageId", &id))
-				g_signal_emit_by_name(fmd->obj, "message", msg_node);
-		}
-
-		const gchar *next_token;
-		if (parse_string(node, "NextToken", &next_token)) {
-			g_hash_table_insert(fmd->query, (void *)"next-token", g_strdup(next_token));
-			fetch_messages_req(self, task);
-			return;
-		}
+		if (more)
+			return TRUE;
 
 		g_task_return_boolean(task, TRUE);
 	}
 	g_object_unref(task);
+	return TRUE;
 }
 
-static void fetch_messages_req(ChimeConnection *self, GTask *task)
+static void message_elem_cb(ChimeConnection *self, JsonNode *node, gpointer user_data)
 {
-	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
-	struct fetch_msg_data *fmd = g_task_get_task_data(task);
-
-	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/%ss/%s/messages",
-					   CHIME_IS_ROOM(fmd->obj) ? "room" : "conversation",
-					   chime_object_get_id(fmd->obj));
-	soup_uri_set_query_from_form(uri, fmd->query);
-	chime_connection_queue_http_request(self, NULL, uri, "GET", fetch_messages_cb, task);
+	ChimeObject *obj = g_task_get_task_data(G_TASK(user_data));
+	const gchar *id;
 
+	if (parse_string(node, "MessageId", &id))
+		g_signal_emit_by_name(obj, "message", node);
 }
 
 void chime_connection_fetch_messages_async(ChimeConnection *self,
@@ -1221,18 +1965,29 @@ void chime_connection_fetch_messages_async(ChimeConnection *self,
 {
 	g_return_if_fail(CHIME_IS_CONNECTION(self));
 
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
 	GTask *task = g_task_new(self, cancellable, callback, user_data);
-	struct fetch_msg_data *fmd = g_new0(struct fetch_msg_data, 1);
-	fmd->obj = g_object_ref(obj);
-	fmd->query = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
-	g_hash_table_insert(fmd->query, (void *)"max-results", g_strdup("50"));
-	if (before)
-		g_hash_table_insert(fmd->query, (void *)"before", g_strdup(before));
-	if (after)
-		g_hash_table_insert(fmd->query, (void *)"after", g_strdup(after));
-
-	g_task_set_task_data(task, fmd, free_fetch_msg_data);
-	fetch_messages_req(self, task);
+	g_task_set_task_data(task, g_object_ref(obj), g_object_unref);
+
+	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/%ss/%s/messages",
+					   CHIME_IS_ROOM(obj) ? "room" : "conversation",
+					   chime_object_get_id(obj));
+	const gchar *opts[4] = {NULL};
+	int i = 0;
+
+	if (before) {
+		opts[i++] = "before";
+		opts[i++] = before;
+	}
+	if (after) {
+		opts[i++] = "after";
+		opts[i++] = after;
+	}
+	if (i)
+		soup_uri_set_query_from_fields(uri, opts[0], opts[1], opts[2], opts[3], NULL);
+
+	chime_connection_fetch_pages(self, "Messages", uri, CHIME_REQ_BACKGROUND,
+				     "Messages", message_elem_cb, fetch_messages_cb, task);
 }
 
 gboolean
@@ -99,6 +99,10 @@ gboolean chime_connection_log_out_finish (ChimeConnection  *self,
 					  GAsyncResult     *result,
 					  GError          **error);
 
+void chime_connection_set_cache_dir(ChimeConnection *self, const gchar *dir);
+#define CHIME_PAGE_SIZE_DEFAULT 50
+void chime_connection_set_page_size(ChimeConnection *self, guint page_size);
+
 const gchar *chime_connection_get_profile_id(ChimeConnection *self);
 const gchar *chime_connection_get_display_name(ChimeConnection *self);
 const gchar *chime_connection_get_email(ChimeConnection *self);
@@ -109,6 +113,8 @@ void chime_connection_disconnect(ChimeConnection *cxn);
 gboolean parse_int(JsonNode *node, const gchar *member, gint64 *val);
 gboolean parse_string(JsonNode *parent, const gchar *name, const gchar **res);
 gboolean parse_time(JsonNode *parent, const gchar *name, const gchar **time_str, GTimeVal *tv);
+gboolean parse_timestamp(JsonNode *parent, const gchar *name, const gchar **time_str, gint64 *usec);
+gboolean chime_parse_iso8601(const gchar *str, gint64 *usec);
 gboolean parse_boolean(JsonNode *node, const gchar *member, gboolean *val);
 G_END_DECLS
 
@@ -48,6 +48,7 @@ struct _ChimeContact {
 
 	ChimeAvailability availability;
 	gint64 avail_revision;
+	gboolean avail_live;	/* Not just from the snapshot */
 };
 
 G_DEFINE_TYPE(ChimeContact, chime_contact, CHIME_TYPE_OBJECT)
@@ -107,6 +108,67 @@ static gboolean contact_presence_jugg_cb(ChimeConnection *cxn, gpointer _self,
 					 JsonNode *data_node);
 static gboolean fetch_presences(gpointer _cxn);
 
+/*
+ * Presence and display name changes tend to arrive in bursts of thousands
+ * (the presence fetch on reconnect, or a contacts refresh) and each notify
+ * makes the UI update its buddy list. So collect them for a few frames and
+ * emit them all at once. Each contact gets at most one notify of each
+ * kind, however many updates it saw in the meantime.
+ */
+#define CONTACT_NOTIFY_AVAILABILITY	1
+#define CONTACT_NOTIFY_DISPLAY_NAME	2
+
+#define CONTACT_NOTIFY_DELAY_MSEC	50
+
+static gboolean flush_contact_notifies(gpointer _cxn)
+{
+	ChimeConnection *cxn = _cxn;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	GHashTable *pending = priv->contacts_pending;
+	GHashTableIter iter;
+	gpointer key, val;
+
+	/* Handlers may queue more; they'll go in the next batch */
+	priv->contacts_pending = NULL;
+	priv->contacts_notify_id = 0;
+
+	g_hash_table_iter_init(&iter, pending);
+	while (g_hash_table_iter_next(&iter, &key, &val)) {
+		GObject *obj = key;
+		guint what = GPOINTER_TO_UINT(val);
+
+		if (what & CONTACT_NOTIFY_AVAILABILITY)
+			g_object_notify_by_pspec(obj, props[PROP_AVAILABILITY]);
+		if (what & CONTACT_NOTIFY_DISPLAY_NAME)
+			g_object_notify_by_pspec(obj, props[PROP_DISPLAY_NAME]);
+	}
+	g_hash_table_destroy(pending);
+
+	return FALSE;
+}
+
+static void queue_contact_notify(ChimeConnection *cxn, ChimeContact *contact, guint what)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	guint pending;
+
+	if (!priv->contacts_pending)
+		priv->contacts_pending = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+							       g_object_unref, NULL);
+
+	pending = GPOINTER_TO_UINT(g_hash_table_lookup(priv->contacts_pending, contact));
+	if (pending)
+		priv->contacts_coalesced++;
+
+	/* If it was already there, g_hash_table_insert() drops the new ref */
+	g_hash_table_insert(priv->contacts_pending, g_object_ref(contact),
+			    GUINT_TO_POINTER(pending | what));
+
+	if (!priv->contacts_notify_id)
+		priv->contacts_notify_id = g_timeout_add(CONTACT_NOTIFY_DELAY_MSEC,
+							 flush_contact_notifies, cxn);
+}
+
 
 static void chime_contact_get_property(GObject *object, guint prop_id,
 				       GValue *value, GParamSpec *pspec)
@@ -286,7 +348,7 @@ subscribe_contact(ChimeConnection *cxn, ChimeContact *contact)
 
 	/* As well as subscribing to the channel, we'll need to fetch the
 	 * initial presence information for this contact */
-	priv->contacts_needed = g_slist_prepend(priv->contacts_needed, contact);
+	g_queue_push_tail(&priv->contacts_needed, contact);
 	if (!priv->contacts_src_id)
 		priv->contacts_src_id = g_idle_add(fetch_presences, g_object_ref(cxn));
 }
@@ -337,7 +399,7 @@ static ChimeContact *find_or_create_contact(ChimeConnection *cxn, const gchar *i
 	if (display_name && g_strcmp0(display_name, contact->display_name)) {
 		g_free(contact->display_name);
 		contact->display_name = g_strdup(display_name);
-		g_object_notify(G_OBJECT(contact), "display-name");
+		queue_contact_notify(cxn, contact, CONTACT_NOTIFY_DISPLAY_NAME);
 	}
 
 	if (presence_channel && !contact->presence_channel) {
@@ -413,9 +475,9 @@ ChimeContact *chime_connection_parse_conversation_contact(ChimeConnection *cxn,
 }
 
 /* Update contact presence with a node obtained with via a juggernaut
- * channel or explicit request. */
+ * channel or explicit request, or from the snapshot if 'cached'. */
 static gboolean set_contact_presence(ChimeConnection *cxn, JsonNode *node,
-				     GError **error)
+				     gboolean cached, GError **error)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 	gint64 availability, revision;
@@ -451,9 +513,11 @@ static gboolean set_contact_presence(ChimeConnection *cxn, JsonNode *node,
 		return TRUE;
 
 	contact->avail_revision = revision;
+	if (!cached)
+		contact->avail_live = TRUE;
 	if (contact->availability != availability) {
 		contact->availability = availability;
-		g_object_notify(G_OBJECT(contact), "availability");
+		queue_contact_notify(cxn, contact, CONTACT_NOTIFY_AVAILABILITY);
 	}
 
 	return TRUE;
@@ -468,54 +532,92 @@ static gboolean contact_presence_jugg_cb(ChimeConnection *cxn, gpointer _unused,
 	if (!record)
 		return FALSE;
 
-	return set_contact_presence(cxn, record, NULL);
+	return set_contact_presence(cxn, record, FALSE, NULL);
 }
 
+/*
+ * Presence is fetched in batches of PRESENCE_BATCH_MAX profile IDs, to keep
+ * the URL to a sane length (each ID is 36 characters plus a comma), with up
+ * to PRESENCE_FETCH_PARALLEL of them in flight at a time. The rest stay in
+ * contacts_needed rather than sitting built in the CHIME_REQ_BACKGROUND
+ * queue, so contacts subscribed in the meantime fill out later batches and
+ * those which go away or hear from Juggernaut first are dropped.
+ */
+#define PRESENCE_BATCH_MAX	50
+#define PRESENCE_FETCH_PARALLEL	2
+
+static void send_presence_batches(ChimeConnection *cxn);
+
 static void presence_cb(ChimeConnection *cxn, SoupMessage *msg,
 			 JsonNode *node, gpointer _unused)
 {
-	if (!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code))
-		return;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	if (priv->presence_fetches)
+		priv->presence_fetches--;
 
-	JsonObject *obj = json_node_get_object(node);
-	node = json_object_get_member(obj, "Presences");
-	if (!node)
+	/* Being aborted on disconnect */
+	if (msg->status_code == SOUP_STATUS_CANCELLED)
 		return;
 
-	JsonArray *arr = json_node_get_array(node);
-	int i, len = json_array_get_length(arr);
-	for (i = 0; i < len; i++)
-		set_contact_presence(cxn, json_array_get_element(arr, i), NULL);
+	if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && node) {
+		JsonObject *obj = json_node_get_object(node);
+		JsonNode *presences = json_object_get_member(obj, "Presences");
+
+		if (presences) {
+			JsonArray *arr = json_node_get_array(presences);
+			int i, len = json_array_get_length(arr);
+			for (i = 0; i < len; i++)
+				set_contact_presence(cxn, json_array_get_element(arr, i),
+						     FALSE, NULL);
+		}
+	}
+
+	send_presence_batches(cxn);
 }
 
-static gboolean fetch_presences(gpointer _cxn)
+static void send_presence_batches(ChimeConnection *cxn)
 {
-	ChimeConnection *cxn = _cxn;
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	GPtrArray *ids = g_ptr_array_new();
-
-	while (priv->contacts_needed) {
-		ChimeContact *contact = priv->contacts_needed->data;
-		priv->contacts_needed = g_slist_remove(priv->contacts_needed,
-						       contact);
-		if (!contact || contact->avail_revision)
-			continue;
-
-		g_ptr_array_add(ids, (gpointer)chime_object_get_id(CHIME_OBJECT(contact)));
-	}
-	if (ids->len > 0) {
-		g_ptr_array_add(ids, NULL);
+	GString *query = g_string_new(NULL);
 
-		gchar *query = g_strjoinv(",", (gchar **)ids->pdata);
+	while (priv->presence_fetches < PRESENCE_FETCH_PARALLEL &&
+	       !g_queue_is_empty(&priv->contacts_needed)) {
+		ChimeContact *contact;
+		int count = 0;
+
+		g_string_truncate(query, 0);
+		while (count < PRESENCE_BATCH_MAX &&
+		       (contact = g_queue_pop_head(&priv->contacts_needed))) {
+			/* Already heard from Juggernaut or a previous batch. A
+			 * revision loaded from the snapshot still gets refreshed. */
+			if (contact->avail_live)
+				continue;
+
+			if (count++)
+				g_string_append_c(query, ',');
+			g_string_append(query, chime_object_get_id(CHIME_OBJECT(contact)));
+		}
+		if (!count)
+			break;
 
 		SoupURI *uri = soup_uri_new_printf(priv->presence_url, "/presence");
-		soup_uri_set_query_from_fields(uri, "profile-ids", query, NULL);
-		g_free(query);
+		soup_uri_set_query_from_fields(uri, "profile-ids", query->str, NULL);
 
-		chime_connection_queue_http_request(cxn, NULL, uri, "GET",
-						    presence_cb, NULL);
+		priv->presence_fetches++;
+		chime_connection_queue_http_request_class(cxn, NULL, uri, "GET",
+							  CHIME_REQ_BACKGROUND,
+							  presence_cb, NULL);
 	}
-	g_ptr_array_unref(ids);
+	g_string_free(query, TRUE);
+}
+
+static gboolean fetch_presences(gpointer _cxn)
+{
+	ChimeConnection *cxn = _cxn;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	send_presence_batches(cxn);
 	priv->contacts_src_id = 0;
 	g_object_unref(cxn);
 	return FALSE;
@@ -523,6 +625,11 @@ static gboolean fetch_presences(gpointer _cxn)
 
 static void fetch_contacts(ChimeConnection *cxn, const gchar *next_token);
 
+static void contact_elem_cb(ChimeConnection *cxn, JsonNode *node, gpointer _unused)
+{
+	chime_connection_parse_contact(cxn, TRUE, node, NULL);
+}
+
 static void contacts_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
 			gpointer _unused)
 {
@@ -536,15 +643,6 @@ static void contacts_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
 	}
 
 	if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && node) {
-		JsonArray *arr = json_node_get_array(node);
-		guint i, len = json_array_get_length(arr);
-
-		for (i = 0; i < len; i++) {
-			chime_connection_parse_contact(cxn, TRUE,
-						       json_array_get_element(arr, i),
-						       NULL);
-		}
-
 		const gchar *next_token = soup_message_headers_get_one(msg->response_headers, "aws-ucbuzz-nexttoken");;
 		if (next_token)
 			fetch_contacts(cxn, next_token);
@@ -593,8 +691,93 @@ static void fetch_contacts(ChimeConnection *cxn, const gchar *next_token)
 	if (next_token)
 		soup_uri_set_query_from_fields(uri, "next_token", next_token, NULL);
 
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", contacts_cb,
-					    NULL);
+	chime_connection_queue_http_request_streamed(cxn, NULL, uri, "GET", CHIME_REQ_SYNC,
+						     NULL, contact_elem_cb, NULL,
+						     contacts_cb, NULL);
+}
+
+static gboolean load_snapshot_contact(ChimeConnection *cxn, JsonNode *node)
+{
+	return !!chime_connection_parse_contact(cxn, TRUE, node, NULL);
+}
+
+static gboolean load_snapshot_presence(ChimeConnection *cxn, JsonNode *node)
+{
+	return set_contact_presence(cxn, node, TRUE, NULL);
+}
+
+static void build_string(JsonBuilder *jb, const gchar *member, const gchar *str)
+{
+	if (str) {
+		jb = json_builder_set_member_name(jb, member);
+		jb = json_builder_add_string_value(jb, str);
+	}
+}
+
+/* In the same form as the server's contacts list, for the snapshot */
+JsonNode *chime_contact_get_snapshot(ChimeContact *contact)
+{
+	g_return_val_if_fail(CHIME_IS_CONTACT(contact), NULL);
+
+	JsonBuilder *jb = json_builder_new();
+	jb = json_builder_begin_object(jb);
+	build_string(jb, "id", chime_contact_get_profile_id(contact));
+	build_string(jb, "email", chime_contact_get_email(contact));
+	build_string(jb, "full_name", contact->full_name);
+	build_string(jb, "display_name", contact->display_name);
+	build_string(jb, "presence_channel", contact->presence_channel);
+	build_string(jb, "profile_channel", contact->profile_channel);
+	jb = json_builder_end_object(jb);
+
+	JsonNode *node = json_builder_get_root(jb);
+	g_object_unref(jb);
+	return node;
+}
+
+/* And as a conversation's member list has it */
+JsonNode *chime_contact_get_member_snapshot(ChimeContact *contact)
+{
+	g_return_val_if_fail(CHIME_IS_CONTACT(contact), NULL);
+
+	/* chime_connection_parse_conversation_contact() would refuse it */
+	if (!contact->presence_channel)
+		return NULL;
+
+	JsonBuilder *jb = json_builder_new();
+	jb = json_builder_begin_object(jb);
+	build_string(jb, "ProfileId", chime_contact_get_profile_id(contact));
+	build_string(jb, "Email", chime_contact_get_email(contact));
+	build_string(jb, "FullName", contact->full_name);
+	build_string(jb, "DisplayName", contact->display_name);
+	build_string(jb, "PresenceChannel", contact->presence_channel);
+	jb = json_builder_end_object(jb);
+
+	JsonNode *node = json_builder_get_root(jb);
+	g_object_unref(jb);
+	return node;
+}
+
+/* In the same form as the server's presence records, for the snapshot */
+JsonNode *chime_contact_get_presence_snapshot(ChimeContact *contact)
+{
+	g_return_val_if_fail(CHIME_IS_CONTACT(contact), NULL);
+
+	if (!contact->avail_revision)
+		return NULL;
+
+	JsonBuilder *jb = json_builder_new();
+	jb = json_builder_begin_object(jb);
+	jb = json_builder_set_member_name(jb, "ProfileId");
+	jb = json_builder_add_string_value(jb, chime_contact_get_profile_id(contact));
+	jb = json_builder_set_member_name(jb, "Revision");
+	jb = json_builder_add_int_value(jb, contact->avail_revision);
+	jb = json_builder_set_member_name(jb, "Availability");
+	jb = json_builder_add_int_value(jb, contact->availability);
+	jb = json_builder_end_object(jb);
+
+	JsonNode *node = json_builder_get_root(jb);
+	g_object_unref(jb);
+	return node;
 }
 
 void chime_init_contacts(ChimeConnection *cxn)
@@ -604,6 +787,13 @@ void chime_init_contacts(ChimeConnection *cxn)
 
 	chime_object_collection_init(cxn, &priv->contacts);
 
+	/* If we have them cached, don't wait for the fetch to complete */
+	if (chime_snapshot_load(cxn, CHIME_SNAPSHOT_CONTACTS, load_snapshot_contact)) {
+		priv->contacts_online = TRUE;
+		/* Stale, but better than showing everyone as offline */
+		chime_snapshot_load(cxn, CHIME_SNAPSHOT_PRESENCE, load_snapshot_presence);
+	}
+
 	fetch_contacts(cxn, NULL);
 }
 
@@ -613,8 +803,7 @@ static void unsubscribe_contact(gpointer key, gpointer val, gpointer data)
 	if (contact->cxn) {
 		ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (contact->cxn);
 
-		priv->contacts_needed = g_slist_remove(priv->contacts_needed,
-						       contact);
+		g_queue_remove_all(&priv->contacts_needed, contact);
 
 		if (contact->subscribed)
 			chime_jugg_unsubscribe(contact->cxn, contact->presence_channel, "Presence",
@@ -633,10 +822,18 @@ void chime_destroy_contacts(ChimeConnection *cxn)
 		g_source_remove(priv->contacts_src_id);
 		priv->contacts_src_id = 0;
 	}
-	if (priv->contacts_needed) {
-		g_slist_free(priv->contacts_needed);
-		priv->contacts_needed = NULL;
+	g_queue_clear(&priv->contacts_needed);
+	priv->presence_fetches = 0;
+
+	/* Nobody's listening any more */
+	if (priv->contacts_notify_id) {
+		g_source_remove(priv->contacts_notify_id);
+		priv->contacts_notify_id = 0;
 	}
+	g_clear_pointer(&priv->contacts_pending, g_hash_table_destroy);
+	/* Not reset; chime_connection_get_contacts_coalesced() is a running total */
+	chime_connection_log(cxn, CHIME_LOGLVL_MISC, "Coalesced %u contact updates so far\n",
+			     priv->contacts_coalesced);
 	if (priv->contacts.by_id)
 		g_hash_table_foreach(priv->contacts.by_id, unsubscribe_contact, NULL);
 
@@ -676,6 +873,14 @@ void chime_connection_foreach_contact(ChimeConnection *cxn, ChimeContactCB cb,
 	chime_object_collection_foreach_object(cxn, &priv->contacts, (ChimeObjectCB)cb, cbdata);
 }
 
+guint chime_connection_get_contacts_coalesced(ChimeConnection *cxn)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(cxn), 0);
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	return priv->contacts_coalesced;
+}
+
 static void contact_invited_cb(ChimeConnection *cxn, SoupMessage *msg,
 			       JsonNode *node, gpointer user_data)
 {
@@ -74,6 +74,9 @@ typedef void (*ChimeContactCB) (ChimeConnection *, ChimeContact *, gpointer);
 void chime_connection_foreach_contact(ChimeConnection *cxn, ChimeContactCB cb,
 				      gpointer cbdata);
 
+/* Contact notifies saved by batching, over the life of the ChimeConnection */
+guint chime_connection_get_contacts_coalesced(ChimeConnection *cxn);
+
 void chime_connection_invite_contact_async(ChimeConnection *self,
 					   const gchar *email,
 					   GCancellable *cancellable,
@@ -27,7 +27,9 @@
 	x(favourite, FAVOURITE, "Favorite", "favourite", "favourite", TRUE)
 
 #define STRING_PROPS(x)							\
-	x(channel, CHANNEL, "Channel", "channel", "channel", TRUE) \
+	x(channel, CHANNEL, "Channel", "channel", "channel", TRUE)
+
+#define TIME_PROPS(x)							\
 	x(created_on, CREATED_ON, "CreatedOn", "created-on", "created on", TRUE) \
 	x(updated_on, UPDATED_ON, "UpdatedOn", "updated-on", "updated on", TRUE) \
 	x(last_sent, LAST_SENT, "LastSent", "last-sent", "last sent", FALSE)
@@ -282,6 +284,27 @@ const gchar *chime_conversation_get_created_on(ChimeConversation *self)
 	return self->created_on;
 }
 
+gint64 chime_conversation_get_last_sent_time(ChimeConversation *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(self), 0);
+
+	return self->last_sent_time;
+}
+
+gint64 chime_conversation_get_updated_on_time(ChimeConversation *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(self), 0);
+
+	return self->updated_on_time;
+}
+
+gint64 chime_conversation_get_created_on_time(ChimeConversation *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(self), 0);
+
+	return self->created_on_time;
+}
+
 static gboolean conv_typing_jugg_cb(ChimeConnection *cxn, gpointer _conv, JsonNode *data_node)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
@@ -470,18 +493,57 @@ static ChimeConversation *chime_connection_parse_conversation(ChimeConnection *c
 	return conversation;
 }
 
-static void fetch_conversations(ChimeConnection *cxn, const gchar *next_token);
+static void snapshot_member(gpointer key, gpointer val, gpointer _jb)
+{
+	JsonBuilder *jb = _jb;
+	JsonNode *node = chime_contact_get_member_snapshot(CHIME_CONTACT(val));
+
+	if (node)
+		json_builder_add_value(jb, node);
+}
+
+/* Enough of a server record for chime_connection_parse_conversation() to
+ * recreate it */
+JsonNode *chime_conversation_get_snapshot(ChimeConversation *conversation)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(conversation), NULL);
+
+	JsonBuilder *jb = json_builder_new();
+	jb = json_builder_begin_object(jb);
+	jb = json_builder_set_member_name(jb, "ConversationId");
+	jb = json_builder_add_string_value(jb, chime_object_get_id(CHIME_OBJECT(conversation)));
+	jb = json_builder_set_member_name(jb, "Name");
+	jb = json_builder_add_string_value(jb, chime_object_get_name(CHIME_OBJECT(conversation)));
+	jb = json_builder_set_member_name(jb, "Visibility");
+	jb = json_builder_add_string_value(jb, conversation->visibility ? "visible" : "hidden");
+
+	CHIME_PROPS_SNAPSHOT
+
+	jb = json_builder_set_member_name(jb, "Members");
+	jb = json_builder_begin_array(jb);
+	g_hash_table_foreach(conversation->members, snapshot_member, jb);
+	jb = json_builder_end_array(jb);
+
+	build_notify_prefs(jb, conversation->desktop_notification, conversation->mobile_notification);
+	jb = json_builder_end_object(jb);
+
+	JsonNode *node = json_builder_get_root(jb);
+	g_object_unref(jb);
+	return node;
+}
+
+static void fetch_conversations(ChimeConnection *cxn);
 
-static void conversations_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
-			gpointer _unused)
+static gboolean conversations_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
+			gboolean more, gpointer _unused)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	/* If it got invalidated while in transit, refetch */
 	if (priv->conversations_sync != CHIME_SYNC_FETCHING) {
 		priv->conversations_sync = CHIME_SYNC_IDLE;
-		fetch_conversations(cxn, NULL);
-		return;
+		fetch_conversations(cxn);
+		return FALSE;
 	}
 
 	if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && node) {
@@ -490,21 +552,9 @@ static void conversations_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *n
 		if (!conversations_node) {
 			chime_connection_fail(cxn, CHIME_ERROR_BAD_RESPONSE,
 					      _("Failed to find Conversations node in response"));
-			return;
-		}
-		JsonArray *arr = json_node_get_array(conversations_node);
-		guint i, len = json_array_get_length(arr);
-
-		for (i = 0; i < len; i++) {
-			chime_connection_parse_conversation(cxn,
-							    json_array_get_element(arr, i),
-							    NULL);
+			return FALSE;
 		}
-
-		const gchar *next_token;
-		if (parse_string(node, "NextToken", &next_token))
-			fetch_conversations(cxn, next_token);
-		else {
+		if (!more) {
 			priv->conversations_sync = CHIME_SYNC_IDLE;
 
 			chime_object_collection_expire_outdated(&priv->conversations);
@@ -523,34 +573,42 @@ static void conversations_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *n
 				      _("Failed to fetch conversations (%d): %s\n"),
 				      msg->status_code, reason);
 	}
+	return TRUE;
 }
 
-static void fetch_conversations(ChimeConnection *cxn, const gchar *next_token)
+static void conversation_elem_cb(ChimeConnection *cxn, JsonNode *node, gpointer _unused)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
-	if (!next_token) {
-		/* Actually we could listen for the 'starting' flag on the message,
-		 * and as long as *that* hasn't happened yet we don't need to refetch
-		 * as it'll get up-to-date information. */
-		switch(priv->conversations_sync) {
-		case CHIME_SYNC_FETCHING:
-			priv->conversations_sync = CHIME_SYNC_STALE;
-		case CHIME_SYNC_STALE:
-			return;
-
-		case CHIME_SYNC_IDLE:
-			priv->conversations.generation++;
-			priv->conversations_sync = CHIME_SYNC_FETCHING;
-		}
+	/* Stale; conversations_cb() will refetch, so don't bother parsing it */
+	if (priv->conversations_sync != CHIME_SYNC_FETCHING)
+		return;
+
+	chime_connection_parse_conversation(cxn, node, NULL);
+}
+
+static void fetch_conversations(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	/* Actually we could listen for the 'starting' flag on the message,
+	 * and as long as *that* hasn't happened yet we don't need to refetch
+	 * as it'll get up-to-date information. */
+	switch(priv->conversations_sync) {
+	case CHIME_SYNC_FETCHING:
+		priv->conversations_sync = CHIME_SYNC_STALE;
+	case CHIME_SYNC_STALE:
+		return;
+
+	case CHIME_SYNC_IDLE:
+		priv->conversations.generation++;
+		priv->conversations_sync = CHIME_SYNC_FETCHING;
 	}
 
 	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/conversations");
-	soup_uri_set_query_from_fields(uri, "max-results", "50",
-				       next_token ? "next-token" : NULL, next_token,
-				       NULL);
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", conversations_cb,
-					    NULL);
+	chime_connection_fetch_pages(cxn, "Conversations", uri, CHIME_REQ_SYNC,
+				     "Conversations", conversation_elem_cb,
+				     conversations_cb, NULL);
 }
 
 
@@ -643,18 +701,27 @@ static gboolean conv_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *d
 	return !!chime_connection_parse_conversation(cxn, record, NULL);
 }
 
+static gboolean load_snapshot_conversation(ChimeConnection *cxn, JsonNode *node)
+{
+	return !!chime_connection_parse_conversation(cxn, node, NULL);
+}
+
 void chime_init_conversations(ChimeConnection *cxn)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	chime_object_collection_init(cxn, &priv->conversations);
 
+	/* If we have them cached, don't wait for the fetch to complete */
+	if (chime_snapshot_load(cxn, CHIME_SNAPSHOT_CONVERSATIONS, load_snapshot_conversation))
+		priv->convs_online = TRUE;
+
 	chime_jugg_subscribe(cxn, priv->device_channel, "Conversation",
 			     conv_jugg_cb, NULL);
 	chime_jugg_subscribe(cxn, priv->device_channel, "ConversationMessage",
 			     conv_msg_jugg_cb, NULL);
 
-	fetch_conversations(cxn, NULL);
+	fetch_conversations(cxn);
 }
 
 static void unsubscribe_conversation(gpointer key, gpointer val, gpointer data)
@@ -47,6 +47,11 @@ const gchar *chime_conversation_get_last_sent(ChimeConversation *self);
 const gchar *chime_conversation_get_updated_on(ChimeConversation *self);
 const gchar *chime_conversation_get_created_on(ChimeConversation *self);
 
+/* The same, in microseconds since the epoch. Zero if unset. */
+gint64 chime_conversation_get_last_sent_time(ChimeConversation *self);
+gint64 chime_conversation_get_updated_on_time(ChimeConversation *self);
+gint64 chime_conversation_get_created_on_time(ChimeConversation *self);
+
 ChimeConversation *chime_connection_conversation_by_name(ChimeConnection *cxn,
 					 const gchar *name);
 ChimeConversation *chime_connection_conversation_by_id(ChimeConnection *cxn,
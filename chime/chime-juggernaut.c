@@ -27,18 +27,140 @@
 
 static void connect_jugg(ChimeConnection *cxn);
 
-struct jugg_subscription {
+/*
+ * priv->subscriptions is a GHashTable with the interned 'channel' as key,
+ * and a struct jugg_channel as the value. Within each channel, subscribers
+ * are grouped by klass, which is held as a GQuark so that dispatch is just an
+ * integer comparison. A klass of zero matches every message. Each group
+ * also hashes its live subscribers by (cb, cb_data), so that subscribing
+ * and unsubscribing don't depend on how many others share the group.
+ */
+struct jugg_subscriber {
 	JuggernautCallback cb;
 	gpointer cb_data;
-	gchar *klass;
+	guint idx;		/* Position in ks->subs */
+	gboolean removed;	/* Unsubscribed during dispatch */
+};
+
+struct jugg_klass_subs {
+	GQuark klass;
+	GPtrArray *subs;
+	GHashTable *by_cb;
 };
 
-static void free_jugg_subscription(gpointer user_data)
+struct jugg_channel {
+	GPtrArray *klasses;
+	guint nr_subs;
+	guint dispatching;
+	gboolean dirty;
+};
+
+static void free_jugg_klass_subs(gpointer _ks)
+{
+	struct jugg_klass_subs *ks = _ks;
+
+	g_hash_table_destroy(ks->by_cb);
+	g_ptr_array_free(ks->subs, TRUE);
+	g_free(ks);
+}
+
+static void free_jugg_channel(gpointer _ch)
+{
+	struct jugg_channel *ch = _ch;
+
+	g_ptr_array_free(ch->klasses, TRUE);
+	g_free(ch);
+}
+
+static struct jugg_klass_subs *find_klass_subs(struct jugg_channel *ch, GQuark klass)
+{
+	guint i;
+
+	for (i = 0; i < ch->klasses->len; i++) {
+		struct jugg_klass_subs *ks = g_ptr_array_index(ch->klasses, i);
+		if (ks->klass == klass)
+			return ks;
+	}
+	return NULL;
+}
+
+static guint subscriber_hash(gconstpointer _sub)
+{
+	const struct jugg_subscriber *sub = _sub;
+
+	return g_direct_hash((gconstpointer)sub->cb) * 31 + g_direct_hash(sub->cb_data);
+}
+
+static gboolean subscriber_equal(gconstpointer _a, gconstpointer _b)
+{
+	const struct jugg_subscriber *a = _a, *b = _b;
+
+	return a->cb == b->cb && a->cb_data == b->cb_data;
+}
+
+static struct jugg_subscriber *find_subscriber(struct jugg_klass_subs *ks,
+					       JuggernautCallback cb, gpointer cb_data)
+{
+	struct jugg_subscriber key = { cb, cb_data };
+
+	return g_hash_table_lookup(ks->by_cb, &key);
+}
+
+/* Fill the hole with the last entry; the order within a group doesn't matter */
+static void remove_subscriber(struct jugg_klass_subs *ks, struct jugg_subscriber *sub)
+{
+	guint idx = sub->idx;
+
+	g_ptr_array_remove_index_fast(ks->subs, idx);
+	if (idx < ks->subs->len) {
+		sub = g_ptr_array_index(ks->subs, idx);
+		sub->idx = idx;
+	}
+}
+
+/* Drop subscribers which went away while we were dispatching to them */
+static void compact_channel(ChimeConnectionPrivate *priv, const gchar *channel,
+			    struct jugg_channel *ch)
+{
+	guint i, j;
+
+	ch->dirty = FALSE;
+
+	for (i = ch->klasses->len; i > 0; i--) {
+		struct jugg_klass_subs *ks = g_ptr_array_index(ch->klasses, i - 1);
+
+		/* Backwards, so whatever fills a hole has already been checked */
+		for (j = ks->subs->len; j > 0; j--) {
+			struct jugg_subscriber *sub = g_ptr_array_index(ks->subs, j - 1);
+			if (sub->removed)
+				remove_subscriber(ks, sub);
+		}
+		if (!ks->subs->len)
+			g_ptr_array_remove_index(ch->klasses, i - 1);
+	}
+
+	if (!ch->nr_subs)
+		g_hash_table_remove(priv->subscriptions, channel);
+}
+
+/* Is there anyone who actually wants to see this message? */
+static gboolean channel_wants(struct jugg_channel *ch, GQuark klass)
 {
-	struct jugg_subscription *sub = user_data;
+	guint i, j;
+
+	for (i = 0; i < ch->klasses->len; i++) {
+		struct jugg_klass_subs *ks = g_ptr_array_index(ch->klasses, i);
 
-	g_free(sub->klass);
-	g_free(sub);
+		if (ks->klass && ks->klass != klass)
+			continue;
+
+		for (j = 0; j < ks->subs->len; j++) {
+			struct jugg_subscriber *sub = g_ptr_array_index(ks->subs, j);
+			if (sub->cb && !sub->removed)
+				return TRUE;
+		}
+	}
+	return FALSE;
 }
 
 #define KEEPALIVE_INTERVAL 30
@@ -62,50 +184,357 @@ static void on_websocket_closed(SoupWebsocketConnection *ws,
 				      _("Failed to establish WebSocket connection"));
 }
 
-static void handle_callback(ChimeConnection *cxn, const gchar *msg)
+/* Minimal JSON scanning, just enough to pick the 'channel' and 'data.klass'
+ * members out of a Juggernaut message without building a tree. Anything we
+ * don't expect (including escaped strings) makes the scan fail, and the
+ * caller falls back to a full parse. */
+static const gchar *jugg_skip_ws(const gchar *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+	return p;
+}
+
+/* On entry *p is the opening quote. Returns a pointer past the closing one. */
+static const gchar *jugg_scan_string(const gchar *p, const gchar **str, gsize *len,
+				     gboolean *escaped)
+{
+	const gchar *start = ++p;
+
+	*escaped = FALSE;
+	while (*p != '"') {
+		if (!*p)
+			return NULL;
+		if (*p == '\\') {
+			*escaped = TRUE;
+			if (!*++p)
+				return NULL;
+		}
+		p++;
+	}
+	if (str) {
+		*str = start;
+		*len = p - start;
+	}
+	return p + 1;
+}
+
+static const gchar *jugg_skip_value(const gchar *p)
+{
+	gboolean escaped;
+	int depth = 0;
+
+	if (*p == '"')
+		return jugg_scan_string(p, NULL, NULL, &escaped);
+
+	if (*p != '{' && *p != '[') {
+		/* Number, true, false, null */
+		while (*p && !strchr(",}] \t\r\n", *p))
+			p++;
+		return p;
+	}
+
+	do {
+		switch (*p) {
+		case '\0':
+			return NULL;
+		case '"':
+			p = jugg_scan_string(p, NULL, NULL, &escaped);
+			if (!p)
+				return NULL;
+			continue;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			depth--;
+			break;
+		}
+		p++;
+	} while (depth);
+
+	return p;
+}
+
+/* Returns a pointer to the value of member @name of the object at @p */
+static const gchar *jugg_find_member(const gchar *p, const gchar *name)
+{
+	gsize name_len = strlen(name);
+	const gchar *key;
+	gsize key_len;
+	gboolean escaped;
+
+	p = jugg_skip_ws(p);
+	if (*p != '{')
+		return NULL;
+
+	p = jugg_skip_ws(p + 1);
+	while (*p == '"') {
+		p = jugg_scan_string(p, &key, &key_len, &escaped);
+		if (!p)
+			return NULL;
+		p = jugg_skip_ws(p);
+		if (*p != ':')
+			return NULL;
+		p = jugg_skip_ws(p + 1);
+
+		if (!escaped && key_len == name_len && !memcmp(key, name, name_len))
+			return p;
+
+		p = jugg_skip_value(p);
+		if (!p)
+			return NULL;
+		p = jugg_skip_ws(p);
+		if (*p != ',')
+			return NULL;
+		p = jugg_skip_ws(p + 1);
+	}
+	return NULL;
+}
+
+static gboolean jugg_find_string(const gchar *obj, const gchar *name,
+				 const gchar **str, gsize *len)
+{
+	const gchar *p = jugg_find_member(obj, name);
+	gboolean escaped;
+
+	if (!p || *p != '"' || !jugg_scan_string(p, str, len, &escaped))
+		return FALSE;
+
+	return !escaped;
+}
+
+/* NUL-terminate a token from the message; on the stack if it's small enough */
+#define JUGG_TOKEN_BUFLEN 128
+
+static gchar *jugg_token(gchar *buf, const gchar *str, gsize len)
+{
+	if (len >= JUGG_TOKEN_BUFLEN)
+		return g_strndup(str, len);
+
+	memcpy(buf, str, len);
+	buf[len] = 0;
+	return buf;
+}
+
+#define jugg_token_free(buf, tok) do { if ((tok) != (buf)) g_free(tok); } while (0)
+
+/* A handful of idle parsers are kept around to avoid constructing a new
+ * JsonParser for every message. */
+#define JUGG_PARSER_POOL_MAX 4
+
+static JsonParser *jugg_parser_get(ChimeConnectionPrivate *priv)
+{
+	JsonParser *parser = g_queue_pop_head(&priv->jugg_parsers);
+
+	return parser ? parser : json_parser_new();
+}
+
+static void jugg_parser_put(ChimeConnectionPrivate *priv, JsonParser *parser)
+{
+	if (g_queue_get_length(&priv->jugg_parsers) < JUGG_PARSER_POOL_MAX)
+		g_queue_push_head(&priv->jugg_parsers, parser);
+	else
+		g_object_unref(parser);
+}
+
+struct jugg_klass_stats {
+	guint64 msgs;
+	guint64 bytes;
+	guint64 parsed;		/* Messages which needed a full JSON tree */
+	gint64 parse_usec;	/* Time spent scanning and parsing */
+};
+
+static void jugg_account(ChimeConnectionPrivate *priv, const gchar *klass,
+			 gsize bytes, gboolean parsed, gint64 start)
+{
+	struct jugg_klass_stats *st;
+
+	if (!klass)
+		klass = "(unknown)";
+
+	if (!priv->jugg_stats)
+		priv->jugg_stats = g_hash_table_new_full(g_str_hash, g_str_equal,
+							 g_free, g_free);
+
+	st = g_hash_table_lookup(priv->jugg_stats, klass);
+	if (!st) {
+		st = g_new0(struct jugg_klass_stats, 1);
+		g_hash_table_insert(priv->jugg_stats, g_strdup(klass), st);
+	}
+
+	st->msgs++;
+	st->bytes += bytes;
+	if (parsed)
+		st->parsed++;
+	st->parse_usec += g_get_monotonic_time() - start;
+}
+
+static void jugg_log_stats(gpointer _klass, gpointer _st, gpointer _cxn)
+{
+	struct jugg_klass_stats *st = _st;
+
+	chime_connection_log(_cxn, CHIME_LOGLVL_MISC,
+			     "Juggernaut '%s': %" G_GUINT64_FORMAT " msgs, %" G_GUINT64_FORMAT
+			     " bytes, %" G_GUINT64_FORMAT " parsed, %" G_GINT64_FORMAT " µs\n",
+			     (gchar *)_klass, st->msgs, st->bytes, st->parsed, st->parse_usec);
+}
+
+static void jugg_log_deflate_stats(ChimeConnection *cxn, SoupWebsocketConnection *ws)
+{
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	ChimeWebsocketDeflateStats st;
+
+	if (!ws || !chime_websocket_connection_get_deflate_stats(ws, &st))
+		return;
+
+	chime_connection_log(cxn, CHIME_LOGLVL_MISC,
+			     "Juggernaut deflate: sent %" G_GUINT64_FORMAT " msgs %" G_GUINT64_FORMAT
+			     " → %" G_GUINT64_FORMAT " bytes, received %" G_GUINT64_FORMAT " msgs %"
+			     G_GUINT64_FORMAT " → %" G_GUINT64_FORMAT " bytes, %" G_GINT64_FORMAT " µs\n",
+			     st.messages_out, st.raw_out, st.wire_out,
+			     st.messages_in, st.wire_in, st.raw_in, st.usec);
+#endif
+}
+
+/* Callbacks may subscribe or unsubscribe while we're iterating, so
+ * removals are deferred and the arrays are re-indexed on each step. */
+static gboolean jugg_dispatch(ChimeConnection *cxn, const gchar *channel,
+			      struct jugg_channel *ch, GQuark klass, JsonNode *data_node)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gboolean handled = FALSE;
+	guint i, j;
+
+	ch->dispatching++;
+	for (i = 0; i < ch->klasses->len; i++) {
+		struct jugg_klass_subs *ks = g_ptr_array_index(ch->klasses, i);
+
+		if (ks->klass && ks->klass != klass)
+			continue;
+
+		for (j = 0; j < ks->subs->len; j++) {
+			struct jugg_subscriber *sub = g_ptr_array_index(ks->subs, j);
+			if (sub->cb && !sub->removed)
+				handled |= sub->cb(cxn, sub->cb_data, data_node);
+		}
+	}
+	if (!--ch->dispatching && ch->dirty)
+		compact_channel(priv, channel, ch);
+
+	return handled;
+}
+
+static void log_unhandled(ChimeConnection *cxn, const gchar *channel, JsonNode *r)
+{
+	JsonGenerator *gen = json_generator_new();
+	json_generator_set_root(gen, r);
+	json_generator_set_pretty(gen, TRUE);
+
+	gchar *data = json_generator_to_data(gen, NULL);
+	chime_connection_log(cxn, CHIME_LOGLVL_INFO, "Unhandled jugg msg on channel '%s': %s\n",
+			     channel, data);
+	g_free(data);
+	g_object_unref(gen);
+}
+
+/* For messages that the pre-scan can't cope with */
+static void handle_callback_full(ChimeConnection *cxn, const gchar *msg, gsize len,
+				 gint64 start)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	JsonParser *parser = json_parser_new();
+	JsonParser *parser = jugg_parser_get(priv);
 	gboolean handled = FALSE;
 	GError *error = NULL;
 
-	if (!json_parser_load_from_data(parser, msg, strlen(msg), &error)) {
+	if (!json_parser_load_from_data(parser, msg, len, &error)) {
 		chime_connection_log(cxn, CHIME_LOGLVL_WARNING, "Error parsing juggernaut message: '%s'\n",
 				     error->message);
 		g_error_free(error);
-		g_object_unref(parser);
+		jugg_parser_put(priv, parser);
+		jugg_account(priv, NULL, len, TRUE, start);
 		return;
 	}
 
-	const gchar *channel = NULL;
+	const gchar *channel = NULL, *klass = NULL;
 	JsonNode *r = json_parser_get_root(parser);
 	if (parse_string(r, "channel", &channel)) {
 		JsonObject *obj = json_node_get_object(r);
 		JsonNode *data_node = json_object_get_member(obj, "data");
 
-		const gchar *klass;
 		if (parse_string(data_node, "klass", &klass)) {
-			    GList *l = g_hash_table_lookup(priv->subscriptions, channel);
-			    while (l) {
-				    struct jugg_subscription *sub = l->data;
-				    if (sub->cb && (!sub->klass || !strcmp(sub->klass, klass)))
-					    handled |= sub->cb(cxn, sub->cb_data, data_node);
-				    l = l->next;
-			    }
+			struct jugg_channel *ch = g_hash_table_lookup(priv->subscriptions, channel);
+
+			jugg_account(priv, klass, len, TRUE, start);
+			if (ch)
+				handled = jugg_dispatch(cxn, channel, ch,
+							g_quark_try_string(klass), data_node);
 		}
 	}
-	if (!handled) {
-		JsonGenerator *gen = json_generator_new();
-		json_generator_set_root(gen, r);
-		json_generator_set_pretty(gen, TRUE);
+	if (!klass)
+		jugg_account(priv, NULL, len, TRUE, start);
+	if (!handled)
+		log_unhandled(cxn, channel, r);
+
+	jugg_parser_put(priv, parser);
+}
 
-		gchar *data = json_generator_to_data(gen, NULL);
+/* Pick out the channel and klass without parsing, and only build the
+ * full JSON tree if there's actually a subscriber who wants it. Only
+ * called once there are subscriptions at all. */
+void chime_jugg_handle_callback(ChimeConnection *cxn, const gchar *msg, gsize len)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gint64 start = g_get_monotonic_time();
+	gchar chan_buf[JUGG_TOKEN_BUFLEN], klass_buf[JUGG_TOKEN_BUFLEN];
+	const gchar *chan_str, *klass_str, *data;
+	gsize chan_len, klass_len;
+	gchar *channel, *klass;
+	struct jugg_channel *ch;
+	GQuark klass_q;
+
+	if (!jugg_find_string(msg, "channel", &chan_str, &chan_len) ||
+	    !(data = jugg_find_member(msg, "data")) ||
+	    !jugg_find_string(data, "klass", &klass_str, &klass_len)) {
+		handle_callback_full(cxn, msg, len, start);
+		return;
+	}
+
+	channel = jugg_token(chan_buf, chan_str, chan_len);
+	klass = jugg_token(klass_buf, klass_str, klass_len);
+
+	/* If nobody ever subscribed to this klass, it won't have a quark */
+	klass_q = g_quark_try_string(klass);
+	ch = g_hash_table_lookup(priv->subscriptions, channel);
+
+	if (!ch || !channel_wants(ch, klass_q)) {
+		jugg_account(priv, klass, len, FALSE, start);
 		chime_connection_log(cxn, CHIME_LOGLVL_INFO, "Unhandled jugg msg on channel '%s': %s\n",
-				     channel, data);
-		g_free(data);
-		g_object_unref(gen);
+				     channel, msg);
+	} else {
+		JsonParser *parser = jugg_parser_get(priv);
+		GError *error = NULL;
+
+		if (!json_parser_load_from_data(parser, msg, len, &error)) {
+			chime_connection_log(cxn, CHIME_LOGLVL_WARNING, "Error parsing juggernaut message: '%s'\n",
+					     error->message);
+			g_error_free(error);
+			jugg_account(priv, klass, len, TRUE, start);
+		} else {
+			JsonNode *r = json_parser_get_root(parser);
+			JsonNode *data_node = json_object_get_member(json_node_get_object(r), "data");
+
+			jugg_account(priv, klass, len, TRUE, start);
+			if (!jugg_dispatch(cxn, channel, ch, klass_q, data_node))
+				log_unhandled(cxn, channel, r);
+		}
+		jugg_parser_put(priv, parser);
 	}
-	g_object_unref(parser);
+
+	jugg_token_free(chan_buf, channel);
+	jugg_token_free(klass_buf, klass);
 }
 
 static void jugg_send(ChimeConnection *cxn, const gchar *fmt, ...)
@@ -128,18 +557,92 @@ static void send_subscription_message(ChimeConnection *cxn, const gchar *type, c
 	jugg_send(cxn, "3:::{\"type\":\"%s\",\"channel\":\"%s\"}", type, channel);
 }
 
+/*
+ * Subscription changes are gathered up and sent from an idle callback, so
+ * that a burst of them (e.g. for every buddy after login) is handled in one
+ * go. A subscribe and unsubscribe for the same channel cancel each other
+ * out. The server only accepts a single channel per (un)subscribe message,
+ * so what we save is the ones which cancel, and the per-message overhead.
+ */
+#define JUGG_SUB_SUBSCRIBE	GINT_TO_POINTER(1)
+#define JUGG_SUB_UNSUBSCRIBE	GINT_TO_POINTER(2)
+
+static void clear_pending_subscriptions(ChimeConnectionPrivate *priv)
+{
+	if (priv->jugg_flush_id) {
+		g_source_remove(priv->jugg_flush_id);
+		priv->jugg_flush_id = 0;
+	}
+	g_clear_pointer(&priv->jugg_pending_subs, g_hash_table_destroy);
+}
+
+static gboolean flush_subscriptions(gpointer _cxn)
+{
+	ChimeConnection *cxn = _cxn;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	GString *str = g_string_sized_new(128);
+	GHashTableIter iter;
+	gpointer channel, op;
+	guint subs = 0, unsubs = 0;
+
+	priv->jugg_flush_id = 0;
+
+	g_hash_table_iter_init(&iter, priv->jugg_pending_subs);
+	while (g_hash_table_iter_next(&iter, &channel, &op)) {
+		g_string_printf(str, "3:::{\"type\":\"%s\",\"channel\":\"%s\"}",
+				op == JUGG_SUB_SUBSCRIBE ? "subscribe" : "unsubscribe",
+				(gchar *)channel);
+		soup_websocket_connection_send_text(priv->ws_conn, str->str);
+		if (op == JUGG_SUB_SUBSCRIBE)
+			subs++;
+		else
+			unsubs++;
+	}
+	g_string_free(str, TRUE);
+
+	chime_connection_log(cxn, CHIME_LOGLVL_MISC,
+			     "Sent %u juggernaut subscribe and %u unsubscribe messages\n",
+			     subs, unsubs);
+
+	clear_pending_subscriptions(priv);
+	return FALSE;
+}
+
+static void queue_subscription(ChimeConnection *cxn, const gchar *channel, gpointer op)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gpointer pending;
+
+	/* If we're not connected, the resubscribe on connection covers it */
+	if (!priv->ws_conn)
+		return;
+
+	if (!priv->jugg_pending_subs)
+		priv->jugg_pending_subs = g_hash_table_new(g_str_hash, g_str_equal);
+
+	pending = g_hash_table_lookup(priv->jugg_pending_subs, channel);
+	if (pending && pending != op)
+		g_hash_table_remove(priv->jugg_pending_subs, channel);
+	else
+		g_hash_table_insert(priv->jugg_pending_subs,
+				    (gpointer)chime_connection_intern(cxn, channel), op);
+
+	if (!priv->jugg_flush_id)
+		priv->jugg_flush_id = g_idle_add(flush_subscriptions, cxn);
+}
+
 static void on_websocket_message(SoupWebsocketConnection *ws, gint type,
 				 GBytes *message, gpointer _cxn)
 {
 	ChimeConnection *cxn = _cxn;
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	gchar **parms;
-	gconstpointer data;
+	const gchar *data, *id, *endpoint, *payload;
+	gsize size;
 
 	if (type != SOUP_WEBSOCKET_DATA_TEXT)
 		return;
 
-	data = g_bytes_get_data(message, NULL);
+	data = g_bytes_get_data(message, &size);
 
 	chime_connection_log(cxn, CHIME_LOGLVL_MISC,
 			     "websocket message received:\n'%s'\n", (char *)data);
@@ -159,6 +662,11 @@ static void on_websocket_message(SoupWebsocketConnection *ws, gint type,
 			chime_connection_calculate_online(cxn);
 		}
 		priv->jugg_connected = TRUE;
+		if (priv->jugg_connect_start) {
+			chime_connection_timing(cxn, "Juggernaut connection",
+						g_get_monotonic_time() - priv->jugg_connect_start);
+			priv->jugg_connect_start = 0;
+		}
 		return;
 	}
 	/* Keepalive */
@@ -166,15 +674,23 @@ static void on_websocket_message(SoupWebsocketConnection *ws, gint type,
 		jugg_send(cxn, "2::");
 		return;
 	}
-	parms = g_strsplit(data, ":", 4);
-	if (parms[0] && parms[1] && *parms[1] && parms[2]) {
-		/* Send an ack */
-		jugg_send(cxn, "6:::%s", parms[1]);
+	/* socket.io framing is 'type:id:endpoint:data'. Parse it in place. */
+	id = strchr(data, ':');
+	if (!id)
+		return;
+	id++;
+	endpoint = strchr(id, ':');
+	if (!endpoint || endpoint == id)
+		return;
+
+	/* Send an ack */
+	jugg_send(cxn, "6:::%.*s", (int)(endpoint - id), id);
 
-		if (priv->subscriptions && !strcmp(parms[0], "3") && parms[3])
-			handle_callback(cxn, parms[3]);
+	payload = strchr(endpoint + 1, ':');
+	if (priv->subscriptions && payload && id - data == 2 && data[0] == '3') {
+		payload++;
+		chime_jugg_handle_callback(cxn, payload, size - (payload - data));
 	}
-	g_strfreev(parms);
 }
 
 static gboolean pong_timeout(gpointer _cxn)
@@ -209,17 +725,24 @@ static void on_websocket_pong(SoupWebsocketConnection *ws,
 	priv->keepalive_timer = g_timeout_add_seconds(KEEPALIVE_INTERVAL * 3, pong_timeout, cxn);
 }
 
-static void each_chan(gpointer _chan, gpointer _sub, gpointer _builder)
+static void each_chan(gpointer _chan, gpointer _ch, gpointer _builder)
 {
+	struct jugg_channel *ch = _ch;
 	JsonBuilder **builder = _builder;
 
-	*builder = json_builder_add_string_value(*builder, _chan);
+	if (ch->nr_subs)
+		*builder = json_builder_add_string_value(*builder, _chan);
 }
 
 static void send_resubscribe_message(ChimeConnection *cxn)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	JsonBuilder *builder = json_builder_new();
+	JsonBuilder *builder;
+
+	/* This covers anything we had queued */
+	clear_pending_subscriptions(priv);
+
+	builder = json_builder_new();
 	builder = json_builder_begin_object(builder);
 	builder = json_builder_set_member_name(builder, "type");
 	builder = json_builder_add_string_value(builder, "resubscribe");
@@ -301,7 +824,8 @@ static void ws_key_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node, gp
 	msg = soup_message_new_from_uri("GET", uri);
 	soup_uri_free(uri);
 
-	chime_connection_websocket_connect_async(cxn, msg, NULL, NULL, NULL,
+	/* It's all JSON, which compresses well. Media doesn't. */
+	chime_connection_websocket_connect_async(cxn, msg, NULL, NULL, TRUE, NULL,
 						 jugg_ws_connect_cb, cxn);
 }
 
@@ -312,10 +836,11 @@ static gboolean chime_sublist_destroy(gpointer k, gpointer v, gpointer _cxn)
 	ChimeConnection *cxn = _cxn;
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
-	if (priv->ws_conn)
+	struct jugg_channel *ch = v;
+
+	if (priv->ws_conn && ch->nr_subs)
 		send_subscription_message(_cxn, "unsubscribe", k);
 
-	g_list_free_full(v, free_jugg_subscription);
 	return TRUE;
 }
 
@@ -335,12 +860,23 @@ void chime_destroy_juggernaut(ChimeConnection *cxn)
 		priv->subscriptions = NULL;
 	}
 
+	clear_pending_subscriptions(priv);
+
+	g_queue_foreach(&priv->jugg_parsers, (GFunc)g_object_unref, NULL);
+	g_queue_clear(&priv->jugg_parsers);
+
+	if (priv->jugg_stats) {
+		g_hash_table_foreach(priv->jugg_stats, jugg_log_stats, cxn);
+		g_clear_pointer(&priv->jugg_stats, g_hash_table_destroy);
+	}
+
 	/* The ChimeConnection is going away, so disconnect the signals which
 	 * refer to it...*/
 	if (priv->ws_conn) {
 		g_signal_handlers_disconnect_matched(G_OBJECT(priv->ws_conn), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, cxn);
 
 		jugg_send(cxn, "0::");
+		jugg_log_deflate_stats(cxn, priv->ws_conn);
 
 		/* We want to let it send the clean shutdown messages and close properly, or
 		 * we aren't properly marked as offline until a later timeout. */
@@ -365,12 +901,15 @@ static void connect_jugg(ChimeConnection *cxn)
 	SoupURI *uri = soup_uri_new_printf(priv->websocket_url, "/1");
 
 	priv->jugg_connected = FALSE;
+	priv->jugg_connect_start = g_get_monotonic_time();
+	clear_pending_subscriptions(priv);
 
 	if (priv->keepalive_timer) {
 		g_source_remove(priv->keepalive_timer);
 		priv->keepalive_timer = 0;
 	}
 
+	jugg_log_deflate_stats(cxn, priv->ws_conn);
 	g_clear_object(&priv->ws_conn);
 
 	soup_uri_set_query_from_fields(uri, "session_uuid", priv->session_id, NULL);
@@ -404,76 +943,97 @@ gboolean chime_connection_jugg_send(ChimeConnection *cxn, JsonNode *node)
  * We allow multiple subscribers to a channel, as long as {cb, cb_data, klass}
  * is unique.
  *
- * priv->subscriptions is a GHashTable with 'channel' as key.
- *
- * Each value is a GList, containing the set of {cb,cb_data} subscribers.
- *
  * We send the server a subscribe request when the first subscription to a
  * channel occurs, and an unsubscribe request when the last one goes away.
  */
-static gboolean compare_sub(gconstpointer _a, gconstpointer _b)
-{
-	const struct jugg_subscription *a = _a;
-	const struct jugg_subscription *b = _b;
-
-	return !(a->cb == b->cb && a->cb_data == b->cb_data && !g_strcmp0(a->klass, b->klass));
-}
-
 void chime_jugg_subscribe(ChimeConnection *cxn, const gchar *channel, const gchar *klass,
 			  JuggernautCallback cb, gpointer cb_data)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	struct jugg_subscription *sub = g_new0(struct jugg_subscription, 1);
-	GList *l;
+	GQuark klass_q = klass ? g_quark_from_string(klass) : 0;
+	struct jugg_subscriber *sub;
+	struct jugg_klass_subs *ks;
+	struct jugg_channel *ch;
 
-	sub->cb = cb;
-	sub->cb_data = cb_data;
-	if (klass)
-		sub->klass = g_strdup(klass);
 	if (!priv->subscriptions)
 		priv->subscriptions = g_hash_table_new_full(g_str_hash, g_str_equal,
-							   g_free, NULL);
-
-	l = g_hash_table_lookup(priv->subscriptions, channel);
-	if (!l && priv->ws_conn)
-		send_subscription_message(cxn, "subscribe", channel);
+							   NULL, free_jugg_channel);
+
+	ch = g_hash_table_lookup(priv->subscriptions, channel);
+	if (!ch) {
+		ch = g_new0(struct jugg_channel, 1);
+		ch->klasses = g_ptr_array_new_with_free_func(free_jugg_klass_subs);
+		g_hash_table_insert(priv->subscriptions,
+				    (gpointer)chime_connection_intern(cxn, channel), ch);
+	}
 
-	if (g_list_find_custom(l, sub, compare_sub)) {
-		free_jugg_subscription(sub);
+	ks = find_klass_subs(ch, klass_q);
+	if (!ks) {
+		ks = g_new0(struct jugg_klass_subs, 1);
+		ks->klass = klass_q;
+		ks->subs = g_ptr_array_new_with_free_func(g_free);
+		ks->by_cb = g_hash_table_new(subscriber_hash, subscriber_equal);
+		g_ptr_array_add(ch->klasses, ks);
+	} else if (find_subscriber(ks, cb, cb_data))
 		return;
-	}
 
-	l = g_list_append(l, sub);
-	g_hash_table_replace(priv->subscriptions, g_strdup(channel), l);
+	if (!ch->nr_subs)
+		queue_subscription(cxn, channel, JUGG_SUB_SUBSCRIBE);
+
+	sub = g_new0(struct jugg_subscriber, 1);
+	sub->cb = cb;
+	sub->cb_data = cb_data;
+	sub->idx = ks->subs->len;
+	g_ptr_array_add(ks->subs, sub);
+	g_hash_table_add(ks->by_cb, sub);
+	ch->nr_subs++;
 }
 
 void chime_jugg_unsubscribe(ChimeConnection *cxn, const gchar *channel, const gchar *klass,
 			    JuggernautCallback cb, gpointer cb_data)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	struct jugg_subscription sub;
-	GList *l, *item;
+	struct jugg_subscriber *sub;
+	struct jugg_klass_subs *ks;
+	struct jugg_channel *ch;
+	GQuark klass_q = 0;
 
 	if (!priv->subscriptions)
 		return;
 
-	l = g_hash_table_lookup(priv->subscriptions, channel);
-	if (!l)
+	ch = g_hash_table_lookup(priv->subscriptions, channel);
+	if (!ch)
+		return;
+
+	if (klass) {
+		klass_q = g_quark_try_string(klass);
+		if (!klass_q)
+			return;
+	}
+
+	ks = find_klass_subs(ch, klass_q);
+	if (!ks)
+		return;
+
+	sub = find_subscriber(ks, cb, cb_data);
+	if (!sub)
 		return;
 
-	sub.cb = cb;
-	sub.cb_data = cb_data;
-	sub.klass = (gchar *)klass;
-
-	item = g_list_find_custom(l, &sub, compare_sub);
-	if (item) {
-		free_jugg_subscription(item->data);
-		l = g_list_delete_link(l, item);
-		if (!l) {
-			g_hash_table_remove(priv->subscriptions, channel);
-			if (priv->ws_conn)
-				send_subscription_message(cxn, "unsubscribe", channel);
-		} else
-			g_hash_table_replace(priv->subscriptions, g_strdup(channel), l);
+	if (!--ch->nr_subs)
+		queue_subscription(cxn, channel, JUGG_SUB_UNSUBSCRIBE);
+
+	/* Out of the hash now, so that it can be subscribed again at once */
+	g_hash_table_remove(ks->by_cb, sub);
+
+	if (ch->dispatching) {
+		sub->removed = TRUE;
+		ch->dirty = TRUE;
+		return;
 	}
+
+	remove_subscriber(ks, sub);
+	if (!ks->subs->len)
+		g_ptr_array_remove_fast(ch->klasses, ks);
+	if (!ch->nr_subs)
+		g_hash_table_remove(priv->subscriptions, channel);
 }
@@ -448,8 +448,8 @@ static void fetch_meetings(ChimeConnection *cxn, const gchar *next_token)
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	SoupURI *uri = soup_uri_new_printf(priv->conference_url, "/joinable_meetings");
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", meetings_cb,
-					    NULL);
+	chime_connection_queue_http_request_class(cxn, NULL, uri, "GET", CHIME_REQ_SYNC,
+						  meetings_cb, NULL);
 }
 
 static gboolean meeting_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *data_node)
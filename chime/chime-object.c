@@ -25,10 +25,15 @@
 typedef struct {
 	GObject parent_instance;
 
-	gchar *id;
-	gchar *name;
+	/* While the object is hashed into a collection, these are interned
+	 * in the connection and are not ours to free. The connection drops
+	 * its interned strings on disconnect, so we take copies back when
+	 * we're unhashed. */
+	const gchar *id;
+	const gchar *name;
+	gboolean interned;
 
-	gint64 generation;
+	guint slot;		/* Index in collection->slots */
 
 	/* While the obiect is live and discoverable, we hold a refcount to it
 	 * But once it's dead, it remains in the hash table to avoid duplicates
@@ -51,6 +56,21 @@ enum
 
 static GParamSpec *props[LAST_PROP];
 
+/*
+ * As well as the by_id and by_name indexes, a collection keeps its
+ * objects packed in an array along with the state that a sweep needs,
+ * so expiring and iterating never have to allocate, or chase pointers
+ * into every object. Each object knows its own slot; removing one moves
+ * the last slot into the hole to keep the array dense.
+ */
+struct chime_object_slot {
+	ChimeObject *object;
+	gint64 generation;
+	gboolean is_dead;
+};
+
+#define COLL_SLOT(coll, i) (&g_array_index((coll)->slots, struct chime_object_slot, (i)))
+
 G_DEFINE_TYPE_WITH_PRIVATE(ChimeObject, chime_object, G_TYPE_OBJECT)
 
 enum {
@@ -60,6 +80,27 @@ enum {
 
 static guint signals[LAST_SIGNAL];
 
+static void set_dead(ChimeObjectPrivate *priv, gboolean dead)
+{
+	priv->is_dead = dead;
+	if (priv->collection)
+		COLL_SLOT(priv->collection, priv->slot)->is_dead = dead;
+}
+
+static void remove_slot(ChimeObjectCollection *coll, ChimeObjectPrivate *priv)
+{
+	guint last = coll->slots->len - 1;
+
+	if (priv->slot != last) {
+		ChimeObjectPrivate *moved;
+
+		*COLL_SLOT(coll, priv->slot) = *COLL_SLOT(coll, last);
+		moved = chime_object_get_instance_private(COLL_SLOT(coll, priv->slot)->object);
+		moved->slot = priv->slot;
+	}
+	g_array_set_size(coll->slots, last);
+}
+
 static void
 chime_object_dispose(GObject *object)
 {
@@ -69,15 +110,13 @@ chime_object_dispose(GObject *object)
 	priv = chime_object_get_instance_private (self);
 
 	if (priv->collection) {
+		remove_slot(priv->collection, priv);
 		g_hash_table_remove(priv->collection->by_name, priv->name);
 		g_hash_table_remove(priv->collection->by_id, priv->id);
 	}
 
 	chime_debug("Object disposed: %p\n", self);
 
-	if (priv->cxn)
-		g_clear_object(&priv->cxn);
-
 	g_signal_emit(object, signals[DISPOSED], 0);
 
 	G_OBJECT_CLASS(chime_object_parent_class)->dispose(object);
@@ -91,8 +130,13 @@ chime_object_finalize(GObject *object)
 
 	priv = chime_object_get_instance_private (self);
 
-	g_free(priv->id);
-	g_free(priv->name);
+	if (!priv->interned) {
+		g_free((gchar *)priv->id);
+		g_free((gchar *)priv->name);
+	}
+
+	/* Only now, since the interned strings belong to the connection */
+	g_clear_object(&priv->cxn);
 
 	G_OBJECT_CLASS(chime_object_parent_class)->finalize(object);
 }
@@ -131,14 +175,14 @@ static void chime_object_set_property(GObject *object, guint prop_id,
 
 	switch (prop_id) {
 	case PROP_ID:
-		g_free(priv->id);
+		g_free((gchar *)priv->id);
 		priv->id = g_value_dup_string(value);
 		break;
 	case PROP_NAME:
 		chime_object_rename(self, g_value_get_string(value));
 		break;
 	case PROP_DEAD:
-		priv->is_dead = g_value_get_boolean(value);
+		set_dead(priv, g_value_get_boolean(value));
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
@@ -160,11 +204,15 @@ void chime_object_rename(ChimeObject *self, const gchar *name)
 			g_hash_table_remove(priv->collection->by_name, priv->name);
 	}
 
-	g_free(priv->name);
-	priv->name = g_strdup(name);
+	if (priv->interned)
+		priv->name = chime_connection_intern(priv->cxn, name);
+	else {
+		g_free((gchar *)priv->name);
+		priv->name = g_strdup(name);
+	}
 
 	if (priv->collection)
-		g_hash_table_insert(priv->collection->by_name, priv->name, self);
+		g_hash_table_insert(priv->collection->by_name, (gpointer)priv->name, self);
 }
 
 static void chime_object_class_init(ChimeObjectClass *klass)
@@ -266,43 +314,67 @@ void chime_object_collection_hash_object(ChimeObjectCollection *collection, Chim
 
 	priv = chime_object_get_instance_private (object);
 
-	priv->generation = collection->generation;
-
 	if (!priv->cxn)
 		priv->cxn = g_object_ref(collection->cxn);
 
+	if (!priv->interned) {
+		gchar *id = (gchar *)priv->id, *name = (gchar *)priv->name;
+
+		priv->id = chime_connection_intern(priv->cxn, id);
+		priv->name = chime_connection_intern(priv->cxn, name);
+		priv->interned = TRUE;
+		g_free(id);
+		g_free(name);
+	}
+
 	if (!priv->collection) {
+		struct chime_object_slot slot = { object, 0, priv->is_dead };
+
 		priv->collection = collection;
-		g_hash_table_insert(collection->by_id, priv->id, object);
-		g_hash_table_insert(collection->by_name, priv->name, object);
+		priv->slot = collection->slots->len;
+		g_array_append_val(collection->slots, slot);
+		g_hash_table_insert(collection->by_id, (gpointer)priv->id, object);
+		g_hash_table_insert(collection->by_name, (gpointer)priv->name, object);
 	}
 
+	COLL_SLOT(collection, priv->slot)->generation = collection->generation;
+
 	if (live && priv->is_dead) {
 		g_object_ref(object);
-		priv->is_dead = FALSE;
+		set_dead(priv, FALSE);
 		g_object_notify(G_OBJECT(object), "dead");
 	} else if (!live && !priv->is_dead) {
-		priv->is_dead = TRUE;
+		set_dead(priv, TRUE);
 		g_object_notify(G_OBJECT(object), "dead");
 		g_object_unref(object);
 	}
 }
 
+/*
+ * Dropping our reference may dispose an object and remove its slot, and
+ * a "dead" handler may drop others. Walking backwards means whatever gets
+ * moved into a hole has already been visited; we just have to cope with
+ * the array getting shorter under us.
+ */
 void chime_object_collection_expire_outdated(ChimeObjectCollection *coll)
 {
-	GList *objects = g_hash_table_get_values(coll->by_id);
-	while (objects) {
-		ChimeObject *object = CHIME_OBJECT(objects->data);
-		ChimeObjectPrivate *priv;
-
-		priv = chime_object_get_instance_private (object);
-
-		if (!priv->is_dead && priv->generation != coll->generation) {
-			priv->is_dead = TRUE;
-			g_object_notify(G_OBJECT(object), "dead");
-			g_object_unref(object);
-		}
-		objects = g_list_remove(objects, object);
+	guint i = coll->slots->len;
+
+	while (i--) {
+		struct chime_object_slot *slot;
+		ChimeObject *object;
+
+		if (i >= coll->slots->len)
+			continue;
+
+		slot = COLL_SLOT(coll, i);
+		if (slot->is_dead || slot->generation == coll->generation)
+			continue;
+
+		object = slot->object;
+		set_dead(chime_object_get_instance_private (object), TRUE);
+		g_object_notify(G_OBJECT(object), "dead");
+		g_object_unref(object);
 	}
 }
 
@@ -316,8 +388,14 @@ static void unhash_object(gpointer _object)
 	/* Now it's unhashed, it doesn't need to unhash itself on dispose() */
 	priv->collection = NULL;
 
+	if (priv->interned) {
+		priv->id = g_strdup(priv->id);
+		priv->name = g_strdup(priv->name);
+		priv->interned = FALSE;
+	}
+
 	if (!priv->is_dead) {
-		priv->is_dead = TRUE;
+		set_dead(priv, TRUE);
 		g_object_unref(object);
 	}
 }
@@ -327,6 +405,7 @@ void chime_object_collection_init(ChimeConnection *cxn, ChimeObjectCollection *c
 	coll->by_id = g_hash_table_new_full(g_str_hash, g_str_equal,
 						    NULL, unhash_object);
 	coll->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+	coll->slots = g_array_new(FALSE, FALSE, sizeof(struct chime_object_slot));
 	coll->generation = 0;
 	coll->cxn = cxn;
 }
@@ -334,36 +413,33 @@ void chime_object_collection_init(ChimeConnection *cxn, ChimeObjectCollection *c
 void chime_object_collection_destroy(ChimeObjectCollection *coll)
 {
 	g_clear_pointer(&coll->by_name, g_hash_table_unref);
+	/* Unhashing clears each object's ->collection, so nothing
+	 * touches the slots after this */
 	g_clear_pointer(&coll->by_id, g_hash_table_unref);
+	if (coll->slots) {
+		g_array_free(coll->slots, TRUE);
+		coll->slots = NULL;
+	}
 }
 
-struct foreach_object_st {
-	ChimeConnection *cxn;
-	ChimeObjectCB cb;
-	gpointer cbdata;
-};
-
-static void foreach_object_cb(gpointer key, gpointer value, gpointer _data)
+/* Backwards, for the same reasons as chime_object_collection_expire_outdated() */
+void chime_object_collection_foreach_object(ChimeConnection *cxn, ChimeObjectCollection *coll,
+					    ChimeObjectCB cb, gpointer cbdata)
 {
-	struct foreach_object_st *data = _data;
-	ChimeObject *object = CHIME_OBJECT(value);
-	ChimeObjectPrivate *priv;
+	guint i;
 
-	priv = chime_object_get_instance_private (object);
+	if (!coll->slots)
+		return;
 
-	if (!priv->is_dead)
-		data->cb(data->cxn, object, data->cbdata);
-}
+	i = coll->slots->len;
+	while (i--) {
+		struct chime_object_slot *slot;
 
-void chime_object_collection_foreach_object(ChimeConnection *cxn, ChimeObjectCollection *coll,
-					    ChimeObjectCB cb, gpointer cbdata)
-{
-	struct foreach_object_st data = {
-		.cxn = cxn,
-		.cb = cb,
-		.cbdata = cbdata,
-	};
-
-	if (coll->by_id)
-		g_hash_table_foreach(coll->by_id, foreach_object_cb, &data);
+		if (i >= coll->slots->len)
+			continue;
+
+		slot = COLL_SLOT(coll, i);
+		if (!slot->is_dead)
+			cb(cxn, slot->object, cbdata);
+	}
 }
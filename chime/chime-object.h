@@ -32,6 +32,7 @@ G_DECLARE_DERIVABLE_TYPE (ChimeObject, chime_object, CHIME, OBJECT, GObject)
 typedef struct {
 	GHashTable *by_id;
 	GHashTable *by_name;
+	GArray *slots;		/* Every hashed object, densely packed */
 	gint64 generation;
 	ChimeConnection *cxn;
 } ChimeObjectCollection;
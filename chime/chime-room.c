@@ -26,7 +26,9 @@
 	x(is_open, OPEN, "Open", "open", "open", TRUE)
 
 #define STRING_PROPS(x)				\
-	x(channel, CHANNEL, "Channel", "channel", "channel", TRUE) \
+	x(channel, CHANNEL, "Channel", "channel", "channel", TRUE)
+
+#define TIME_PROPS(x)				\
 	x(created_on, CREATED_ON, "CreatedOn", "created-on", "created on", TRUE) \
 	x(updated_on, UPDATED_ON, "UpdatedOn", "updated-on", "updated on", TRUE) \
 	x(last_sent, LAST_SENT, "LastSent", "last-sent", "last sent", FALSE) \
@@ -326,32 +328,47 @@ const gchar *chime_room_get_created_on(ChimeRoom *self)
 	return self->created_on;
 }
 
-static gboolean cmp_time(const char *ev, const char *last_read)
+gint64 chime_room_get_last_mentioned_time(ChimeRoom *self)
 {
-	GTimeVal ev_time, read_time;
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
 
-	if (!ev || !g_time_val_from_iso8601(ev, &ev_time))
-		return FALSE;
+	return self->last_mentioned_time;
+}
 
-	if (!last_read || !g_time_val_from_iso8601(last_read, &read_time))
-		return TRUE;
+gint64 chime_room_get_last_read_time(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
 
-	return (ev_time.tv_sec > read_time.tv_sec ||
-		(ev_time.tv_sec == read_time.tv_sec && ev_time.tv_usec > read_time.tv_usec));
+	return self->last_read_time;
 }
 
+gint64 chime_room_get_last_sent_time(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
+
+	return self->last_sent_time;
+}
+
+gint64 chime_room_get_created_on_time(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
+
+	return self->created_on_time;
+}
+
+/* A missing (or unparseable) timestamp is zero */
 gboolean chime_room_has_mention(ChimeRoom *self)
 {
 	g_return_val_if_fail(CHIME_IS_ROOM(self), FALSE);
 
-	return cmp_time(self->last_mentioned, self->last_read);
+	return self->last_mentioned_time > self->last_read_time;
 }
 
 gboolean chime_room_has_unread(ChimeRoom *self)
 {
 	g_return_val_if_fail(CHIME_IS_ROOM(self), FALSE);
 
-	return cmp_time(self->last_sent, self->last_read);
+	return self->last_sent_time > self->last_read_time;
 }
 
 
@@ -478,18 +495,46 @@ static ChimeRoom *chime_connection_parse_room(ChimeConnection *cxn, JsonNode *no
 	return room;
 }
 
-static void fetch_rooms(ChimeConnection *cxn, const gchar *next_token);
+/* Enough of a server record for chime_connection_parse_room() to recreate it */
+JsonNode *chime_room_get_snapshot(ChimeRoom *room)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(room), NULL);
 
-static void rooms_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
-			gpointer _unused)
+	JsonBuilder *jb = json_builder_new();
+	jb = json_builder_begin_object(jb);
+	jb = json_builder_set_member_name(jb, "RoomId");
+	jb = json_builder_add_string_value(jb, chime_object_get_id(CHIME_OBJECT(room)));
+	jb = json_builder_set_member_name(jb, "Name");
+	jb = json_builder_add_string_value(jb, chime_object_get_name(CHIME_OBJECT(room)));
+	jb = json_builder_set_member_name(jb, "Privacy");
+	jb = json_builder_add_string_value(jb, room->privacy ? "private" : "public");
+	jb = json_builder_set_member_name(jb, "Type");
+	jb = json_builder_add_string_value(jb, enum_value_nick(CHIME_TYPE_ROOM_TYPE, room->type));
+	jb = json_builder_set_member_name(jb, "Visibility");
+	jb = json_builder_add_string_value(jb, room->visibility ? "visible" : "hidden");
+
+	CHIME_PROPS_SNAPSHOT
+
+	build_notify_prefs(jb, room->desktop_notification, room->mobile_notification);
+	jb = json_builder_end_object(jb);
+
+	JsonNode *node = json_builder_get_root(jb);
+	g_object_unref(jb);
+	return node;
+}
+
+static void fetch_rooms(ChimeConnection *cxn);
+
+static gboolean rooms_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
+			gboolean more, gpointer _unused)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	/* If it got invalidated while in transit, refetch */
 	if (priv->rooms_sync != CHIME_SYNC_FETCHING) {
 		priv->rooms_sync = CHIME_SYNC_IDLE;
-		fetch_rooms(cxn, NULL);
-		return;
+		fetch_rooms(cxn);
+		return FALSE;
 	}
 
 	if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && node) {
@@ -498,21 +543,9 @@ static void rooms_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
 		if (!rooms_node) {
 			chime_connection_fail(cxn, CHIME_ERROR_BAD_RESPONSE,
 					      _("Failed to find Rooms node in response"));
-			return;
-		}
-		JsonArray *arr = json_node_get_array(rooms_node);
-		guint i, len = json_array_get_length(arr);
-
-		for (i = 0; i < len; i++) {
-			chime_connection_parse_room(cxn,
-						    json_array_get_element(arr, i),
-						    NULL);
+			return FALSE;
 		}
-
-		const gchar *next_token;
-		if (parse_string(node, "NextToken", &next_token))
-			fetch_rooms(cxn, next_token);
-		else {
+		if (!more) {
 			priv->rooms_sync = CHIME_SYNC_IDLE;
 
 			chime_object_collection_expire_outdated(&priv->rooms);
@@ -531,39 +564,46 @@ static void rooms_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
 				      _("Failed to fetch rooms (%d): %s\n"),
 				      msg->status_code, reason);
 	}
+	return TRUE;
 }
 
-static void fetch_rooms(ChimeConnection *cxn, const gchar *next_token)
+static void room_elem_cb(ChimeConnection *cxn, JsonNode *node, gpointer _unused)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
-	if (!next_token) {
-		/* Actually we could listen for the 'starting' flag on the message,
-		 * and as long as *that* hasn't happened yet we don't need to refetch
-		 * as it'll get up-to-date information. */
-		switch(priv->rooms_sync) {
-		case CHIME_SYNC_FETCHING:
-			priv->rooms_sync = CHIME_SYNC_STALE;
-		case CHIME_SYNC_STALE:
-			return;
-
-		case CHIME_SYNC_IDLE:
-			priv->rooms.generation++;
-			priv->rooms_sync = CHIME_SYNC_FETCHING;
-		}
+	/* Stale; rooms_cb() will refetch, so don't bother parsing it */
+	if (priv->rooms_sync != CHIME_SYNC_FETCHING)
+		return;
+
+	chime_connection_parse_room(cxn, node, NULL);
+}
+
+static void fetch_rooms(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	/* Actually we could listen for the 'starting' flag on the message,
+	 * and as long as *that* hasn't happened yet we don't need to refetch
+	 * as it'll get up-to-date information. */
+	switch(priv->rooms_sync) {
+	case CHIME_SYNC_FETCHING:
+		priv->rooms_sync = CHIME_SYNC_STALE;
+	case CHIME_SYNC_STALE:
+		return;
+
+	case CHIME_SYNC_IDLE:
+		priv->rooms.generation++;
+		priv->rooms_sync = CHIME_SYNC_FETCHING;
 	}
 
 	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/rooms");
-	soup_uri_set_query_from_fields(uri, "max-results", "50",
-				       next_token ? "next-token" : NULL, next_token,
-				       NULL);
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", rooms_cb,
-					    NULL);
+	chime_connection_fetch_pages(cxn, "Rooms", uri, CHIME_REQ_SYNC, "Rooms",
+				     room_elem_cb, rooms_cb, NULL);
 }
 
 static gboolean visible_rooms_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *data_node)
 {
-	fetch_rooms(cxn, NULL);
+	fetch_rooms(cxn);
 	return TRUE;
 }
 
@@ -653,12 +693,21 @@ static gboolean room_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *d
 	return TRUE;
 }
 
+static gboolean load_snapshot_room(ChimeConnection *cxn, JsonNode *node)
+{
+	return !!chime_connection_parse_room(cxn, node, NULL);
+}
+
 void chime_init_rooms(ChimeConnection *cxn)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	chime_object_collection_init(cxn, &priv->rooms);
 
+	/* If we have them cached, don't wait for the fetch to complete */
+	if (chime_snapshot_load(cxn, CHIME_SNAPSHOT_ROOMS, load_snapshot_room))
+		priv->rooms_online = TRUE;
+
 	chime_jugg_subscribe(cxn, priv->profile_channel, "VisibleRooms",
 			     visible_rooms_jugg_cb, NULL);
 	if (0) chime_jugg_subscribe(cxn, priv->device_channel, "JoinableMeetings",
@@ -667,7 +716,7 @@ void chime_init_rooms(ChimeConnection *cxn)
 			     room_jugg_cb, NULL);
 	chime_jugg_subscribe(cxn, priv->device_channel, "RoomMessage",
 			     demux_room_msg_jugg_cb, NULL);
-	fetch_rooms(cxn, NULL);
+	fetch_rooms(cxn);
 }
 
 void chime_destroy_rooms(ChimeConnection *cxn)
@@ -756,11 +805,15 @@ static gboolean add_room_member(ChimeConnection *cxn, ChimeRoom *room, JsonNode
 	    g_strcmp0(last_read, member->last_read)) {
 		    g_free(member->last_read);
 		    member->last_read = g_strdup(last_read);
+		    if (!chime_parse_iso8601(last_read, &member->last_read_time))
+			    member->last_read_time = 0;
 	}
 	if (parse_string(member_node, "LastDelivered", &last_delivered) &&
 	    g_strcmp0(last_delivered, member->last_delivered)) {
 		    g_free(member->last_delivered);
 		    member->last_delivered = g_strdup(last_delivered);
+		    if (!chime_parse_iso8601(last_delivered, &member->last_delivered_time))
+			    member->last_delivered_time = 0;
 	}
 	member->admin = parse_string(node, "Role", &role) && !strcmp(role, "administrator");
 	member->present = parse_string(node, "Presence", &presence) && !strcmp(presence, "present");
@@ -782,7 +835,7 @@ static gboolean room_membership_jugg_cb(ChimeConnection *cxn, gpointer _room, Js
 }
 
 
-void fetch_room_memberships(ChimeConnection *cxn, ChimeRoom *room, gboolean active, const gchar *next_token);
+void fetch_room_memberships(ChimeConnection *cxn, ChimeRoom *room, gboolean active);
 gboolean chime_connection_open_room(ChimeConnection *cxn, ChimeRoom *room)
 {
 	g_return_val_if_fail(CHIME_IS_CONNECTION(cxn), FALSE);
@@ -794,8 +847,8 @@ gboolean chime_connection_open_room(ChimeConnection *cxn, ChimeRoom *room)
 		chime_jugg_subscribe(cxn, room->channel, "Room", room_jugg_cb, NULL);
 		chime_jugg_subscribe(cxn, room->channel, "RoomMessage", room_msg_jugg_cb, room);
 		chime_jugg_subscribe(cxn, room->channel, "RoomMembership", room_membership_jugg_cb, room);
-		fetch_room_memberships(cxn, room, TRUE, NULL);
-		fetch_room_memberships(cxn, room, FALSE, NULL);
+		fetch_room_memberships(cxn, room, TRUE);
+		fetch_room_memberships(cxn, room, FALSE);
 	}
 
 	return room->members_done[0] && room->members_done[1];
@@ -828,11 +881,11 @@ void chime_connection_close_room(ChimeConnection *cxn, ChimeRoom *room)
 }
 
 
-static void fetch_members_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node, gpointer _roomx)
+static gboolean fetch_members_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
+				 gboolean more, gpointer _roomx)
 {
 	ChimeRoom *room = CHIME_ROOM((void *)((unsigned long)_roomx & ~1UL));
 	gboolean active = (unsigned long) _roomx & 1;
-	const gchar *next_token;
 
 	if (!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
 		const gchar *reason = msg->reason_phrase;
@@ -841,47 +894,34 @@ static void fetch_members_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *n
 			parse_string(node, "error", &reason);
 
 		g_warning("Failed to fetch room memberships: %d %s\n", msg->status_code, reason);
- 	} else {
-		JsonObject *obj = json_node_get_object(node);
-		JsonNode *members_node = json_object_get_member(obj, "RoomMemberships");
-		JsonArray *members_array = json_node_get_array(members_node);
-
-		int i, len = json_array_get_length(members_array);
-		for (i = 0; i < len; i++) {
-			JsonNode *member_node = json_array_get_element(members_array, i);
-			add_room_member(cxn, room, member_node);
-		}
+	} else if (more)
+		return TRUE;
 
-		if (parse_string(node, "NextToken", &next_token)) {
-			fetch_room_memberships(cxn, room, active, next_token);
-			return;
-		}
-	}
 	room->members_done[active] = TRUE;
 	if (room->members_done[!active])
 		g_signal_emit(room, signals[MEMBERS_DONE], 0);
+	return TRUE;
+}
+
+static void member_elem_cb(ChimeConnection *cxn, JsonNode *node, gpointer _roomx)
+{
+	ChimeRoom *room = CHIME_ROOM((void *)((unsigned long)_roomx & ~1UL));
+
+	add_room_member(cxn, room, node);
 }
 
-void fetch_room_memberships(ChimeConnection *cxn, ChimeRoom *room, gboolean active, const gchar *next_token)
+void fetch_room_memberships(ChimeConnection *cxn, ChimeRoom *room, gboolean active)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/rooms/%s/memberships",
 					   chime_object_get_id(CHIME_OBJECT(room)));
-	const gchar *opts[4] = {NULL};
-	int i = 0;
-
-	if (!active) {
-		opts[i++] = "status";
-		opts[i++] = "inActive";
-	}
-	if (next_token) {
-		opts[i++] = "next-token";
-		opts[i++] = next_token;
-	}
+	if (!active)
+		soup_uri_set_query_from_fields(uri, "status", "inActive", NULL);
 
-	soup_uri_set_query_from_fields(uri, "max-results", "50", opts[0], opts[1], opts[2], opts[3], NULL);
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", fetch_members_cb, (void *)((unsigned long)room | active));
+	chime_connection_fetch_pages(cxn, active ? "Room memberships" : "Inactive room memberships",
+				     uri, CHIME_REQ_SYNC, "RoomMemberships", member_elem_cb,
+				     fetch_members_cb, (void *)((unsigned long)room | active));
 }
 
 GList *chime_room_get_members(ChimeRoom *room)
@@ -54,6 +54,12 @@ const gchar *chime_room_get_last_read(ChimeRoom *self);
 const gchar *chime_room_get_last_sent(ChimeRoom *self);
 const gchar *chime_room_get_created_on(ChimeRoom *self);
 
+/* The same, in microseconds since the epoch. Zero if unset. */
+gint64 chime_room_get_last_mentioned_time(ChimeRoom *self);
+gint64 chime_room_get_last_read_time(ChimeRoom *self);
+gint64 chime_room_get_last_sent_time(ChimeRoom *self);
+gint64 chime_room_get_created_on_time(ChimeRoom *self);
+
 gboolean chime_room_has_mention(ChimeRoom *self);
 gboolean chime_room_has_unread(ChimeRoom *self);
 
@@ -74,6 +80,8 @@ typedef struct {
 	gboolean active;
 	char *last_read;
 	char *last_delivered;
+	gint64 last_read_time;
+	gint64 last_delivered_time;
 } ChimeRoomMember;
 
 gboolean chime_connection_open_room(ChimeConnection *cxn, ChimeRoom *room);
@@ -0,0 +1,262 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2017 Amazon.com, Inc. or its affiliates.
+ *
+ * Author: David Woodhouse <dwmw2@infradead.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#include "chime-connection-private.h"
+
+/*
+ * On-disk snapshot of the contacts, rooms and conversations collections,
+ * so that we can populate them at startup without waiting to page through
+ * the whole lot from the server. The network fetch still happens, and its
+ * generation bump and chime_object_collection_expire_outdated() take care
+ * of anything in the snapshot which has since gone away.
+ *
+ * Each object is written as a JSON record in the form the server uses,
+ * built from its properties at save time rather than kept around all
+ * session, and fed back through the normal parsing functions on load. The file
+ * is a fixed header with a table of sections, followed by length-prefixed
+ * records. All integers are little-endian.
+ *
+ * Contacts' last known presence goes in a section of its own, so that the
+ * buddy list isn't all 'offline' while we wait for the presence fetch.
+ */
+#define SNAPSHOT_MAGIC		"ChimeSnp"
+#define SNAPSHOT_VERSION	2
+
+struct snapshot_hdr {
+	gchar magic[8];
+	guint32 version;
+	guint32 nr_sections;
+	struct {
+		guint32 offset;
+		guint32 count;
+	} sections[CHIME_SNAPSHOT_NR];
+};
+
+static gchar *snapshot_path(ChimeConnectionPrivate *priv)
+{
+	gchar *fname = g_strdup_printf("snapshot-%s", priv->profile_id);
+	gchar *path = g_build_filename(priv->cache_dir, fname, NULL);
+
+	g_free(fname);
+	return path;
+}
+
+void chime_snapshot_open(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	const struct snapshot_hdr *hdr;
+	GError *error = NULL;
+	gchar *path;
+
+	if (!priv->cache_dir || !priv->profile_id)
+		return;
+
+	chime_snapshot_close(cxn);
+
+	path = snapshot_path(priv);
+	priv->snapshot = g_mapped_file_new(path, FALSE, &error);
+	if (!priv->snapshot) {
+		chime_connection_log(cxn, CHIME_LOGLVL_MISC, "No snapshot loaded: %s\n",
+				     error->message);
+		g_error_free(error);
+		g_free(path);
+		return;
+	}
+
+	hdr = (void *)g_mapped_file_get_contents(priv->snapshot);
+	if (g_mapped_file_get_length(priv->snapshot) < sizeof(*hdr) ||
+	    memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) ||
+	    GUINT32_FROM_LE(hdr->version) != SNAPSHOT_VERSION ||
+	    GUINT32_FROM_LE(hdr->nr_sections) != CHIME_SNAPSHOT_NR) {
+		chime_connection_log(cxn, CHIME_LOGLVL_WARNING, "Ignoring invalid snapshot %s\n",
+				     path);
+		chime_snapshot_close(cxn);
+	}
+	g_free(path);
+}
+
+void chime_snapshot_close(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	g_clear_pointer(&priv->snapshot, g_mapped_file_unref);
+}
+
+/* Returns the number of objects successfully loaded */
+guint chime_snapshot_load(ChimeConnection *cxn, ChimeSnapshotSection section,
+			  ChimeSnapshotParseCB cb)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	const struct snapshot_hdr *hdr;
+	const gchar *data;
+	JsonParser *parser;
+	guint32 off, count, i;
+	guint loaded = 0;
+	gsize len;
+
+	if (!priv->snapshot)
+		return 0;
+
+	data = g_mapped_file_get_contents(priv->snapshot);
+	len = g_mapped_file_get_length(priv->snapshot);
+	hdr = (void *)data;
+
+	off = GUINT32_FROM_LE(hdr->sections[section].offset);
+	count = GUINT32_FROM_LE(hdr->sections[section].count);
+
+	parser = json_parser_new();
+	for (i = 0; i < count; i++) {
+		guint32 rec_len;
+
+		if (off > len || len - off < sizeof(rec_len))
+			break;
+		memcpy(&rec_len, data + off, sizeof(rec_len));
+		rec_len = GUINT32_FROM_LE(rec_len);
+		off += sizeof(rec_len);
+		if (rec_len > len - off)
+			break;
+
+		if (json_parser_load_from_data(parser, data + off, rec_len, NULL) &&
+		    cb(cxn, json_parser_get_root(parser)))
+			loaded++;
+
+		off += rec_len;
+	}
+	g_object_unref(parser);
+
+	if (i < count)
+		chime_connection_log(cxn, CHIME_LOGLVL_WARNING,
+				     "Snapshot section %d truncated\n", section);
+
+	chime_connection_log(cxn, CHIME_LOGLVL_MISC, "Loaded %u/%u objects from snapshot section %d\n",
+			     loaded, count, section);
+	return loaded;
+}
+
+/* Returns a new reference, or NULL if there's nothing to save */
+typedef JsonNode *(*ChimeSnapshotRecordCB)(ChimeObject *obj);
+
+struct save_st {
+	GString *buf;
+	JsonGenerator *gen;
+	ChimeSnapshotRecordCB get_record;
+	guint32 count;
+};
+
+static JsonNode *contact_record(ChimeObject *obj)
+{
+	return chime_contact_get_snapshot(CHIME_CONTACT(obj));
+}
+
+static JsonNode *room_record(ChimeObject *obj)
+{
+	return chime_room_get_snapshot(CHIME_ROOM(obj));
+}
+
+static JsonNode *conversation_record(ChimeObject *obj)
+{
+	return chime_conversation_get_snapshot(CHIME_CONVERSATION(obj));
+}
+
+static JsonNode *presence_record(ChimeObject *obj)
+{
+	return chime_contact_get_presence_snapshot(CHIME_CONTACT(obj));
+}
+
+static void save_object(ChimeConnection *cxn, ChimeObject *obj, gpointer _st)
+{
+	struct save_st *st = _st;
+	JsonNode *node = st->get_record(obj);
+	guint32 rec_len;
+	gchar *rec;
+	gsize len;
+
+	if (!node)
+		return;
+
+	json_generator_set_root(st->gen, node);
+	rec = json_generator_to_data(st->gen, &len);
+	rec_len = GUINT32_TO_LE(len);
+	g_string_append_len(st->buf, (gchar *)&rec_len, sizeof(rec_len));
+	g_string_append_len(st->buf, rec, len);
+	g_free(rec);
+	json_node_unref(node);
+	st->count++;
+}
+
+static void save_collection(ChimeConnection *cxn, GString *buf, struct snapshot_hdr *hdr,
+			    ChimeSnapshotSection section, ChimeObjectCollection *coll,
+			    ChimeSnapshotRecordCB get_record)
+{
+	struct save_st st = { buf, json_generator_new(), get_record, 0 };
+
+	hdr->sections[section].offset = GUINT32_TO_LE(buf->len);
+
+	/* Only live objects */
+	chime_object_collection_foreach_object(cxn, coll, save_object, &st);
+
+	hdr->sections[section].count = GUINT32_TO_LE(st.count);
+	g_object_unref(st.gen);
+}
+
+void chime_snapshot_save(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	struct snapshot_hdr hdr;
+	GError *error = NULL;
+	GString *buf;
+	gchar *path;
+
+	if (!priv->cache_dir || !priv->profile_id)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.version = GUINT32_TO_LE(SNAPSHOT_VERSION);
+	hdr.nr_sections = GUINT32_TO_LE(CHIME_SNAPSHOT_NR);
+
+	buf = g_string_sized_new(65536);
+	/* Placeholder, filled in at the end */
+	g_string_append_len(buf, (gchar *)&hdr, sizeof(hdr));
+
+	save_collection(cxn, buf, &hdr, CHIME_SNAPSHOT_CONTACTS, &priv->contacts, contact_record);
+	save_collection(cxn, buf, &hdr, CHIME_SNAPSHOT_ROOMS, &priv->rooms, room_record);
+	save_collection(cxn, buf, &hdr, CHIME_SNAPSHOT_CONVERSATIONS, &priv->conversations, conversation_record);
+	save_collection(cxn, buf, &hdr, CHIME_SNAPSHOT_PRESENCE, &priv->contacts, presence_record);
+
+	memcpy(buf->str, &hdr, sizeof(hdr));
+
+	path = snapshot_path(priv);
+	if (g_mkdir_with_parents(priv->cache_dir, 0700) ||
+	    !g_file_set_contents(path, buf->str, buf->len, &error)) {
+		chime_connection_log(cxn, CHIME_LOGLVL_WARNING, "Failed to save snapshot %s: %s\n",
+				     path, error ? error->message : g_strerror(errno));
+		g_clear_error(&error);
+	} else {
+		chime_connection_log(cxn, CHIME_LOGLVL_MISC, "Saved snapshot %s (%" G_GSIZE_FORMAT " bytes)\n",
+				     path, buf->len);
+	}
+
+	g_free(path);
+	g_string_free(buf, TRUE);
+}
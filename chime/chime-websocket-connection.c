@@ -20,7 +20,9 @@
  * along with this library; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 
 #include <libsoup/soup.h>
 #include "chime-websocket-connection.h"
@@ -125,6 +127,7 @@ struct _ChimeWebsocketConnectionPrivate {
 	GPollableInputStream *input;
 	GSource *input_source;
 	GByteArray *incoming;
+	gsize incoming_offset;	/* Start of the first unparsed frame */
 
 	GPollableOutputStream *output;
 	GSource *output_source;
@@ -132,12 +135,25 @@ struct _ChimeWebsocketConnectionPrivate {
 
 	/* Current message being assembled */
 	guint8 message_opcode;
+	gboolean message_compressed;
 	GByteArray *message_data;
 
+	/* RFC 7692 permessage-deflate, if negotiated */
+	gboolean deflate;
+	gboolean deflate_no_context;	/* client_no_context_takeover */
+	gboolean inflate_no_context;	/* server_no_context_takeover */
+	z_stream deflater;
+	z_stream inflater;
+	ChimeWebsocketDeflateStats deflate_stats;
+
 	GSource *keepalive_timeout;
 };
 
 #define MAX_INCOMING_PAYLOAD_SIZE_DEFAULT   128 * 1024
+/* Applies even when max-incoming-payload-size is zero (unlimited), since
+ * that only bounds what the peer actually sends us */
+#define MAX_INFLATED_MESSAGE_SIZE           64 * 1024 * 1024
+#define READ_CHUNK_SIZE                     16384
 
 G_DEFINE_TYPE_WITH_PRIVATE (ChimeWebsocketConnection, chime_websocket_connection, G_TYPE_OBJECT)
 
@@ -326,34 +342,56 @@ xor_with_mask (const guint8 *mask,
 	       guint8 *data,
 	       gsize len)
 {
+	guint64 wmask;
 	gsize n;
 
-	/* Do the masking */
-	for (n = 0; n < len; n++)
+	/* Eight bytes at a time; the mask repeats every four so it lines up
+	 * with each word. The memcpy()s avoid alignment and aliasing trouble
+	 * and compile to plain loads and stores, which the compiler is then
+	 * free to vectorize further. */
+	memcpy (&wmask, mask, 4);
+	memcpy ((guint8 *)&wmask + 4, mask, 4);
+
+	for (n = 0; n + sizeof (wmask) <= len; n += sizeof (wmask)) {
+		guint64 w;
+
+		memcpy (&w, data + n, sizeof (w));
+		w ^= wmask;
+		memcpy (data + n, &w, sizeof (w));
+	}
+
+	/* And the tail */
+	for (; n < len; n++)
 		data[n] ^= mask[n & 3];
 }
 
+/* Frame the payload straight from the caller's fragments, so it's
+ * copied exactly once, into the buffer which gets queued. */
 static void
-send_message (ChimeWebsocketConnection *self,
-	      ChimeWebsocketQueueFlags flags,
-	      guint8 opcode,
-	      const guint8 *data,
-	      gsize length)
+send_frame (ChimeWebsocketConnection *self,
+	    ChimeWebsocketQueueFlags flags,
+	    guint8 opcode,
+	    const GOutputVector *vectors,
+	    gint n_vectors)
 {
-	gsize buffered_amount = length;
-	GByteArray *bytes;
-	gsize frame_len;
+	gsize buffered_amount;
+	gsize length = 0;
+	gsize hdr_len, copied;
 	guint8 *outer;
 	guint8 *mask = 0;
 	guint8 *at;
+	gint i;
 
 	if (!(chime_websocket_connection_get_state (self) == SOUP_WEBSOCKET_STATE_OPEN)) {
 		g_debug ("Ignoring message since the connection is closed or is closing");
 		return;
 	}
 
-	bytes = g_byte_array_sized_new (14 + length);
-	outer = bytes->data;
+	for (i = 0; i < n_vectors; i++)
+		length += vectors[i].size;
+	buffered_amount = length;
+
+	outer = g_malloc (14 + length);
 	outer[0] = 0x80 | opcode;
 
 	/* If control message, truncate payload */
@@ -368,12 +406,12 @@ send_message (ChimeWebsocketConnection *self,
 
 	if (length < 126) {
 		outer[1] = (0xFF & length); /* mask | 7-bit-len */
-		bytes->len = 2;
+		hdr_len = 2;
 	} else if (length < 65536) {
 		outer[1] = 126; /* mask | 16-bit-len */
 		outer[2] = (length >> 8) & 0xFF;
 		outer[3] = (length >> 0) & 0xFF;
-		bytes->len = 4;
+		hdr_len = 4;
 	} else {
 		outer[1] = 127; /* mask | 64-bit-len */
 #if GLIB_SIZEOF_SIZE_T > 4
@@ -388,7 +426,7 @@ send_message (ChimeWebsocketConnection *self,
 		outer[7] = (length >> 16) & 0xFF;
 		outer[8] = (length >> 8) & 0xFF;
 		outer[9] = (length >> 0) & 0xFF;
-		bytes->len = 10;
+		hdr_len = 10;
 	}
 
 	/* The server side doesn't need to mask, so we don't. There's
@@ -396,21 +434,184 @@ send_message (ChimeWebsocketConnection *self,
 	 */
 	if (self->pv->connection_type == SOUP_WEBSOCKET_CONNECTION_CLIENT) {
 		outer[1] |= 0x80;
-		mask = outer + bytes->len;
+		mask = outer + hdr_len;
 		* ((guint32 *)mask) = g_random_int ();
-		bytes->len += 4;
+		hdr_len += 4;
 	}
 
-	at = bytes->data + bytes->len;
-	g_byte_array_append (bytes, data, length);
+	at = outer + hdr_len;
+	for (i = 0, copied = 0; i < n_vectors && copied < length; i++) {
+		gsize frag = MIN (vectors[i].size, length - copied);
+
+		memcpy (at + copied, vectors[i].buffer, frag);
+		copied += frag;
+	}
 
 	if (self->pv->connection_type == SOUP_WEBSOCKET_CONNECTION_CLIENT)
 		xor_with_mask (mask, at, length);
 
-	frame_len = bytes->len;
-	queue_frame (self, flags, g_byte_array_free (bytes, FALSE),
-		     frame_len, buffered_amount);
-	g_debug ("queued %d frame of len %u", (int)opcode, (guint)frame_len);
+	queue_frame (self, flags, outer, hdr_len + length, buffered_amount);
+	g_debug ("queued %d frame of len %u", (int)opcode, (guint)(hdr_len + length));
+}
+
+/* The empty deflate block which ends each message; RFC 7692 §7.2.1 */
+static const guint8 deflate_tail[4] = { 0x00, 0x00, 0xff, 0xff };
+
+static GByteArray *
+deflate_message (ChimeWebsocketConnection *self,
+		 const GOutputVector *vectors,
+		 gint n_vectors)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+	z_stream *z = &pv->deflater;
+	gint64 start = g_get_monotonic_time ();
+	GByteArray *out;
+	gsize in_len = 0, used = 0;
+	gint i;
+
+	for (i = 0; i < n_vectors; i++)
+		in_len += vectors[i].size;
+
+	/* out->len is the space available; 'used' is what's filled */
+	out = g_byte_array_new ();
+	g_byte_array_set_size (out, deflateBound (z, in_len) + 16);
+
+	/* Even an empty message needs the sync flush */
+	for (i = 0; i < MAX (n_vectors, 1); i++) {
+		int flush = (i >= n_vectors - 1) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+		z->next_in = n_vectors ? (Bytef *)vectors[i].buffer : NULL;
+		z->avail_in = n_vectors ? vectors[i].size : 0;
+		do {
+			if (out->len - used < 64)
+				g_byte_array_set_size (out, out->len * 2);
+			z->next_out = out->data + used;
+			z->avail_out = out->len - used;
+			if (deflate (z, flush) == Z_STREAM_ERROR) {
+				g_byte_array_unref (out);
+				return NULL;
+			}
+			used = z->next_out - out->data;
+		} while (z->avail_in || !z->avail_out);
+	}
+
+	/* The peer puts the tail back before inflating */
+	if (used >= sizeof (deflate_tail) &&
+	    !memcmp (out->data + used - sizeof (deflate_tail), deflate_tail, sizeof (deflate_tail)))
+		used -= sizeof (deflate_tail);
+	g_byte_array_set_size (out, used);
+
+	if (pv->deflate_no_context)
+		deflateReset (z);
+
+	pv->deflate_stats.messages_out++;
+	pv->deflate_stats.raw_out += in_len;
+	pv->deflate_stats.wire_out += used;
+	pv->deflate_stats.usec += g_get_monotonic_time () - start;
+	return out;
+}
+
+/* Returns FALSE if the message is corrupt or too large */
+static gboolean
+inflate_message (ChimeWebsocketConnection *self)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+	z_stream *z = &pv->inflater;
+	gint64 start = g_get_monotonic_time ();
+	GByteArray *in = pv->message_data;
+	GByteArray *out;
+	guint64 limit = MAX_INFLATED_MESSAGE_SIZE;
+	gsize used = 0;
+	int ret;
+
+	if (pv->max_incoming_payload_size > 0)
+		limit = MIN (limit, pv->max_incoming_payload_size);
+
+	g_byte_array_append (in, deflate_tail, sizeof (deflate_tail));
+
+	out = g_byte_array_new ();
+	g_byte_array_set_size (out, MAX (in->len * 4, 1024));
+
+	z->next_in = in->data;
+	z->avail_in = in->len;
+	do {
+		if (out->len - used < 1024)
+			g_byte_array_set_size (out, out->len * 2);
+		z->next_out = out->data + used;
+		z->avail_out = out->len - used;
+		ret = inflate (z, Z_SYNC_FLUSH);
+		used = z->next_out - out->data;
+
+		/* The peer may end the message with a final block */
+		if (ret == Z_STREAM_END) {
+			inflateReset (z);
+			break;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			g_debug ("inflate failed: %d", ret);
+			g_byte_array_unref (out);
+			return FALSE;
+		}
+		/* Don't let a small message inflate without bound */
+		if (used >= limit) {
+			g_debug ("inflated message exceeds %" G_GUINT64_FORMAT " bytes",
+				 limit);
+			g_byte_array_unref (out);
+			return FALSE;
+		}
+		/* No progress possible */
+		if (ret == Z_BUF_ERROR && z->avail_out)
+			break;
+	} while (z->avail_in || !z->avail_out);
+
+	if (pv->inflate_no_context)
+		inflateReset (z);
+
+	pv->deflate_stats.messages_in++;
+	pv->deflate_stats.raw_in += used;
+	pv->deflate_stats.wire_in += in->len - sizeof (deflate_tail);
+	pv->deflate_stats.usec += g_get_monotonic_time () - start;
+
+	g_byte_array_set_size (out, used);
+	g_byte_array_unref (pv->message_data);
+	pv->message_data = out;
+	return TRUE;
+}
+
+static void
+send_message_iov (ChimeWebsocketConnection *self,
+		  ChimeWebsocketQueueFlags flags,
+		  guint8 opcode,
+		  const GOutputVector *vectors,
+		  gint n_vectors)
+{
+	GByteArray *compressed;
+
+	/* Control frames are never compressed */
+	if (self->pv->deflate && !(opcode & 0x08) &&
+	    chime_websocket_connection_get_state (self) == SOUP_WEBSOCKET_STATE_OPEN &&
+	    (compressed = deflate_message (self, vectors, n_vectors))) {
+		GOutputVector vec = { compressed->data, compressed->len };
+
+		/* RSV1 marks the message as compressed */
+		send_frame (self, flags, 0x40 | opcode, &vec, 1);
+		g_byte_array_unref (compressed);
+		return;
+	}
+
+	send_frame (self, flags, opcode, vectors, n_vectors);
+}
+
+static void
+send_message (ChimeWebsocketConnection *self,
+	      ChimeWebsocketQueueFlags flags,
+	      guint8 opcode,
+	      const guint8 *data,
+	      gsize length)
+{
+	GOutputVector vec = { data, length };
+
+	send_message_iov (self, flags, opcode, &vec, 1);
 }
 
 static void
@@ -658,6 +859,7 @@ static void
 process_contents (ChimeWebsocketConnection *self,
 		  gboolean control,
 		  gboolean fin,
+		  gboolean compressed,
 		  guint8 opcode,
 		  gconstpointer payload,
 		  gsize payload_len)
@@ -731,12 +933,15 @@ process_contents (ChimeWebsocketConnection *self,
 
 		if (opcode) {
 			pv->message_opcode = opcode;
+			pv->message_compressed = compressed;
 			pv->message_data = g_byte_array_sized_new (payload_len + 1);
 		}
 
 		switch (pv->message_opcode) {
 		case 0x01:
-			if (!g_utf8_validate ((char *)payload, payload_len, NULL)) {
+			/* Compressed text is validated once it's inflated */
+			if (!pv->message_compressed &&
+			    !g_utf8_validate ((char *)payload, payload_len, NULL)) {
 				g_debug ("received invalid non-UTF8 text data");
 
 				/* Discard the entire message */
@@ -758,6 +963,21 @@ process_contents (ChimeWebsocketConnection *self,
 
 		/* Actually deliver the message? */
 		if (fin) {
+			if (pv->message_compressed &&
+			    (!inflate_message (self) ||
+			     (pv->message_opcode == 0x01 &&
+			      !g_utf8_validate ((char *)pv->message_data->data,
+						pv->message_data->len, NULL)))) {
+				g_debug ("received bad compressed message");
+
+				g_byte_array_unref (pv->message_data);
+				pv->message_data = NULL;
+				pv->message_opcode = 0;
+
+				bad_data_error_and_close (self);
+				return;
+			}
+
 			/* Always null terminate, as a convenience */
 			g_byte_array_append (pv->message_data, (guchar *)"\0", 1);
 
@@ -776,30 +996,69 @@ process_contents (ChimeWebsocketConnection *self,
 	}
 }
 
+/*
+ * A complete binary message which runs to the end of the buffer (as a
+ * large screen frame usually does) is handed over without copying: the
+ * buffer becomes the message and we start a new one. Unlike the copied
+ * path, it isn't NUL terminated, which only matters for text.
+ */
+static void
+deliver_incoming_in_place (ChimeWebsocketConnection *self,
+			   guint8 opcode,
+			   gsize payload_offset,
+			   gsize payload_len)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+	GBytes *whole, *message;
+
+	whole = g_byte_array_free_to_bytes (pv->incoming);
+	pv->incoming = g_byte_array_sized_new (1024);
+	pv->incoming_offset = 0;
+
+	message = g_bytes_new_from_bytes (whole, payload_offset, payload_len);
+	g_bytes_unref (whole);
+
+	g_debug ("message: delivering %d with %d length in place",
+		 (int)opcode, (int)payload_len);
+	g_signal_emit (self, signals[MESSAGE], 0, (int)opcode, message);
+	g_bytes_unref (message);
+}
+
 static gboolean
 process_frame (ChimeWebsocketConnection *self)
 {
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
 	guint8 *header;
 	guint8 *payload;
 	guint64 payload_len;
 	guint8 *mask;
 	gboolean fin;
 	gboolean control;
+	gboolean compressed;
 	gboolean masked;
 	guint8 opcode;
 	gsize len;
 	gsize at;
 
-	len = self->pv->incoming->len;
+	len = pv->incoming->len - pv->incoming_offset;
 	if (len < 2)
 		return FALSE; /* need more data */
 
-	header = self->pv->incoming->data;
+	header = pv->incoming->data + pv->incoming_offset;
 	fin = ((header[0] & 0x80) != 0);
 	control = header[0] & 0x08;
+	compressed = ((header[0] & 0x40) != 0);
 	opcode = header[0] & 0x0f;
 	masked = ((header[1] & 0x80) != 0);
 
+	/* RSV1 is only valid on the first frame of a message, and only
+	 * if we negotiated compression */
+	if (compressed && (!pv->deflate || control || !opcode)) {
+		g_debug ("received unexpected compressed frame");
+		protocol_error_and_close (self);
+		return FALSE;
+	}
+
 	switch (header[1] & 0x7f) {
 	case 126:
 		at = 4;
@@ -853,18 +1112,32 @@ process_frame (ChimeWebsocketConnection *self)
 	/* Note that now that we've unmasked, we've modified the buffer, we can
 	 * only return below via discarding or processing the message
 	 */
-	process_contents (self, control, fin, opcode, payload, payload_len);
+	if (fin && opcode == 0x02 && !compressed && !pv->message_data &&
+	    !pv->close_received && at + payload_len == len) {
+		deliver_incoming_in_place (self, opcode, pv->incoming_offset + at, payload_len);
+		return TRUE;
+	}
+
+	process_contents (self, control, fin, compressed, opcode, payload, payload_len);
 
-	/* Move past the parsed frame */
-	g_byte_array_remove_range (self->pv->incoming, 0, at + payload_len);
+	/* Move past the parsed frame; it's discarded in process_incoming() */
+	pv->incoming_offset += at + payload_len;
 	return TRUE;
 }
 
 static void
 process_incoming (ChimeWebsocketConnection *self)
 {
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+
 	while (process_frame (self))
 		;
+
+	/* Shift any partial frame down once, rather than after every frame */
+	if (pv->incoming_offset) {
+		g_byte_array_remove_range (pv->incoming, 0, pv->incoming_offset);
+		pv->incoming_offset = 0;
+	}
 }
 
 static gboolean
@@ -880,11 +1153,11 @@ on_web_socket_input (GObject *pollable_stream,
 
 	do {
 		len = pv->incoming->len;
-		g_byte_array_set_size (pv->incoming, len + 1024);
+		g_byte_array_set_size (pv->incoming, len + READ_CHUNK_SIZE);
 
 		count = g_pollable_input_stream_read_nonblocking (pv->input,
 								  pv->incoming->data + len,
-								  1024, NULL, &error);
+								  READ_CHUNK_SIZE, NULL, &error);
 
 		if (count < 0) {
 			if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
@@ -1197,6 +1470,11 @@ chime_websocket_connection_finalize (GObject *object)
 	if (pv->message_data)
 		g_byte_array_free (pv->message_data, TRUE);
 
+	if (pv->deflate) {
+		deflateEnd (&pv->deflater);
+		inflateEnd (&pv->inflater);
+	}
+
 	if (pv->uri)
 		soup_uri_free (pv->uri);
 	g_free (pv->origin);
@@ -1324,7 +1602,8 @@ chime_websocket_connection_class_init (ChimeWebsocketConnectionClass *klass)
 	 * ChimeWebsocketConnection:max-incoming-payload-size:
 	 *
 	 * The maximum payload size for incoming packets the protocol expects
-	 * or 0 to not limit it.
+	 * or 0 to not limit it. Compressed messages are also limited to this
+	 * size once inflated, and never inflate beyond 64MiB regardless.
 	 *
 	 * Since: 2.56
 	 */
@@ -1705,6 +1984,167 @@ chime_websocket_connection_send_binary (ChimeWebsocketConnection *self,
 	send_message (self, CHIME_WEBSOCKET_QUEUE_NORMAL, 0x02, data, length);
 }
 
+/**
+ * chime_websocket_connection_send_binary_iov:
+ * @self: the WebSocket
+ * @vectors: (array length=n_vectors): the fragments of the message
+ * @n_vectors: the number of elements in @vectors
+ *
+ * Send a binary message to the peer, gathered from @vectors. This
+ * avoids the caller having to assemble a header and payload into a
+ * temporary buffer first.
+ *
+ * The message is queued to be sent and will be sent when the main loop
+ * is run.
+ */
+void
+chime_websocket_connection_send_binary_iov (ChimeWebsocketConnection *self,
+					   const GOutputVector *vectors,
+					   gint n_vectors)
+{
+	g_return_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self));
+	g_return_if_fail (chime_websocket_connection_get_state (self) == SOUP_WEBSOCKET_STATE_OPEN);
+	g_return_if_fail (vectors != NULL || n_vectors == 0);
+
+	send_message_iov (self, CHIME_WEBSOCKET_QUEUE_NORMAL, 0x02, vectors, n_vectors);
+}
+
+static gboolean
+parse_window_bits (const char *val, int *bits)
+{
+	char *end;
+	long n;
+
+	if (!val)
+		return FALSE;
+
+	n = strtol (val, &end, 10);
+	if (*end || n < 8 || n > 15)
+		return FALSE;
+
+	*bits = n;
+	return TRUE;
+}
+
+/**
+ * chime_websocket_connection_enable_deflate:
+ * @self: the WebSocket
+ * @extensions: the Sec-WebSocket-Extensions header from the server's
+ *   handshake response
+ * @error: return location for a #GError, or %NULL
+ *
+ * Enable RFC 7692 permessage-deflate with the parameters the server
+ * accepted in response to %CHIME_WEBSOCKET_DEFLATE_OFFER. This must be
+ * done before the main loop runs with the new connection.
+ *
+ * If the response is not one we can honour, the connection must be
+ * failed.
+ *
+ * Returns: %TRUE if compression is now enabled
+ */
+gboolean
+chime_websocket_connection_enable_deflate (ChimeWebsocketConnection *self,
+					   const char *extensions,
+					   GError **error)
+{
+	ChimeWebsocketConnectionPrivate *pv;
+	gboolean deflate_no_context = FALSE, inflate_no_context = FALSE;
+	int client_bits = 15, server_bits = 15;
+	gchar **params;
+	int i;
+
+	g_return_val_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self), FALSE);
+	g_return_val_if_fail (extensions != NULL, FALSE);
+	pv = self->pv;
+	g_return_val_if_fail (!pv->deflate, FALSE);
+
+	/* We only offered the one, so that's all there can be */
+	params = g_strsplit (extensions, ";", -1);
+	if (!params[0] || strcmp (g_strstrip (params[0]), "permessage-deflate"))
+		goto bad;
+
+	for (i = 1; params[i]; i++) {
+		gchar *name = params[i];
+		gchar *val = strchr (name, '=');
+
+		if (val) {
+			*(val++) = 0;
+			val = g_strstrip (val);
+			/* The value may be a quoted-string */
+			if (val[0] == '"' && strlen (val) > 1 && val[strlen (val) - 1] == '"') {
+				val[strlen (val) - 1] = 0;
+				val++;
+			}
+		}
+		g_strstrip (name);
+
+		if (!strcmp (name, "server_no_context_takeover") && !val)
+			inflate_no_context = TRUE;
+		else if (!strcmp (name, "client_no_context_takeover") && !val)
+			deflate_no_context = TRUE;
+		else if (!strcmp (name, "server_max_window_bits") &&
+			 parse_window_bits (val, &server_bits))
+			; /* Inflating with the full window copes with any size */
+		else if (!strcmp (name, "client_max_window_bits") &&
+			 parse_window_bits (val, &client_bits))
+			;
+		else
+			goto bad;
+	}
+
+	/* zlib can't do a raw deflate with an 8-bit window */
+	if (client_bits < 9)
+		goto bad;
+
+	if (deflateInit2 (&pv->deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			  -client_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		goto bad;
+	if (inflateInit2 (&pv->inflater, -15) != Z_OK) {
+		deflateEnd (&pv->deflater);
+		goto bad;
+	}
+
+	g_debug ("permessage-deflate enabled: client window %d%s, server window %d%s",
+		 client_bits, deflate_no_context ? " no context" : "",
+		 server_bits, inflate_no_context ? " no context" : "");
+
+	pv->deflate = TRUE;
+	pv->deflate_no_context = deflate_no_context;
+	pv->inflate_no_context = inflate_no_context;
+	g_strfreev (params);
+	return TRUE;
+
+ bad:
+	g_set_error (error, SOUP_WEBSOCKET_ERROR, SOUP_WEBSOCKET_ERROR_BAD_HANDSHAKE,
+		     "Unsupported WebSocket extension response: %s", extensions);
+	g_strfreev (params);
+	return FALSE;
+}
+
+/**
+ * chime_websocket_connection_get_deflate_stats:
+ * @self: the WebSocket
+ * @stats: (out): where to store the counters
+ *
+ * Get the permessage-deflate byte counts and the time spent compressing
+ * and decompressing.
+ *
+ * Returns: %FALSE if compression isn't enabled on this connection
+ */
+gboolean
+chime_websocket_connection_get_deflate_stats (ChimeWebsocketConnection *self,
+					      ChimeWebsocketDeflateStats *stats)
+{
+	g_return_val_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self), FALSE);
+	g_return_val_if_fail (stats != NULL, FALSE);
+
+	if (!self->pv->deflate)
+		return FALSE;
+
+	*stats = self->pv->deflate_stats;
+	return TRUE;
+}
+
 /**
  * chime_websocket_connection_close:
  * @self: the WebSocket
@@ -35,6 +35,19 @@ G_BEGIN_DECLS
 
 typedef struct _ChimeWebsocketConnectionPrivate  ChimeWebsocketConnectionPrivate;
 
+/* What a client offers in Sec-WebSocket-Extensions to ask for RFC 7692 */
+#define CHIME_WEBSOCKET_DEFLATE_OFFER "permessage-deflate; client_max_window_bits"
+
+typedef struct {
+	guint64 messages_out;
+	guint64 raw_out;	/* Bytes before compression */
+	guint64 wire_out;	/* Bytes after compression */
+	guint64 messages_in;
+	guint64 raw_in;
+	guint64 wire_in;
+	gint64 usec;		/* Time spent in zlib */
+} ChimeWebsocketDeflateStats;
+
 struct _ChimeWebsocketConnection {
 	GObject parent;
 
@@ -89,6 +102,15 @@ void                chime_websocket_connection_send_text      (ChimeWebsocketCon
 void                chime_websocket_connection_send_binary    (ChimeWebsocketConnection *self,
 							      gconstpointer data,
 							      gsize length);
+void                chime_websocket_connection_send_binary_iov (ChimeWebsocketConnection *self,
+							       const GOutputVector *vectors,
+							       gint n_vectors);
+
+gboolean            chime_websocket_connection_enable_deflate (ChimeWebsocketConnection *self,
+							      const char *extensions,
+							      GError **error);
+gboolean            chime_websocket_connection_get_deflate_stats (ChimeWebsocketConnection *self,
+								 ChimeWebsocketDeflateStats *stats);
 
 void                chime_websocket_connection_close          (ChimeWebsocketConnection *self,
 							      gushort code,
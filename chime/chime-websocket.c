@@ -21,6 +21,35 @@
 #include "chime-connection.h"
 #include "chime-connection-private.h"
 
+#if defined (USE_LIBSOUP_WEBSOCKETS) && SOUP_CHECK_VERSION (2, 68, 0)
+/* libsoup does permessage-deflate itself, given the extension class */
+#define CHIME_LIBSOUP_DEFLATE
+
+static GPtrArray *
+deflate_extensions (void)
+{
+	static gsize once;
+	static GPtrArray *extensions;
+
+	if (g_once_init_enter (&once)) {
+		extensions = g_ptr_array_new ();
+		g_ptr_array_add (extensions, g_type_class_ref (SOUP_TYPE_WEBSOCKET_EXTENSION_DEFLATE));
+		g_once_init_leave (&once, 1);
+	}
+	return extensions;
+}
+
+/* Only what we offered is acceptable in the response */
+static GPtrArray *
+offered_extensions (SoupMessage *msg)
+{
+	if (!soup_message_headers_get_one (msg->request_headers, "Sec-WebSocket-Extensions"))
+		return NULL;
+
+	return deflate_extensions ();
+}
+#endif
+
 static void
 websocket_connect_async_complete (SoupSession *session, SoupMessage *msg, gpointer user_data)
 {
@@ -50,16 +79,47 @@ websocket_connect_async_stop (SoupMessage *msg, gpointer user_data)
 					      0, 0, NULL, NULL, task);
 
 	g_object_ref(msg);
-	if (soup_websocket_client_verify_handshake (msg, &error)) {
+#ifdef CHIME_LIBSOUP_DEFLATE
+	GList *accepted = NULL;
+	gboolean verified = soup_websocket_client_verify_handshake_with_extensions (msg,
+				 offered_extensions (msg), &accepted, &error);
+#else
+	gboolean verified = soup_websocket_client_verify_handshake (msg, &error);
+#endif
+	if (verified) {
 		GIOStream *stream = soup_session_steal_connection (priv->soup_sess, msg);
+#ifdef CHIME_LIBSOUP_DEFLATE
+		SoupWebsocketConnection *client = soup_websocket_connection_new_with_extensions (stream,
+				 soup_message_get_uri (msg),
+				 SOUP_WEBSOCKET_CONNECTION_CLIENT,
+				 soup_message_headers_get_one (msg->request_headers, "Origin"),
+				 soup_message_headers_get_one (msg->response_headers, "Sec-WebSocket-Protocol"),
+				 accepted);
+#else
 		SoupWebsocketConnection *client = soup_websocket_connection_new (stream,
 				 soup_message_get_uri (msg),
 				 SOUP_WEBSOCKET_CONNECTION_CLIENT,
 				 soup_message_headers_get_one (msg->request_headers, "Origin"),
 				 soup_message_headers_get_one (msg->response_headers, "Sec-WebSocket-Protocol"));
+#endif
 		g_object_unref (stream);
 
-		g_task_return_pointer (task, client, g_object_unref);
+#ifndef USE_LIBSOUP_WEBSOCKETS
+		/* If we offered it and the server accepted */
+		const char *extensions = soup_message_headers_get_one (msg->response_headers,
+								       "Sec-WebSocket-Extensions");
+		if (extensions &&
+		    (!soup_message_headers_get_one (msg->request_headers, "Sec-WebSocket-Extensions") ||
+		     !chime_websocket_connection_enable_deflate (client, extensions, &error))) {
+			if (!error)
+				error = g_error_new (SOUP_WEBSOCKET_ERROR, SOUP_WEBSOCKET_ERROR_BAD_HANDSHAKE,
+						     _("Server requested unsupported extension: %s"),
+						     extensions);
+			g_object_unref (client);
+			g_task_return_error (task, error);
+		} else
+#endif
+			g_task_return_pointer (task, client, g_object_unref);
 	} else
 		g_task_return_error (task, error);
 
@@ -74,6 +134,7 @@ websocket_connect_async_stop (SoupMessage *msg, gpointer user_data)
  * @origin: (allow-none): origin of the connection
  * @protocols: (allow-none) (array zero-terminated=1): a
  *   %NULL-terminated array of protocols supported
+ * @deflate: offer permessage-deflate compression
  * @cancellable: a #GCancellable
  * @callback: the callback to invoke
  * @user_data: data for @callback
@@ -104,6 +165,7 @@ chime_connection_websocket_connect_async (ChimeConnection      *cxn,
 					  SoupMessage          *msg,
 					  const char           *origin,
 					  char                **protocols,
+					  gboolean              deflate,
 					  GCancellable         *cancellable,
 					  GAsyncReadyCallback   callback,
 					  gpointer              user_data)
@@ -113,7 +175,17 @@ chime_connection_websocket_connect_async (ChimeConnection      *cxn,
 
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
+#ifdef CHIME_LIBSOUP_DEFLATE
+	soup_websocket_client_prepare_handshake_with_extensions (msg, origin, protocols,
+								 deflate ? deflate_extensions () : NULL);
+#else
 	soup_websocket_client_prepare_handshake (msg, origin, protocols);
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	if (deflate)
+		soup_message_headers_replace (msg->request_headers, "Sec-WebSocket-Extensions",
+					      CHIME_WEBSOCKET_DEFLATE_OFFER);
+#endif
+#endif
 
 	GTask *task = g_task_new (cxn, cancellable, callback, user_data);
 	g_task_set_task_data (task, g_object_ref(cxn), g_object_unref);
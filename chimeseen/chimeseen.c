@@ -37,7 +37,7 @@ struct conv_data {
 };
 
 struct msg_mark {
-	GTimeVal created;
+	gint64 created;		/* µs since the epoch */
 	GtkTextMark *mark;
 };
 
@@ -77,6 +77,8 @@ conv_seen_cb(PurpleConversation *conv, JsonNode *member)
 	    !g_time_val_from_iso8601(lastread, &tv))
 		return;
 
+	gint64 read_time = (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+
 	struct conv_data *cd = purple_conversation_get_data(conv, "chime-seen");
 	if (!cd)
 		return;
@@ -84,11 +86,8 @@ conv_seen_cb(PurpleConversation *conv, JsonNode *member)
 	while (cd->l) {
 		struct msg_mark *m = cd->l->data;
 
-		if (tv.tv_sec < m->created.tv_sec ||
-		    (tv.tv_sec == m->created.tv_sec &&
-		     tv.tv_usec < m->created.tv_usec)) {
+		if (read_time < m->created)
 			break;
-		}
 
 		cd->l = g_list_remove(cd->l, m);
 
@@ -114,10 +113,12 @@ got_convmsg_cb(PurpleConversation *conv, gboolean outbound, JsonNode *msgnode)
 
 	struct msg_mark *m = g_new0(struct msg_mark, 1);
 
-	if (!g_time_val_from_iso8601(created_on, &m->created)) {
+	GTimeVal tv;
+	if (!g_time_val_from_iso8601(created_on, &tv)) {
 		g_free(m);
 		return;
 	}
+	m->created = (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
 
 	GtkIMHtml *imhtml = GTK_IMHTML(PIDGIN_CONVERSATION(conv)->imhtml);
 	GtkTextIter end;
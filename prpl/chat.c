@@ -61,6 +61,7 @@ struct chime_chat {
 	ChimeMeeting *meeting;
 	ChimeCall *call;
 	void *participants_ui;
+	GHashTable *participants_shown;	/* participant_id → participant_row_sig() */
 	PurpleMedia *media;
 	gboolean media_connected;
 
@@ -249,7 +250,32 @@ static void open_participant_im(PurpleConnection *conn, GList *row, gpointer _ch
 	}
 }
 
-static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participants)
+/* -1 for none, else an index into vol_icons[] */
+static int participant_vol_level(ChimeCallParticipant *p)
+{
+	if (p->status != CHIME_PARTICIPATION_PRESENT)
+		return -1;
+	else if (p->volume == -128)
+		return 0;
+	else if (p->volume < -64)
+		return 1;
+	else if (p->volume < -32)
+		return 2;
+	else
+		return 3;
+}
+
+static const gchar *vol_icons[] = { "🔇", "🔈", "🔉", "🔊" };
+
+/* Everything about a participant which shows in the list, apart from the
+ * name which never changes. Most volume changes don't change the icon. */
+static guint participant_row_sig(ChimeCallParticipant *p)
+{
+	return p->status | (p->shared_screen << 8) | ((participant_vol_level(p) + 1) << 16);
+}
+
+static PurpleNotifySearchResults *generate_sr_participants(struct chime_chat *chat,
+							   GHashTable *participants)
 {
 	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
 	PurpleNotifySearchColumn *column;
@@ -267,6 +293,9 @@ static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participa
 
 	gpointer klass = g_type_class_ref(CHIME_TYPE_CALL_PARTICIPATION_STATUS);
 
+	if (!chat->participants_shown)
+		chat->participants_shown = g_hash_table_new(g_str_hash, g_str_equal);
+
 	GList *pl = g_hash_table_get_values(participants);
 	pl = g_list_sort(pl, participant_sort);
 	while (pl) {
@@ -285,20 +314,12 @@ static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participa
 			screen_icon = "";
 		row = g_list_append(row, g_strdup(screen_icon));
 
-		const gchar *vol_icon;
-		if (p->status != CHIME_PARTICIPATION_PRESENT)
-			vol_icon = "";
-		else if (p->volume == -128)
-			vol_icon = "🔇";
-		else if (p->volume < -64)
-			vol_icon = "🔈";
-		else if (p->volume < -32)
-			vol_icon = "🔉";
-		else
-			vol_icon = "🔊";
-		row = g_list_append(row, g_strdup(vol_icon));
+		int vol_level = participant_vol_level(p);
+		row = g_list_append(row, g_strdup(vol_level < 0 ? "" : vol_icons[vol_level]));
 
 		purple_notify_searchresults_row_add(results, row);
+		g_hash_table_insert(chat->participants_shown, (void *)p->participant_id,
+				    GUINT_TO_POINTER(participant_row_sig(p)));
 
 		pl = g_list_remove(pl, p);
 	}
@@ -308,13 +329,18 @@ static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participa
 
 }
 static void on_call_participants(ChimeCall *call, GHashTable *participants, struct chime_chat *chat);
+static void on_call_participants_updated(ChimeCall *call, GHashTable *participants,
+					 GHashTable *changed, gint channel, struct chime_chat *chat);
 
 static void participants_closed_cb(gpointer _chat)
 {
 	struct chime_chat *chat = _chat;
 	chat->participants_ui = NULL;
+	g_clear_pointer(&chat->participants_shown, g_hash_table_destroy);
 	g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
 					     0, 0, NULL, G_CALLBACK(on_call_participants), chat);
+	g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
+					     0, 0, NULL, G_CALLBACK(on_call_participants_updated), chat);
 }
 
 static void call_stream_info(PurpleMedia *media, PurpleMediaInfoType type, gchar *id, const gchar *participant, gboolean local, struct chime_chat *chat)
@@ -459,7 +485,7 @@ static void on_audio_state(ChimeCall *call, ChimeAudioState audio_state,
 
 static void on_call_participants(ChimeCall *call, GHashTable *participants, struct chime_chat *chat)
 {
-	PurpleNotifySearchResults *results = generate_sr_participants(participants);
+	PurpleNotifySearchResults *results = generate_sr_participants(chat, participants);
 	PurpleConnection *conn = chat->conv->account->gc;
 
 	if (!chat->participants_ui) {
@@ -471,6 +497,28 @@ static void on_call_participants(ChimeCall *call, GHashTable *participants, stru
 	}
 }
 
+/* The list can only be regenerated as a whole, so don't unless it looks different */
+static void on_call_participants_updated(ChimeCall *call, GHashTable *participants,
+					 GHashTable *changed, gint channel, struct chime_chat *chat)
+{
+	GHashTableIter iter;
+	gpointer key, val, shown;
+	gboolean visible = FALSE;
+
+	if (chat->participants_ui && chat->participants_shown) {
+		g_hash_table_iter_init(&iter, changed);
+		while (!visible && g_hash_table_iter_next(&iter, &key, &val)) {
+			if (!g_hash_table_lookup_extended(chat->participants_shown, key, NULL, &shown) ||
+			    GPOINTER_TO_UINT(shown) != participant_row_sig(val))
+				visible = TRUE;
+		}
+		if (!visible)
+			return;
+	}
+
+	on_call_participants(call, participants, chat);
+}
+
 static void on_room_membership(ChimeRoom *room, ChimeRoomMember *member, struct chime_chat *chat)
 {
 	const gchar *who = chime_contact_get_email(member->contact);
@@ -909,6 +957,7 @@ struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, Ch
 			g_signal_connect(chat->call, "screen-state", G_CALLBACK(on_screen_state), chat);
 			g_signal_connect(chat->call, "audio-state", G_CALLBACK(on_audio_state), chat);
 			g_signal_connect(chat->call, "participants-changed", G_CALLBACK(on_call_participants), chat);
+			g_signal_connect(chat->call, "participants-updated", G_CALLBACK(on_call_participants_updated), chat);
 			g_signal_connect(chat->call, "new-presenter", G_CALLBACK(on_call_presenter), chat);
 
 			/* We'll probably miss the first audio-state signal when it
@@ -1043,29 +1092,26 @@ static void on_chime_room_mentioned(ChimeConnection *cxn, ChimeObject *obj, Json
 
 static void on_chime_new_room(ChimeConnection *cxn, ChimeRoom *room, PurpleConnection *conn)
 {
-	const gchar *last_mentioned;
-	GTimeVal mention_tv;
+	gint64 mention_time;
 
 	/* If no LastMentioned or we can't parse it, nothing to do */
-	last_mentioned = chime_room_get_last_mentioned(room);
-	if (!last_mentioned || !g_time_val_from_iso8601(last_mentioned, &mention_tv))
+	mention_time = chime_room_get_last_mentioned_time(room);
+	if (!mention_time)
 		return;
 
 	const gchar *msg_time;
-	GTimeVal msg_tv;
+	gint64 seen_time = 0;
 
 	/* For a new installation which hasn't seen this room at all yet,
 	 * use the server's idea of LastRead instead of the local one. Otherwise
 	 * we end up spending hours fetching *all* old rooms and messages. */
-	if ( (chime_read_last_msg(conn, CHIME_OBJECT(room), &msg_time, NULL) &&
-	      g_time_val_from_iso8601(msg_time, &msg_tv)) ||
-	     ((msg_time = chime_room_get_last_read(room)) &&
-	      g_time_val_from_iso8601(msg_time, &msg_tv)) ) {
-		if (mention_tv.tv_sec < msg_tv.tv_sec ||
-		    (mention_tv.tv_sec == msg_tv.tv_sec && mention_tv.tv_usec <= msg_tv.tv_usec)) {
-			/* LastMentioned is older than we've already seen. Nothing to do. */
-			return;
-		}
+	if (!chime_read_last_msg(conn, CHIME_OBJECT(room), &msg_time, NULL) ||
+	    !chime_parse_iso8601(msg_time, &seen_time))
+		seen_time = chime_room_get_last_read_time(room);
+
+	if (seen_time && mention_time <= seen_time) {
+		/* LastMentioned is older than we've already seen. Nothing to do. */
+		return;
 	}
 
 	/* We have been mentioned since we last looked at this room. Open it now. */
@@ -1074,22 +1120,18 @@ static void on_chime_new_room(ChimeConnection *cxn, ChimeRoom *room, PurpleConne
 
 void on_chime_new_group_conv(ChimeConnection *cxn, ChimeConversation *conv, PurpleConnection *conn)
 {
-	const gchar *last_sent;
-	GTimeVal sent_tv;
+	gint64 sent_time;
 
 	/* If no LastMentioned or we can't parse it, nothing to do */
-	last_sent = chime_conversation_get_last_sent(conv);
-	if (!last_sent || !g_time_val_from_iso8601(last_sent, &sent_tv) ||
-	    (!sent_tv.tv_sec && !sent_tv.tv_usec))
+	sent_time = chime_conversation_get_last_sent_time(conv);
+	if (!sent_time)
 		return;
 
-	const gchar *seen_time;
-	GTimeVal seen_tv;
+	const gchar *seen_str;
+	gint64 seen_time;
 
-	if (chime_read_last_msg(conn, CHIME_OBJECT(conv), &seen_time, NULL) &&
-	    g_time_val_from_iso8601(seen_time, &seen_tv) &&
-	    (sent_tv.tv_sec < seen_tv.tv_sec ||
-	     (sent_tv.tv_sec == seen_tv.tv_sec && sent_tv.tv_usec <= seen_tv.tv_usec))) {
+	if (chime_read_last_msg(conn, CHIME_OBJECT(conv), &seen_str, NULL) &&
+	    chime_parse_iso8601(seen_str, &seen_time) && sent_time <= seen_time) {
 		/* LastSent is older than we've already seen. Nothing to do except
 		 * hook up the signal to open the "chat" when a message comes in */
 		g_signal_connect(conv, "message", G_CALLBACK(on_group_conv_msg), conn);
@@ -1181,7 +1223,10 @@ static void show_participants(PurpleBuddy *buddy, gpointer _chat)
 	if (chat->call) {
 		g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
 						     0, 0, NULL, G_CALLBACK(on_call_participants), chat);
+		g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
+						     0, 0, NULL, G_CALLBACK(on_call_participants_updated), chat);
 		g_signal_connect(chat->call, "participants-changed", G_CALLBACK(on_call_participants), chat);
+		g_signal_connect(chat->call, "participants-updated", G_CALLBACK(on_call_participants_updated), chat);
 		chime_call_emit_participants(chat->call);
 	}
 }
@@ -158,6 +158,13 @@ static void on_chime_log_message(ChimeConnection *cxn, ChimeLogLevel lvl, const
 	purple_debug(purple_level_from_chime(lvl), "chime", "%s", str);
 }
 
+static void on_chime_timing(ChimeConnection *cxn, const gchar *what, gint64 usec,
+			    PurpleConnection *conn)
+{
+	purple_debug(PURPLE_DEBUG_INFO, "chime", "%s took %" G_GINT64_FORMAT " ms\n",
+		     what, usec / 1000);
+}
+
 static void on_session_token_changed(ChimeConnection *connection, GParamSpec *pspec, PurpleConnection *conn)
 {
 	purple_debug(PURPLE_DEBUG_INFO, "chime", "Session token changed\n");
@@ -236,6 +243,14 @@ static void chime_purple_login(PurpleAccount *account)
 	pc->cxn = chime_connection_new(purple_account_get_username(account),
 				       server, devtoken, token);
 
+	gchar *cache_dir = g_build_filename(purple_user_dir(), "chime",
+					    purple_account_get_username(account), NULL);
+	chime_connection_set_cache_dir(pc->cxn, cache_dir);
+	g_free(cache_dir);
+
+	chime_connection_set_page_size(pc->cxn, purple_account_get_int(account, "page-size",
+								       CHIME_PAGE_SIZE_DEFAULT));
+
 	g_signal_connect(pc->cxn, "notify::session-token",
 			 G_CALLBACK(on_session_token_changed), conn);
 	g_signal_connect(pc->cxn, "authenticate",
@@ -254,6 +269,8 @@ static void chime_purple_login(PurpleAccount *account)
 	   on close, and it doesn't use it anyway. */
 	g_signal_connect(pc->cxn, "log-message",
 			 G_CALLBACK(on_chime_log_message), NULL);
+	g_signal_connect(pc->cxn, "timing",
+			 G_CALLBACK(on_chime_timing), NULL);
 
 	chime_connection_connect(pc->cxn);
 }
@@ -516,6 +533,14 @@ static void chime_purple_init_plugin(PurplePlugin *plugin)
 	opt = purple_account_option_string_new(_("Token"), "token", NULL);
 	opts = g_list_append(opts, opt);
 
+	opt = purple_account_option_int_new(_("Parallel history fetches"),
+					    "history-fetches", FETCH_PARALLEL_DEFAULT);
+	opts = g_list_append(opts, opt);
+
+	opt = purple_account_option_int_new(_("Maximum results per request"),
+					    "page-size", CHIME_PAGE_SIZE_DEFAULT);
+	opts = g_list_append(opts, opt);
+
 	chime_prpl_info.protocol_options = opts;
 
 #ifndef PRPL_HAS_GET_CB_ALIAS
@@ -121,7 +121,10 @@ void chime_purple_recent_conversations(PurplePluginAction *action);
 extern PurpleDBusBinding chime_purple_dbus_bindings[];
 
 /* messages.c */
+#define FETCH_PARALLEL_DEFAULT 4
+
 struct chime_msgs;
+struct chime_msgstore;
 
 typedef void (*chime_msg_cb)(ChimeConnection *cxn, struct chime_msgs *msgs,
 			     JsonNode *node, time_t tm, gboolean new_msg);
@@ -129,10 +132,13 @@ struct chime_msgs {
 	PurpleConnection *conn;
 	ChimeObject *obj;
 	gchar *last_seen;
-	gchar *fetch_until;
+	GQueue *fetch_windows;
+	GQueue fetches_running;
+	JsonNode *fetch_last;
 	GQueue *seen_msgs;
 	gboolean unseen;
 	GHashTable *msg_gather;
+	struct chime_msgstore *store;
 	chime_msg_cb cb;
 	gboolean msgs_done, members_done, msgs_failed;
 };
@@ -144,6 +150,19 @@ void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj
 void purple_chime_init_messages(PurpleConnection *conn);
 void purple_chime_destroy_messages(PurpleConnection *conn);
 
+/* msgstore.c */
+typedef void (*chime_msgstore_cb)(JsonNode *node, gpointer cb_data);
+
+struct chime_msgstore *chime_msgstore_open(PurpleConnection *conn, ChimeObject *obj);
+void chime_msgstore_close(struct chime_msgstore *store);
+void chime_msgstore_begin(struct chime_msgstore *store);
+void chime_msgstore_end(struct chime_msgstore *store);
+gboolean chime_msgstore_add(struct chime_msgstore *store, JsonNode *node, gboolean synced);
+void chime_msgstore_mark_synced(struct chime_msgstore *store);
+gchar *chime_msgstore_get_synced(struct chime_msgstore *store, gint64 *synced);
+guint chime_msgstore_replay(struct chime_msgstore *store, gint64 since,
+			    chime_msgstore_cb cb, gpointer cb_data);
+
 /* attachments.c */
 
 /*
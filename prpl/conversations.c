@@ -453,8 +453,11 @@ static void open_im_conv(PurpleConnection *conn, GList *row, gpointer _unused)
 
 static gint compare_conv_date(ChimeConversation *a, ChimeConversation *b)
 {
-	return g_strcmp0(chime_conversation_get_updated_on(b),
-			 chime_conversation_get_updated_on(a));
+	gint64 a_time = chime_conversation_get_updated_on_time(a);
+	gint64 b_time = chime_conversation_get_updated_on_time(b);
+
+	/* Newest first */
+	return (b_time > a_time) - (b_time < a_time);
 }
 
 static void insert_conv(ChimeConnection *cxn, ChimeConversation *conv, gpointer _convs)
@@ -46,8 +46,23 @@ static gboolean is_msg_unseen(GQueue *q, const gchar *id)
 	return TRUE;
 }
 
+/* Values in msgs->msg_gather, with the timestamps parsed on arrival */
+struct gathered_msg {
+	JsonNode *node;
+	gint64 created;
+	gint64 updated;
+};
+
+static void free_gathered_msg(gpointer _gm)
+{
+	struct gathered_msg *gm = _gm;
+
+	json_node_unref(gm->node);
+	g_free(gm);
+}
+
 struct msg_sort {
-	GTimeVal tm;
+	gint64 tm;
 	const gchar *id;
 	JsonNode *node;
 };
@@ -57,101 +72,100 @@ static gint compare_ms(gconstpointer _a, gconstpointer _b)
 	const struct msg_sort *a = _a;
 	const struct msg_sort *b = _b;
 
-	if (a->tm.tv_sec > b->tm.tv_sec)
-		return 1;
-	if (a->tm.tv_sec == b->tm.tv_sec &&
-	    a->tm.tv_usec > b->tm.tv_usec)
-		return 1;
-	return 0;
+	if (a->tm != b->tm)
+		return a->tm > b->tm ? 1 : -1;
+
+	/* g_array_sort() isn't stable; keep replay order deterministic */
+	return strcmp(a->id, b->id);
 }
 
-static int insert_queued_msg(gpointer _id, gpointer _node, gpointer _list)
+struct msg_take {
+	GArray *arr;
+	gint64 until;
+};
+
+static int insert_queued_msg(gpointer _id, gpointer _gm, gpointer _take)
 {
-	const gchar *str;
-	GList **l = _list;
-
-	if (parse_string(_node, "CreatedOn", &str)) {
-		struct msg_sort *ms = g_new0(struct msg_sort, 1);
-		if (!g_time_val_from_iso8601(str, &ms->tm)) {
-			g_free(ms);
-			return TRUE;
-		}
-		ms->node = json_node_ref(_node);
-		ms->id = _id;
-		*l = g_list_insert_sorted(*l, ms, compare_ms);
+	struct gathered_msg *gm = _gm;
+	struct msg_take *take = _take;
+	GArray *arr = take->arr;
+
+	if (gm->created >= take->until)
+		return FALSE;
+
+	if (gm->created) {
+		struct msg_sort ms;
+
+		ms.tm = gm->created;
+		ms.node = json_node_ref(gm->node);
+		ms.id = _id;
+		g_array_append_val(arr, ms);
 	}
 	return TRUE;
 }
 
-void chime_complete_messages(ChimeConnection *cxn, struct chime_msgs *msgs)
+/* Sort and deliver the gathered messages created before 'until'. Each
+ * batch follows on from the last in time; only the 'final' one can hold
+ * the newest message, which may count as new. */
+static void deliver_gathered(ChimeConnection *cxn, struct chime_msgs *msgs, gint64 until,
+			     gboolean final)
 {
-	GList *l = NULL;
-
-	/* Sort messages by time */
-	g_hash_table_foreach_remove(msgs->msg_gather, insert_queued_msg, &l);
-
-	while (l) {
-		struct msg_sort *ms = l->data;
+	struct msg_take take;
+	guint i;
+
+	/* Sort messages by time, which was parsed as they arrived. Sort the
+	 * whole batch in one go rather than doing an insertion sort. */
+	take.until = until;
+	take.arr = g_array_sized_new(FALSE, FALSE, sizeof(struct msg_sort),
+				     g_hash_table_size(msgs->msg_gather));
+	g_hash_table_foreach_remove(msgs->msg_gather, insert_queued_msg, &take);
+	g_array_sort(take.arr, compare_ms);
+
+	for (i = 0; i < take.arr->len; i++) {
+		struct msg_sort *ms = &g_array_index(take.arr, struct msg_sort, i);
+		gboolean last = (i == take.arr->len - 1);
+		time_t tm = ms->tm / G_USEC_PER_SEC;
 		const gchar *id = ms->id;
 		JsonNode *node = ms->node;
-		gboolean seen_one = FALSE;
-
-		l = g_list_remove(l, ms);
 
 		if (is_msg_unseen(msgs->seen_msgs, id)) {
 			gboolean new_msg = FALSE;
 			/* Only treat it as a new message if it is the last one,
 			 * and it was sent within the last day */
-			if (!l && !msgs->fetch_until && ms->tm.tv_sec + 86400 < time(NULL))
+			if (final && last && tm + 86400 < time(NULL))
 				new_msg = TRUE;
 
-			seen_one = TRUE;
-			msgs->cb(cxn, msgs, node, ms->tm.tv_sec, new_msg);
-		}
-		g_free(ms);
+			msgs->cb(cxn, msgs, node, tm, new_msg);
 
-		/* Last message, note down the received time */
-		if (!l && !msgs->msgs_failed && seen_one) {
-			const gchar *tm;
-			if (parse_string(node, "CreatedOn", &tm))
-				chime_update_last_msg(cxn, msgs, tm, id);
+			/* Last message so far; note down its time once all is fetched */
+			if (last) {
+				if (msgs->fetch_last)
+					json_node_unref(msgs->fetch_last);
+				msgs->fetch_last = json_node_ref(node);
+			}
 		}
 		json_node_unref(node);
 	}
-
-	if (!msgs->fetch_until)
-		g_clear_pointer(&msgs->msg_gather, g_hash_table_destroy);
+	g_array_free(take.arr, TRUE);
 }
 
-
-static gboolean msg_newer_than(JsonNode *new, const gchar *old_date)
+void chime_complete_messages(ChimeConnection *cxn, struct chime_msgs *msgs)
 {
-	const gchar *new_updated = NULL;
+	deliver_gathered(cxn, msgs, G_MAXINT64, TRUE);
 
-	if (!parse_string(new, "UpdatedOn", &new_updated))
-		return FALSE;
-
-	GTimeVal old_tv, new_tv;
-	if (!g_time_val_from_iso8601(new_updated, &new_tv) ||
-	    !g_time_val_from_iso8601(old_date, &old_tv))
-		return FALSE;
+	if (msgs->fetch_last) {
+		const gchar *created, *id;
 
-	if (new_tv.tv_sec > old_tv.tv_sec ||
-	    (new_tv.tv_sec == old_tv.tv_sec && new_tv.tv_usec > old_tv.tv_usec))
-		return TRUE;
+		if (!msgs->msgs_failed && parse_string(msgs->fetch_last, "CreatedOn", &created) &&
+		    parse_string(msgs->fetch_last, "MessageId", &id))
+			chime_update_last_msg(cxn, msgs, created, id);
+		g_clear_pointer(&msgs->fetch_last, json_node_unref);
+	}
 
-	return FALSE;
+	g_clear_pointer(&msgs->msg_gather, g_hash_table_destroy);
+	chime_msgstore_end(msgs->store);
 }
 
-static gboolean msg_newer(JsonNode *new, JsonNode *old)
-{
-	const gchar *old_updated = NULL;
-
-	if (!parse_string(old, "UpdatedOn", &old_updated))
-		return TRUE;
-
-	return msg_newer_than(new, old_updated);
-}
 
 static void on_message_received(ChimeObject *obj, JsonNode *node, struct chime_msgs *msgs)
 {
@@ -160,21 +174,25 @@ static void on_message_received(ChimeObject *obj, JsonNode *node, struct chime_m
 	if (!parse_string(node, "MessageId", &id))
 		return;
 	if (msgs->msg_gather) {
-		/* If we're still fetching ancient messages and a new message comes
-		 * in, then ignore it. We'll fetch it again when our fetch reaches
-		 * the present day. */
-		if (msgs->fetch_until && msg_newer_than(node, msgs->fetch_until))
-			return;
+		struct gathered_msg *gm;
+		gint64 updated = 0;
+
+		chime_msgstore_add(msgs->store, node, FALSE);
 
 		/* Still gathering messages. Add to the table, to avoid dupes */
-		JsonNode *old_node = g_hash_table_lookup(msgs->msg_gather, id);
-		if (old_node) {
-			if (!msg_newer(node, old_node))
+		parse_timestamp(node, "UpdatedOn", NULL, &updated);
+		gm = g_hash_table_lookup(msgs->msg_gather, id);
+		if (gm) {
+			if (gm->updated && updated <= gm->updated)
 				return;
 			/* Remove first because the key belongs to the value */
 			g_hash_table_remove(msgs->msg_gather, id);
 		}
-		g_hash_table_insert(msgs->msg_gather, (gchar *)id, json_node_ref(node));
+		gm = g_new0(struct gathered_msg, 1);
+		gm->node = json_node_ref(node);
+		gm->updated = updated;
+		parse_timestamp(node, "CreatedOn", NULL, &gm->created);
+		g_hash_table_insert(msgs->msg_gather, (gchar *)id, gm);
 		return;
 	}
 	GTimeVal tv;
@@ -182,6 +200,8 @@ static void on_message_received(ChimeObject *obj, JsonNode *node, struct chime_m
 	if (!parse_time(node, "CreatedOn", &created, &tv))
 		return;
 
+	chime_msgstore_add(msgs->store, node, !msgs->msgs_failed);
+
 	if (!msgs->msgs_failed)
 		chime_update_last_msg(cxn, msgs, created, id);
 
@@ -189,11 +209,118 @@ static void on_message_received(ChimeObject *obj, JsonNode *node, struct chime_m
 		msgs->cb(cxn, msgs, node, tv.tv_sec, TRUE);
 }
 
+/*
+ * History is fetched in FETCH_TIME_CHUNK windows, several at a time. The
+ * newest, open-ended window goes first since that's the one the user
+ * most cares about, and it also covers any live messages which arrive
+ * while we're fetching. The results all land in msgs->msg_gather. They
+ * have to be shown in time order though, so each time a window completes,
+ * whatever is older than all the windows still outstanding is sorted and
+ * delivered; the rest waits for its turn. The older windows are fetched
+ * oldest first, so history fills in from the top while the newest window
+ * is held back until the end.
+ */
+struct fetch_window {
+	struct chime_msgs *msgs;
+	gchar *after;
+	gchar *before;
+	gint64 after_time;
+};
+
+static void fetch_msgs_cb(GObject *source, GAsyncResult *result, gpointer _win);
+
+static void free_fetch_window(struct fetch_window *win)
+{
+	g_free(win->after);
+	g_free(win->before);
+	g_free(win);
+}
+
+static void queue_fetch_window(struct chime_msgs *msgs, gboolean newest,
+			       const gchar *after, gchar *before)
+{
+	struct fetch_window *win = g_new0(struct fetch_window, 1);
+
+	win->msgs = msgs;
+	win->after = g_strdup(after);
+	win->before = before;
+	/* If we can't tell, it holds everything back until it's done */
+	if (!after || !chime_parse_iso8601(after, &win->after_time))
+		win->after_time = 0;
+
+	if (newest)
+		g_queue_push_head(msgs->fetch_windows, win);
+	else
+		g_queue_push_tail(msgs->fetch_windows, win);
+}
+
+/* Split the time from 'after' until now into windows. The boundaries
+ * are counted from 'start', which may be later than 'after' if we don't
+ * have a 'last seen' time and are starting from the room's creation. */
+static void queue_fetch_windows(struct chime_msgs *msgs, const gchar *after,
+				const gchar *start)
+{
+	gchar *next_after = g_strdup(after);
+	GTimeVal before_tv;
+
+	if (g_time_val_from_iso8601(start, &before_tv)) {
+		while ((before_tv.tv_sec += FETCH_TIME_CHUNK) < time(NULL) - 86400) {
+			gchar *before = g_time_val_to_iso8601(&before_tv);
+
+			queue_fetch_window(msgs, FALSE, next_after, before);
+			g_free(next_after);
+			next_after = g_strdup(before);
+		}
+	}
+	queue_fetch_window(msgs, TRUE, next_after, NULL);
+	g_free(next_after);
+}
+
+static void start_fetches(ChimeConnection *cxn, struct chime_msgs *msgs)
+{
+	int max = purple_account_get_int(msgs->conn->account, "history-fetches",
+					 FETCH_PARALLEL_DEFAULT);
+	struct fetch_window *win;
+
+	while (msgs->fetches_running.length < MAX(max, 1) &&
+	       (win = g_queue_pop_head(msgs->fetch_windows))) {
+		purple_debug(PURPLE_DEBUG_INFO, "chime", "Fetch messages for %s from %s until %s\n",
+			     chime_object_get_name(msgs->obj), win->after, win->before);
+		g_queue_push_tail(&msgs->fetches_running, win);
+		chime_connection_fetch_messages_async(cxn, msgs->obj, win->before, win->after,
+						      NULL, fetch_msgs_cb, win);
+	}
+}
+
+/* Deliver whatever is older than every window still outstanding, so that
+ * history shows up a window at a time without waiting for all of it. */
+static void deliver_fetched(ChimeConnection *cxn, struct chime_msgs *msgs)
+{
+	gint64 until = G_MAXINT64;
+	GList *l;
+
+	if (!msgs->members_done || !msgs->msg_gather)
+		return;
+
+	for (l = msgs->fetch_windows->head; l; l = l->next)
+		until = MIN(until, ((struct fetch_window *)l->data)->after_time);
+	for (l = msgs->fetches_running.head; l; l = l->next)
+		until = MIN(until, ((struct fetch_window *)l->data)->after_time);
+
+	/* Once nothing is outstanding, chime_complete_messages() does the rest */
+	if (until && until != G_MAXINT64)
+		deliver_gathered(cxn, msgs, until, FALSE);
+}
+
 /* Once the message fetching is complete, we can play the fetched messages in order */
-static void fetch_msgs_cb(GObject *source, GAsyncResult *result, gpointer _msgs)
+static void fetch_msgs_cb(GObject *source, GAsyncResult *result, gpointer _win)
 {
 	ChimeConnection *cxn = CHIME_CONNECTION(source);
-	struct chime_msgs *msgs = _msgs;
+	struct fetch_window *win = _win;
+	struct chime_msgs *msgs = win->msgs;
+
+	g_queue_remove(&msgs->fetches_running, win);
+	free_fetch_window(win);
 
 	GError *error = NULL;
 	if (!chime_connection_fetch_messages_finish(cxn, result, &error)) {
@@ -205,37 +332,28 @@ static void fetch_msgs_cb(GObject *source, GAsyncResult *result, gpointer _msgs)
 	}
 
 	/* If cleanup_msgs() was already called, it will have left the
-	 * struct to be freed here. */
+	 * struct to be freed by the last outstanding fetch. */
 	if (!msgs->obj) {
-		free(msgs);
+		if (g_queue_is_empty(&msgs->fetches_running))
+			g_free(msgs);
 		return;
 	}
 
-	/* If we have the member list, we can sort and deliver this batch of messages. */
-	if (msgs->members_done)
-		chime_complete_messages(cxn, msgs);
-
-	if (msgs->fetch_until) {
-		/* Fetch the next batch */
-		gchar *next_after = msgs->fetch_until;
-		GTimeVal before_tv;
-
-		g_time_val_from_iso8601(msgs->fetch_until, &before_tv);
-		before_tv.tv_sec += FETCH_TIME_CHUNK;
-		if (before_tv.tv_sec < time(NULL) - 86400)
-			msgs->fetch_until = g_time_val_to_iso8601(&before_tv);
-		else
-			msgs->fetch_until = NULL;
-		purple_debug(PURPLE_DEBUG_INFO, "chime", "Fetch more messages from %s until %s\n", next_after, msgs->fetch_until);
-		chime_connection_fetch_messages_async(cxn, msgs->obj, msgs->fetch_until,
-						      next_after, NULL, fetch_msgs_cb, msgs);
-		g_free(next_after);
+	start_fetches(cxn, msgs);
+	if (!g_queue_is_empty(&msgs->fetches_running)) {
+		deliver_fetched(cxn, msgs);
+		return;
+	}
 
+	msgs->msgs_done = TRUE;
 
-	} else {
-		msgs->msgs_done = TRUE;
-	}
+	/* The local store now has everything up to the present */
+	if (!msgs->msgs_failed)
+		chime_msgstore_mark_synced(msgs->store);
 
+	/* If we have the member list, we can sort and deliver the messages. */
+	if (msgs->members_done)
+		chime_complete_messages(cxn, msgs);
 }
 
 static void on_room_members_done(ChimeRoom *room, struct chime_msgs *msgs)
@@ -245,6 +363,8 @@ static void on_room_members_done(ChimeRoom *room, struct chime_msgs *msgs)
 	msgs->members_done = TRUE;
 	if (msgs->msgs_done)
 		chime_complete_messages(cxn, msgs);
+	else
+		deliver_fetched(cxn, msgs);
 }
 
 static void on_last_sent_updated(ChimeObject *obj, GParamSpec *ignored, struct chime_msgs *msgs)
@@ -260,20 +380,31 @@ static void on_last_sent_updated(ChimeObject *obj, GParamSpec *ignored, struct c
 		purple_debug(PURPLE_DEBUG_INFO, "chime", "Fetch messages for %s; LastSent updated to %s\n",
 			     chime_object_get_id(msgs->obj), last_sent);
 
-		chime_connection_fetch_messages_async(PURPLE_CHIME_CXN(msgs->conn), obj, NULL, msgs->last_seen, NULL, fetch_msgs_cb, msgs);
 		msgs->msgs_done = FALSE;
-		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)json_node_unref);
+		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_gathered_msg);
+		chime_msgstore_begin(msgs->store);
+		queue_fetch_window(msgs, TRUE, msgs->last_seen, NULL);
+		start_fetches(PURPLE_CHIME_CXN(msgs->conn), msgs);
 	}
 
 	g_free(last_sent);
 }
 
+static void replay_stored_msg(JsonNode *node, gpointer _msgs)
+{
+	struct chime_msgs *msgs = _msgs;
+
+	on_message_received(msgs->obj, node, msgs);
+}
+
 void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj, chime_msg_cb cb, const gchar *name, JsonNode *first_msg)
 {
 	msgs->conn = conn;
 	msgs->obj = g_object_ref(obj);
 	msgs->cb = cb;
 	msgs->seen_msgs = g_queue_new();
+	msgs->fetch_windows = g_queue_new();
+	msgs->store = chime_msgstore_open(conn, obj);
 
 	const gchar *last_seen = NULL;
 	gchar *last_id = NULL;
@@ -285,6 +416,15 @@ void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj
 		g_free(last_id);
 	}
 
+	/* If the local store has messages after the last one we showed,
+	 * play them from disk and only ask the server for what's newer. */
+	gint64 last_seen_time = 0, synced_time = 0;
+	gchar *synced = chime_msgstore_get_synced(msgs->store, &synced_time);
+	chime_parse_iso8601(msgs->last_seen, &last_seen_time);
+	if (synced && synced_time <= last_seen_time)
+		g_clear_pointer(&synced, g_free);
+	const gchar *fetch_from = synced ? : msgs->last_seen;
+
 	g_signal_connect(obj, "notify::last-sent", G_CALLBACK(on_last_sent_updated), msgs);
 	g_signal_connect(obj, "message", G_CALLBACK(on_message_received), msgs);
 
@@ -296,18 +436,15 @@ void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj
 		msgs->members_done = TRUE;
 
 		/* Do we need to fetch new messages? */
-		gchar *last_sent;
-		g_object_get(obj, "last-sent", &last_sent, NULL);
+		gint64 last_sent = chime_conversation_get_last_sent_time(CHIME_CONVERSATION(obj));
 
-		if (!last_sent || ! strcmp(msgs->last_seen, last_sent))
+		if (!last_sent || last_sent == last_seen_time ||
+		    (synced && last_sent <= synced_time))
 			msgs->msgs_done = TRUE;
-
-		g_free(last_sent);
 	}
 
 	if (!msgs->msgs_done) {
-		GTimeVal before_tv;
-		const gchar *start_from = last_seen;
+		const gchar *start_from = synced ? : last_seen;
 
 		if (!start_from) {
 			if (CHIME_IS_ROOM(obj))
@@ -315,18 +452,24 @@ void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj
 			else
 				start_from = chime_conversation_get_created_on(CHIME_CONVERSATION(obj));
 		}
-		if (g_time_val_from_iso8601(start_from, &before_tv)) {
-			before_tv.tv_sec += FETCH_TIME_CHUNK;
-			if (before_tv.tv_sec < time(NULL) - 86400)
-				msgs->fetch_until = g_time_val_to_iso8601(&before_tv);
-		}
-		purple_debug(PURPLE_DEBUG_INFO, "chime", "Fetch messages for %s from %s until %s\n", name, msgs->last_seen, msgs->fetch_until);
-		chime_connection_fetch_messages_async(PURPLE_CHIME_CXN(conn), obj, msgs->fetch_until,
-						      msgs->last_seen, NULL, fetch_msgs_cb, msgs);
+		queue_fetch_windows(msgs, fetch_from, start_from);
+		purple_debug(PURPLE_DEBUG_INFO, "chime", "Fetch messages for %s from %s in %u windows\n",
+			     name, fetch_from, g_queue_get_length(msgs->fetch_windows));
+		start_fetches(PURPLE_CHIME_CXN(conn), msgs);
 	}
 
-	if (!msgs->msgs_done || !msgs->members_done)
-		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)json_node_unref);
+	if (!msgs->msgs_done || !msgs->members_done || synced) {
+		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_gathered_msg);
+		chime_msgstore_begin(msgs->store);
+	}
+
+	if (synced) {
+		chime_msgstore_replay(msgs->store, last_seen_time, replay_stored_msg, msgs);
+		g_free(synced);
+
+		if (msgs->msgs_done && msgs->members_done)
+			chime_complete_messages(PURPLE_CHIME_CXN(conn), msgs);
+	}
 
 	if (first_msg)
 		on_message_received(obj, first_msg, msgs);
@@ -342,15 +485,18 @@ void cleanup_msgs(struct chime_msgs *msgs)
 
 	/* Caller disconnects all signals with 'msgs' as user_data */
 	g_clear_pointer(&msgs->last_seen, g_free);
+	g_clear_pointer(&msgs->store, chime_msgstore_close);
 	g_clear_object(&msgs->obj);
-	g_free(msgs->fetch_until);
-	/* If msgs->msgs_done then we can free immediately. This
-	 * actually frees the entire containing chat/im struct, not
+	g_queue_free_full(msgs->fetch_windows, (GDestroyNotify)free_fetch_window);
+	msgs->fetch_windows = NULL;
+	g_clear_pointer(&msgs->fetch_last, json_node_unref);
+	/* If no fetches are outstanding then we can free immediately.
+	 * This actually frees the entire containing chat/im struct, not
 	 * just the msgs. Otherwise, fetch_msgs_cb() is still pending
-	 * so we need to defer the free until it happens. Even on an
-	 * account disconnect, fetch_msgs_cb() will get called with a
-	 * failure result. */
-	if (msgs->msgs_done)
+	 * so we need to defer the free until the last one happens. Even
+	 * on an account disconnect, fetch_msgs_cb() will get called with
+	 * a failure result. */
+	if (g_queue_is_empty(&msgs->fetches_running))
 		g_free(msgs);
 }
 
@@ -0,0 +1,549 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2017 Amazon.com, Inc. or its affiliates.
+ *
+ * Author: David Woodhouse <dwmw2@infradead.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#include <debug.h>
+
+#include "chime.h"
+
+/*
+ * Local append-only message store, one file per room/conversation.
+ *
+ * Every message we see, fetched or live, is appended as a fixed header
+ * followed by its MessageId and the JSON record the server gave us. Edits
+ * are just appended again with a newer UpdatedOn, and the newest wins when
+ * we build the index.
+ *
+ * We also track 'synced': the CreatedOn time up to which the store is
+ * known to hold *every* message. It advances when a fetch completes
+ * successfully, and with each live message received after that. Anything
+ * before it can be served from disk, and the next fetch need only ask
+ * the server for what came after it.
+ *
+ * There's a store for every room and conversation, so nothing is held
+ * open between writes. Opening just scans the record headers for 'synced';
+ * the MessageId index is only built for a batch (the replay and fetch
+ * when a chat is set up), and dropped again at the end of it, when the
+ * file also gets rewritten if enough of it has been superseded.
+ */
+
+#define MSGSTORE_SYNCED		1	/* Store is complete up to this record */
+
+/* Write out a batch's records once they get to this size */
+#define MSGSTORE_BATCH_MAX	(256 * 1024)
+
+/* Rewrite the file once this many records are stale, and they're at
+ * least a third of it */
+#define MSGSTORE_COMPACT_MIN	256
+
+struct msgstore_rec {
+	guint32 json_len;
+	guint16 id_len;
+	guint16 flags;
+	gint64 created;
+	gint64 updated;
+};
+
+struct msgstore_entry {
+	gint64 created;
+	gint64 updated;
+	goffset offset;		/* Of the JSON */
+	guint32 len;
+};
+
+struct chime_msgstore {
+	gchar *path;
+	goffset file_len;	/* Written so far, not counting 'pending' */
+	GString *pending;	/* Records waiting to be written */
+	GHashTable *index;	/* MessageId → struct msgstore_entry, during a batch */
+	guint nr_recs;		/* Message records on file, superseded or not */
+	gint64 synced;
+	gint64 newest;
+	gboolean in_batch;
+	gboolean write_failed;
+};
+
+static gint64 msg_time(JsonNode *node, const gchar *member)
+{
+	gint64 usec;
+
+	if (!parse_timestamp(node, member, NULL, &usec))
+		return 0;
+
+	return usec;
+}
+
+static void index_msg(struct chime_msgstore *store, const gchar *id, gsize id_len,
+		      const struct msgstore_rec *rec, goffset offset)
+{
+	struct msgstore_entry *e;
+
+	if (rec->created > store->newest)
+		store->newest = rec->created;
+
+	if ((rec->flags & MSGSTORE_SYNCED) && rec->created > store->synced)
+		store->synced = rec->created;
+
+	/* A bare 'synced' marker */
+	if (!id_len)
+		return;
+
+	store->nr_recs++;
+	if (!store->index)
+		return;
+
+	gchar *key = g_strndup(id, id_len);
+	e = g_hash_table_lookup(store->index, key);
+	if (e) {
+		g_free(key);
+		if (rec->updated < e->updated)
+			return;
+	} else {
+		e = g_new0(struct msgstore_entry, 1);
+		g_hash_table_insert(store->index, key, e);
+	}
+	e->created = rec->created;
+	e->updated = rec->updated;
+	e->offset = offset;
+	e->len = rec->json_len;
+}
+
+static GMappedFile *map_store(struct chime_msgstore *store)
+{
+	GError *error = NULL;
+	GMappedFile *map;
+
+	map = g_mapped_file_new(store->path, FALSE, &error);
+	if (!map) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			purple_debug(PURPLE_DEBUG_WARNING, "chime", "Failed to open message store %s: %s\n",
+				     store->path, error->message);
+		g_clear_error(&error);
+	}
+	return map;
+}
+
+/* Walk the record headers, and fill in the index if there is one */
+static void scan_store(struct chime_msgstore *store)
+{
+	GMappedFile *map;
+	const gchar *data;
+	gsize len, off = 0;
+
+	store->nr_recs = 0;
+	store->file_len = 0;
+
+	map = map_store(store);
+	if (!map)
+		return;
+
+	data = g_mapped_file_get_contents(map);
+	len = g_mapped_file_get_length(map);
+
+	while (len - off >= sizeof(struct msgstore_rec)) {
+		struct msgstore_rec rec;
+
+		memcpy(&rec, data + off, sizeof(rec));
+		rec.json_len = GUINT32_FROM_LE(rec.json_len);
+		rec.id_len = GUINT16_FROM_LE(rec.id_len);
+		rec.flags = GUINT16_FROM_LE(rec.flags);
+		rec.created = GINT64_FROM_LE(rec.created);
+		rec.updated = GINT64_FROM_LE(rec.updated);
+
+		if (len - off - sizeof(rec) < (gsize)rec.id_len + rec.json_len)
+			break;
+
+		index_msg(store, data + off + sizeof(rec), rec.id_len, &rec,
+			  off + sizeof(rec) + rec.id_len);
+		off += sizeof(rec) + rec.id_len + rec.json_len;
+	}
+	g_mapped_file_unref(map);
+
+	/* Drop any partial record left by a crash, or we'd append after it */
+	if (off != len) {
+		purple_debug(PURPLE_DEBUG_WARNING, "chime", "Truncating damaged message store %s at %" G_GSIZE_FORMAT "\n",
+			     store->path, off);
+		if (truncate(store->path, off))
+			purple_debug(PURPLE_DEBUG_WARNING, "chime", "Failed to truncate %s: %s\n",
+				     store->path, g_strerror(errno));
+	}
+	store->file_len = off;
+}
+
+struct chime_msgstore *chime_msgstore_open(PurpleConnection *conn, ChimeObject *obj)
+{
+	struct chime_msgstore *store = g_new0(struct chime_msgstore, 1);
+	gchar *fname = g_strdup_printf("%s-%s", CHIME_IS_ROOM(obj) ? "room" : "conversation",
+				       chime_object_get_id(obj));
+
+	store->path = g_build_filename(purple_user_dir(), "chime",
+				       purple_account_get_username(conn->account),
+				       "messages", fname, NULL);
+	g_free(fname);
+
+	store->pending = g_string_new(NULL);
+
+	scan_store(store);
+	return store;
+}
+
+/* Open, append and close again; we don't hold a file open per store */
+static gboolean write_pending(struct chime_msgstore *store)
+{
+	gboolean ok = FALSE;
+	gchar *dir;
+	FILE *f;
+
+	if (!store->pending->len)
+		return TRUE;
+
+	if (store->write_failed)
+		goto out;
+
+	dir = g_path_get_dirname(store->path);
+	f = g_mkdir_with_parents(dir, 0700) ? NULL : g_fopen(store->path, "ab");
+	g_free(dir);
+	if (!f) {
+		purple_debug(PURPLE_DEBUG_WARNING, "chime", "Failed to open %s for append: %s\n",
+			     store->path, g_strerror(errno));
+		goto out;
+	}
+
+	ok = fwrite(store->pending->str, 1, store->pending->len, f) == store->pending->len;
+	if (fclose(f))
+		ok = FALSE;
+	if (!ok) {
+		purple_debug(PURPLE_DEBUG_WARNING, "chime", "Failed to write to %s: %s\n",
+			     store->path, g_strerror(errno));
+		/* Don't write anything after a partial record. It'll
+		 * get truncated next time we open it. */
+		store->write_failed = TRUE;
+		goto out;
+	}
+	store->file_len += store->pending->len;
+ out:
+	/* Entries for records that didn't make it would point past the end */
+	if (!ok)
+		g_clear_pointer(&store->index, g_hash_table_destroy);
+	g_string_truncate(store->pending, 0);
+	return ok;
+}
+
+static void put_rec(GString *buf, const struct msgstore_rec *rec,
+		    const gchar *id, const gchar *json)
+{
+	struct msgstore_rec le_rec;
+
+	le_rec.json_len = GUINT32_TO_LE(rec->json_len);
+	le_rec.id_len = GUINT16_TO_LE(rec->id_len);
+	le_rec.flags = GUINT16_TO_LE(rec->flags);
+	le_rec.created = GINT64_TO_LE(rec->created);
+	le_rec.updated = GINT64_TO_LE(rec->updated);
+
+	g_string_append_len(buf, (gchar *)&le_rec, sizeof(le_rec));
+	if (rec->id_len)
+		g_string_append_len(buf, id, rec->id_len);
+	if (rec->json_len)
+		g_string_append_len(buf, json, rec->json_len);
+}
+
+static gboolean append_rec(struct chime_msgstore *store, struct msgstore_rec *rec,
+			   const gchar *id, const gchar *json, goffset *json_offset)
+{
+	if (store->write_failed)
+		return FALSE;
+
+	*json_offset = store->file_len + store->pending->len + sizeof(*rec) + rec->id_len;
+	put_rec(store->pending, rec, id, json);
+
+	/* Outside a batch, each record is a batch of its own */
+	if (!store->in_batch || store->pending->len >= MSGSTORE_BATCH_MAX)
+		return write_pending(store);
+
+	return TRUE;
+}
+
+struct compact_msg {
+	const gchar *id;
+	const struct msgstore_entry *e;
+};
+
+static gint compare_offset(gconstpointer _a, gconstpointer _b)
+{
+	const struct compact_msg *a = _a, *b = _b;
+
+	return (a->e->offset > b->e->offset) - (a->e->offset < b->e->offset);
+}
+
+/* Rewrite the file with just the newest version of each message. The
+ * index offsets are stale afterwards, so the caller drops it. */
+static void compact_store(struct chime_msgstore *store)
+{
+	struct msgstore_rec rec = { 0 };
+	GHashTableIter iter;
+	gpointer key, val;
+	GError *error = NULL;
+	GMappedFile *map;
+	GArray *msgs;
+	GString *buf;
+	guint i;
+
+	map = map_store(store);
+	if (!map)
+		return;
+
+	const gchar *data = g_mapped_file_get_contents(map);
+	gsize len = g_mapped_file_get_length(map);
+
+	msgs = g_array_sized_new(FALSE, FALSE, sizeof(struct compact_msg),
+				 g_hash_table_size(store->index));
+	g_hash_table_iter_init(&iter, store->index);
+	while (g_hash_table_iter_next(&iter, &key, &val)) {
+		struct compact_msg cm = { key, val };
+
+		if (cm.e->offset + cm.e->len <= len)
+			g_array_append_val(msgs, cm);
+	}
+	/* Keep them in the order they were first written */
+	g_array_sort(msgs, compare_offset);
+
+	buf = g_string_sized_new(len);
+	for (i = 0; i < msgs->len; i++) {
+		const struct compact_msg *cm = &g_array_index(msgs, struct compact_msg, i);
+
+		rec.json_len = cm->e->len;
+		rec.id_len = strlen(cm->id);
+		rec.created = cm->e->created;
+		rec.updated = cm->e->updated;
+		put_rec(buf, &rec, cm->id, data + cm->e->offset);
+	}
+	if (store->synced) {
+		memset(&rec, 0, sizeof(rec));
+		rec.created = store->synced;
+		rec.flags = MSGSTORE_SYNCED;
+		put_rec(buf, &rec, NULL, NULL);
+	}
+	g_mapped_file_unref(map);
+
+	/* This writes a temporary file and renames it over the old one */
+	if (g_file_set_contents(store->path, buf->str, buf->len, &error)) {
+		purple_debug(PURPLE_DEBUG_INFO, "chime", "Compacted %s from %u to %u messages\n",
+			     store->path, store->nr_recs, msgs->len);
+		store->file_len = buf->len;
+		store->nr_recs = msgs->len;
+	} else {
+		purple_debug(PURPLE_DEBUG_WARNING, "chime", "Failed to compact %s: %s\n",
+			     store->path, error->message);
+		g_clear_error(&error);
+	}
+
+	g_string_free(buf, TRUE);
+	g_array_free(msgs, TRUE);
+}
+
+/*
+ * A batch is the replay and fetch when a chat is set up, or a refetch.
+ * Within it, records are buffered and written out together, and the
+ * index is there to spot messages we already have.
+ */
+void chime_msgstore_begin(struct chime_msgstore *store)
+{
+	if (!store || store->in_batch)
+		return;
+
+	store->in_batch = TRUE;
+	if (!store->index) {
+		write_pending(store);
+		store->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		scan_store(store);
+		purple_debug(PURPLE_DEBUG_INFO, "chime", "Indexed %u messages from %s\n",
+			     g_hash_table_size(store->index), store->path);
+	}
+}
+
+void chime_msgstore_end(struct chime_msgstore *store)
+{
+	if (!store || !store->in_batch)
+		return;
+
+	store->in_batch = FALSE;
+	if (write_pending(store) && store->index) {
+		guint live = g_hash_table_size(store->index);
+		guint stale = store->nr_recs - live;
+
+		if (stale >= MSGSTORE_COMPACT_MIN && stale * 2 >= live)
+			compact_store(store);
+	}
+	g_clear_pointer(&store->index, g_hash_table_destroy);
+}
+
+void chime_msgstore_close(struct chime_msgstore *store)
+{
+	if (!store)
+		return;
+
+	write_pending(store);
+	g_clear_pointer(&store->index, g_hash_table_destroy);
+	g_string_free(store->pending, TRUE);
+	g_free(store->path);
+	g_free(store);
+}
+
+/* Returns FALSE if we already had this version of the message. Outside a
+ * batch there's no index, so it gets written regardless. */
+gboolean chime_msgstore_add(struct chime_msgstore *store, JsonNode *node, gboolean synced)
+{
+	struct msgstore_rec rec = { 0 };
+	struct msgstore_entry *e;
+	const gchar *id;
+	goffset offset;
+
+	if (!store || !parse_string(node, "MessageId", &id))
+		return FALSE;
+
+	rec.created = msg_time(node, "CreatedOn");
+	rec.updated = msg_time(node, "UpdatedOn");
+	rec.id_len = strlen(id);
+	if (synced)
+		rec.flags |= MSGSTORE_SYNCED;
+
+	if (store->index) {
+		e = g_hash_table_lookup(store->index, id);
+		if (e && rec.updated <= e->updated)
+			return FALSE;
+	}
+
+	JsonGenerator *gen = json_generator_new();
+	json_generator_set_root(gen, node);
+	gsize json_len;
+	gchar *json = json_generator_to_data(gen, &json_len);
+	g_object_unref(gen);
+
+	rec.json_len = json_len;
+	if (append_rec(store, &rec, id, json, &offset))
+		index_msg(store, id, rec.id_len, &rec, offset);
+
+	g_free(json);
+	return TRUE;
+}
+
+/* Everything we've stored so far is complete; there are no gaps. */
+void chime_msgstore_mark_synced(struct chime_msgstore *store)
+{
+	struct msgstore_rec rec = { 0 };
+	goffset offset;
+
+	if (!store || store->synced >= store->newest)
+		return;
+
+	rec.created = store->newest;
+	rec.flags = MSGSTORE_SYNCED;
+	if (append_rec(store, &rec, NULL, NULL, &offset))
+		store->synced = store->newest;
+}
+
+/* In the same form the server uses, so it can be compared with LastSent etc. */
+gchar *chime_msgstore_get_synced(struct chime_msgstore *store, gint64 *synced)
+{
+	if (!store || !store->synced)
+		return NULL;
+
+	if (synced)
+		*synced = store->synced;
+
+	GDateTime *dt = g_date_time_new_from_unix_utc(store->synced / G_USEC_PER_SEC);
+	gchar *date = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%S");
+	gchar *ret = g_strdup_printf("%s.%03dZ", date,
+				     (int)(store->synced % G_USEC_PER_SEC) / 1000);
+	g_free(date);
+	g_date_time_unref(dt);
+	return ret;
+}
+
+struct replay_msg {
+	gint64 created;
+	const struct msgstore_entry *e;
+};
+
+static gint compare_replay(gconstpointer _a, gconstpointer _b)
+{
+	const struct replay_msg *a = _a, *b = _b;
+
+	return (a->created > b->created) - (a->created < b->created);
+}
+
+/*
+ * Feed stored messages created after 'since' (and up to the point where
+ * the store is known complete) to 'cb', in order. Only within a batch,
+ * since it needs the index.
+ */
+guint chime_msgstore_replay(struct chime_msgstore *store, gint64 since,
+			    chime_msgstore_cb cb, gpointer cb_data)
+{
+	GMappedFile *map;
+	const gchar *data;
+	GHashTableIter iter;
+	gpointer val;
+	GArray *msgs;
+	gsize len;
+	guint i, count = 0;
+
+	if (!store || !store->index || !write_pending(store))
+		return 0;
+
+	map = map_store(store);
+	if (!map)
+		return 0;
+
+	data = g_mapped_file_get_contents(map);
+	len = g_mapped_file_get_length(map);
+
+	msgs = g_array_new(FALSE, FALSE, sizeof(struct replay_msg));
+	g_hash_table_iter_init(&iter, store->index);
+	while (g_hash_table_iter_next(&iter, NULL, &val)) {
+		struct replay_msg rm = { ((struct msgstore_entry *)val)->created, val };
+
+		if (rm.created > since && rm.created <= store->synced &&
+		    rm.e->offset + rm.e->len <= len)
+			g_array_append_val(msgs, rm);
+	}
+	g_array_sort(msgs, compare_replay);
+
+	JsonParser *parser = json_parser_new();
+	for (i = 0; i < msgs->len; i++) {
+		const struct msgstore_entry *e = g_array_index(msgs, struct replay_msg, i).e;
+
+		if (json_parser_load_from_data(parser, data + e->offset, e->len, NULL)) {
+			cb(json_parser_get_root(parser), cb_data);
+			count++;
+		}
+	}
+	g_object_unref(parser);
+	g_array_free(msgs, TRUE);
+	g_mapped_file_unref(map);
+
+	purple_debug(PURPLE_DEBUG_INFO, "chime", "Replayed %u messages from %s\n",
+		     count, store->path);
+	return count;
+}
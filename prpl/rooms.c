@@ -34,7 +34,7 @@ struct room_sort {
 	struct room_sort *next;
 	gboolean unread;
 	gboolean mention;
-	GTimeVal when;
+	gint64 when;		/* LastSent, or CreatedOn if none */
 	ChimeRoom *room;
 };
 
@@ -44,30 +44,21 @@ static gboolean cmp_room(struct room_sort *a, struct room_sort *b)
 		return a->mention;
 	if (a->unread != b->unread)
 		return a->unread;
-	if (a->when.tv_sec > b->when.tv_sec)
-		return TRUE;
-	if (a->when.tv_sec == b->when.tv_sec &&
-	    a->when.tv_usec > b->when.tv_sec)
-		return TRUE;
-	return FALSE;
+	return a->when > b->when;
 }
 
 static void sort_room(ChimeConnection *cxn, ChimeRoom *room, gpointer _rs_list)
 {
 	struct room_sort **rs_list = _rs_list;
 	struct room_sort *rs = g_new0(struct room_sort, 1);
-	const char *tm;
 
 	rs->room = room;
 	rs->unread = chime_room_has_unread(room);
 	rs->mention = chime_room_has_mention(room);
 
-	tm = chime_room_get_last_sent(room);
-	if (!tm || !g_time_val_from_iso8601(tm, &rs->when)) {
-		tm = chime_room_get_created_on(room);
-		if (tm)
-			g_time_val_from_iso8601(tm, &rs->when);
-	}
+	rs->when = chime_room_get_last_sent_time(room);
+	if (!rs->when)
+		rs->when = chime_room_get_created_on_time(room);
 	while (*rs_list && cmp_room(*rs_list, rs))
 		rs_list = &((*rs_list)->next);
 	rs->next = *rs_list;